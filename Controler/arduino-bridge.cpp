@@ -1,6 +1,8 @@
 #include "arduino-bridge.hpp"
 #include "thread-queue.hpp"
 
+#include "../driver/protocol.h"
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -17,6 +19,7 @@
 #include <stdexcept>
 #include <iostream>
 #include <unordered_map>
+#include <deque>
 
 ArduinoBridge::ArduinoBridge(const char* host, const char* port) :
   host{host}, port{port}, is_active{ATOMIC_FLAG_INIT}, shutdown{ATOMIC_FLAG_INIT}
@@ -27,6 +30,9 @@ ArduinoBridge::ArduinoBridge(const char* host, const char* port) :
 }
 ArduinoBridge::~ArduinoBridge()
 {
+  kill();
+  if (sending_thread.joinable())
+    sending_thread.join();
   close(socket_fd);
 }
 
@@ -44,36 +50,67 @@ void ArduinoBridge::callback(ArduinoBridge* bridge)
 
       std::cout << '\b' << "Connection accepted" << '\n';
 
-      std::unordered_map<size_t, packet_t> pending_objects;
+      lane_t lanes[PRIORITIES_COUNT];
+      size_t served_in_a_row = 0;
       while (bridge->shutdown.test())
       {
         // std::cout << "Connection Loop Begin" << '\n';
-        std::optional<pending_obj_t> optobj;
-        while (std::nullopt != (optobj = bridge->sending_queue.pop()))
-        {
-          auto [addr, obj] = optobj.value();
-          pending_objects.insert_or_assign(addr, obj);
-        }
-        if (!pending_objects.empty())
+        std::optional<batch_t> optbatch;
+        while (std::nullopt != (optbatch = bridge->sending_queue.pop()))
         {
-          auto itr = pending_objects.begin();
-          auto [_, packet] = *itr;
-          if (write(bridge->socket_fd, packet.data(), packet.size()) != packet.size())
+          auto& batch = optbatch.value();
+          if (!batch.is_transaction)
           {
-            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            for (auto& [addr, obj] : batch.writes)
             {
-              usleep(100);
-              continue;
-            }
-            else
-            {
-              perror("Partial / failed write\n");
-              throw std::runtime_error("Err");
+              lanes[batch.priority].push(addr, obj);
+              // Keep queued transactions from sending an older value afterward
+              for (auto& lane : lanes)
+                for (auto& transaction : lane.transactions)
+                  for (auto& write : transaction.writes)
+                    if (write.first == addr)
+                      write.second = obj;
             }
+            continue;
+          }
+          // Transactions supersede older pending writes
+          for (auto& [addr, _] : batch.writes)
+            for (auto& lane : lanes)
+              lane.erase(addr);
+          lanes[batch.priority].transactions.push_back(transaction_t{ std::move(batch.writes), batch.target });
+        }
+
+        // Pings skip the lanes, any queuing before the stamp would bias the offset
+        std::optional<std::function<uint32_t()>> optping;
+        while (std::nullopt != (optping = bridge->pings.pop()))
+          bridge->write_ping(optping.value()());
+
+        // Strict priority, except that the lowest waiting lane gets one frame
+        //  after 'StarvationLimit' frames in a row from higher lanes
+        int lane = PRIORITIES_COUNT, lowest = PRIORITIES_COUNT;
+        for (int i = 0 ; i < PRIORITIES_COUNT ; ++i)
+          if (!lanes[i].empty())
+          {
+            if (lane == PRIORITIES_COUNT)
+              lane = i;
+            lowest = i;
           }
-          // Sleep after object send to avoid network congestion
-          pending_objects.erase(itr);
-          usleep(1000);
+        if (StarvationLimit <= served_in_a_row)
+          lane = lowest;
+        served_in_a_row = lane == lowest ? 0 : served_in_a_row + 1;
+
+        if (lane < PRIORITIES_COUNT && !lanes[lane].transactions.empty())
+        {
+          bridge->write_transaction(lanes[lane].transactions.front());
+          lanes[lane].transactions.pop_front();
+        }
+        else if (lane < PRIORITIES_COUNT)
+        {
+          // Pack as many writes of the lane as possible in one frame
+          uint8_t payload[protocol::MaxPayloadSize];
+          size_t payload_size = 0;
+          lanes[lane].pack(payload, payload_size);
+          bridge->write_frame(payload, payload_size);
         }
         else
           usleep(100);
@@ -93,6 +130,90 @@ void ArduinoBridge::callback(ArduinoBridge* bridge)
   std::cout << "Shuting down Arduino Bridge" << std::endl;
 }
 
+void ArduinoBridge::lane_t::push(size_t addr, const packet_t& packet)
+{
+  if (writes.insert_or_assign(addr, packet).second)
+    order.push_back(addr);
+}
+void ArduinoBridge::lane_t::erase(size_t addr)
+{
+  // The address stays in 'order' and is skipped when packing
+  writes.erase(addr);
+}
+void ArduinoBridge::lane_t::pack(uint8_t* payload, size_t& payload_size)
+{
+  while (!order.empty())
+  {
+    auto itr = writes.find(order.front());
+    if (itr == writes.end())
+    {
+      order.pop_front();
+      continue;
+    }
+    const packet_t& packet = itr->second;
+    if (packet.size() >= protocol::RecordHeaderSize
+      && !protocol::add_record(payload, payload_size, itr->first, packet.data() + protocol::RecordHeaderSize, packet[2]))
+      break;
+    writes.erase(itr);
+    order.pop_front();
+  }
+}
+
+void ArduinoBridge::write_frame(uint8_t* payload, size_t payload_size)
+{
+  uint8_t frame[protocol::MaxEncodedSize + 1];
+  const size_t frame_size = protocol::finish_frame(payload, payload_size, frame);
+
+  while (write(socket_fd, frame, frame_size) != ssize_t(frame_size))
+  {
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+    {
+      usleep(100);
+      continue;
+    }
+    perror("Partial / failed write\n");
+    throw std::runtime_error("Err");
+  }
+  // Sleep after frame send to avoid network congestion
+  usleep(1000);
+}
+
+void ArduinoBridge::write_transaction(const transaction_t& transaction)
+{
+  uint8_t payload[protocol::MaxPayloadSize];
+  size_t payload_size = 0;
+  protocol::add_control(payload, payload_size, protocol::BeginTransaction);
+  if (transaction.target)
+    protocol::add_control(payload, payload_size, protocol::Quantize, (const uint8_t*)&transaction.target.value());
+  for (auto& [addr, packet] : transaction.writes)
+  {
+    if (packet.size() < protocol::RecordHeaderSize)
+      continue;
+    const uint8_t* data = packet.data() + protocol::RecordHeaderSize;
+    if (!protocol::add_record(payload, payload_size, addr, data, packet[2]))
+    {
+      write_frame(payload, payload_size);
+      payload_size = 0;
+      protocol::add_record(payload, payload_size, addr, data, packet[2]);
+    }
+  }
+  if (!protocol::add_control(payload, payload_size, protocol::Commit))
+  {
+    write_frame(payload, payload_size);
+    payload_size = 0;
+    protocol::add_control(payload, payload_size, protocol::Commit);
+  }
+  write_frame(payload, payload_size);
+}
+
+void ArduinoBridge::write_ping(uint32_t time)
+{
+  uint8_t payload[protocol::MaxPayloadSize];
+  size_t payload_size = 0;
+  protocol::add_control(payload, payload_size, protocol::TimePing, (const uint8_t*)&time);
+  write_frame(payload, payload_size);
+}
+
 bool ArduinoBridge::connect()
 {
   struct addrinfo hints;
@@ -148,9 +269,18 @@ void ArduinoBridge::kill()
 }
 
 
-void ArduinoBridge::send(size_t addr, const packet_t& packet)
+void ArduinoBridge::send(size_t addr, const packet_t& packet, priority_e priority)
+{
+  sending_queue.push(batch_t{ {pending_obj_t(addr, packet)}, false, priority, std::nullopt });
+}
+void ArduinoBridge::send_transaction(std::vector<pending_obj_t>&& writes, priority_e priority,
+  std::optional<quantize::target_t> target)
+{
+  sending_queue.push(batch_t{ std::move(writes), true, priority, target });
+}
+void ArduinoBridge::send_ping(std::function<uint32_t()> clock)
 {
-  sending_queue.push(pending_obj_t(addr, packet));
+  pings.push(std::move(clock));
 }
 std::optional<std::string> ArduinoBridge::receive()
 {
@@ -175,6 +305,6 @@ std::optional<std::string> ArduinoBridge::receive()
     }
   }
 
-  buffer[nread] = '\0';
-  return std::make_optional(std::string(buffer));
+  // Raw bytes, the driver mixes text and binary telemetry
+  return std::make_optional(std::string(buffer, nread));
 }
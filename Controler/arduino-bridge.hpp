@@ -1,6 +1,7 @@
 #pragma once
 
 #include "thread-queue.hpp"
+#include "../driver/quantize.h"
 
 #include <string>
 #include <vector>
@@ -8,13 +9,58 @@
 #include <utility>
 #include <optional>
 #include <atomic>
+#include <deque>
+#include <functional>
+#include <unordered_map>
 
 class ArduinoBridge {
 
+public:
+
+  /// Sending order of the writes, a lane is only served when the previous ones are empty
+  enum priority_e {
+    CRITICAL,     ///!< Triggers, blackout and master brightness
+    PERFORMANCE,  ///!< Live controls
+    BULK,         ///!< Setup, palettes and preset loads
+    PRIORITIES_COUNT
+  };
+
+  /// Frames sent in a row from higher lanes before a lower lane gets one
+  static constexpr size_t StarvationLimit = 8;
+
+private:
+
   using packet_t = std::vector<uint8_t>;
   using pending_obj_t = std::pair<size_t, packet_t>;
 
-  ThreadSafeQueue<pending_obj_t> sending_queue;
+  /// Writes shown on the same frame, on the beat 'target' when there is one
+  struct transaction_t {
+    std::vector<pending_obj_t> writes;
+    std::optional<quantize::target_t> target;
+  };
+
+  struct batch_t {
+    std::vector<pending_obj_t> writes;
+    bool is_transaction;
+    priority_e priority;
+    std::optional<quantize::target_t> target;
+  };
+
+  /// Pending writes of a priority, the last value for each address sent in first-come order,
+  ///   transactions are sent before single writes
+  struct lane_t {
+    std::unordered_map<size_t, packet_t> writes;
+    std::deque<size_t> order;
+    std::deque<transaction_t> transactions;
+
+    bool empty() const { return writes.empty() && transactions.empty(); }
+    void push(size_t addr, const packet_t& packet);
+    void erase(size_t addr);
+    void pack(uint8_t* payload, size_t& payload_size);
+  };
+
+  ThreadSafeQueue<batch_t> sending_queue;
+  ThreadSafeQueue<std::function<uint32_t()>> pings;
   std::thread sending_thread;
 
   int socket_fd;
@@ -24,6 +70,9 @@ class ArduinoBridge {
   std::atomic_flag shutdown;
 
   bool connect();
+  void write_frame(uint8_t* payload, size_t payload_size);
+  void write_transaction(const transaction_t& transaction);
+  void write_ping(uint32_t time);
 
   static void callback(ArduinoBridge* bridge);
 
@@ -31,7 +80,14 @@ public:
   ArduinoBridge(const char* host, const char* port);
   ~ArduinoBridge();
 
-  void send(size_t addr, const packet_t& packet);
+  void send(size_t addr, const packet_t& packet, priority_e priority = PERFORMANCE);
+  /// Writes applied by the driver on the same frame, as (addr, packet) pairs. With a 'target',
+  ///   the driver holds them until that beat (see Driver/quantize.h)
+  void send_transaction(std::vector<std::pair<size_t, packet_t>>&& writes, priority_e priority = BULK,
+    std::optional<quantize::target_t> target = std::nullopt);
+  /// Clock sync ping, stamped with 'clock()' right before it is written to the socket
+  void send_ping(std::function<uint32_t()> clock);
+  /// Bytes received from the driver, see Telemetry to decode them
   std::optional<std::string> receive();
 
   void kill();
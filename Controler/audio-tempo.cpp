@@ -0,0 +1,408 @@
+#include "audio-tempo.hpp"
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+Fft::Fft(size_t size) :
+  n{size}, bitrev(size), twiddle_re(size ? size - 1 : 0), twiddle_im(size ? size - 1 : 0)
+{
+  size_t bits = 0;
+  while ((size_t(1) << bits) < n)
+    bits++;
+  for (size_t i = 0 ; i < n ; ++i)
+  {
+    uint32_t r = 0;
+    for (size_t b = 0 ; b < bits ; ++b)
+      r |= ((i >> b) & 1) << (bits - 1 - b);
+    bitrev[i] = r;
+  }
+  for (size_t h = 1 ; h < n ; h <<= 1)
+    for (size_t k = 0 ; k < h ; ++k)
+    {
+      const double angle = -M_PI * double(k) / double(h);
+      twiddle_re[h - 1 + k] = std::cos(angle);
+      twiddle_im[h - 1 + k] = std::sin(angle);
+    }
+}
+
+void Fft::transform(float* re, float* im) const
+{
+  for (size_t i = 0 ; i < n ; ++i)
+  {
+    const size_t j = bitrev[i];
+    if (i < j)
+    {
+      std::swap(re[i], re[j]);
+      std::swap(im[i], im[j]);
+    }
+  }
+
+  for (size_t h = 1 ; h < n ; h <<= 1)
+  {
+    const float* wr = twiddle_re.data() + h - 1;
+    const float* wi = twiddle_im.data() + h - 1;
+    for (size_t s = 0 ; s < n ; s += 2 * h)
+    {
+      float* ar = re + s, * ai = im + s;
+      float* br = re + s + h, * bi = im + s + h;
+      size_t k = 0;
+#ifdef __SSE__
+      // Stages of 4 butterflies and more, 4 at once
+      for ( ; k + 4 <= h ; k += 4)
+      {
+        const __m128 xr = _mm_loadu_ps(br + k), xi = _mm_loadu_ps(bi + k);
+        const __m128 c = _mm_loadu_ps(wr + k), d = _mm_loadu_ps(wi + k);
+        const __m128 tr = _mm_sub_ps(_mm_mul_ps(xr, c), _mm_mul_ps(xi, d));
+        const __m128 ti = _mm_add_ps(_mm_mul_ps(xr, d), _mm_mul_ps(xi, c));
+        const __m128 yr = _mm_loadu_ps(ar + k), yi = _mm_loadu_ps(ai + k);
+        _mm_storeu_ps(ar + k, _mm_add_ps(yr, tr));
+        _mm_storeu_ps(ai + k, _mm_add_ps(yi, ti));
+        _mm_storeu_ps(br + k, _mm_sub_ps(yr, tr));
+        _mm_storeu_ps(bi + k, _mm_sub_ps(yi, ti));
+      }
+#endif
+      for ( ; k < h ; ++k)
+      {
+        const float tr = br[k] * wr[k] - bi[k] * wi[k];
+        const float ti = br[k] * wi[k] + bi[k] * wr[k];
+        br[k] = ar[k] - tr;
+        bi[k] = ai[k] - ti;
+        ar[k] += tr;
+        ai[k] += ti;
+      }
+    }
+  }
+}
+
+float dot(const float* a, const float* b, size_t count)
+{
+  size_t i = 0;
+  float result = 0;
+#ifdef __SSE__
+  __m128 sum = _mm_setzero_ps();
+  for ( ; i + 4 <= count ; i += 4)
+    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  float lanes[4];
+  _mm_storeu_ps(lanes, sum);
+  result = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+  for ( ; i < count ; ++i)
+    result += a[i] * b[i];
+  return result;
+}
+
+BandEnergies::BandEnergies(double sample_rate, size_t bins)
+{
+  // At least a bin per band
+  const double hz_per_bin = sample_rate / (2. * (bins - 1));
+  for (size_t b = 0 ; b <= BandsCount ; ++b)
+  {
+    const double hz = MinHz * std::pow(MaxHz / MinHz, double(b) / BandsCount);
+    edges[b] = std::min(bins, size_t(std::lround(hz / hz_per_bin)));
+    if (b && edges[b] <= edges[b - 1])
+      edges[b] = std::min(bins, edges[b - 1] + 1);
+  }
+  peaks.fill(Floor);
+  levels.fill(0);
+}
+
+void BandEnergies::process(const float* magnitude, float dt)
+{
+  for (size_t b = 0 ; b < BandsCount ; ++b)
+  {
+    const float power = dot(magnitude + edges[b], magnitude + edges[b], edges[b + 1] - edges[b]);
+    const float db = 10.f * std::log10(power + 1e-12f);
+    peaks[b] = std::max({ db, peaks[b] - PeakDecay * dt, Floor });
+    const float level = std::clamp((db - peaks[b] + Range) / Range, 0.f, 1.f);
+    levels[b] = std::max(level, levels[b] - dt / Release);
+    bands[b] = uint8_t(std::lround(levels[b] * 255.f));
+  }
+  updates_count++;
+}
+
+std::optional<std::vector<uint8_t>> BandEnergies::message(double now, double frame_period)
+{
+  if (sent_updates == updates_count || now - last_sent < frame_period)
+    return std::nullopt;
+  sent_updates = updates_count;
+  last_sent = now;
+  const size_t addr = offsetof(state_t, audio);
+  std::vector<uint8_t> msg{ uint8_t(addr >> 8), uint8_t(addr & 0xFF), uint8_t(BandsCount) };
+  msg.insert(msg.end(), bands.begin(), bands.end());
+  return msg;
+}
+
+OnsetDetector::OnsetDetector(double sample_rate) :
+  rate{sample_rate}, fft{FrameSize}, window(FrameSize), buffer(FrameSize),
+  re(FrameSize), im(FrameSize), magnitude(FrameSize / 2 + 1), previous(FrameSize / 2 + 1), weight(FrameSize / 2 + 1),
+  energies{sample_rate, FrameSize / 2 + 1}
+{
+  // Hann, scaled so a full scale sine peaks at 1
+  for (size_t i = 0 ; i < FrameSize ; ++i)
+    window[i] = (0.5 - 0.5 * std::cos(2. * M_PI * i / FrameSize)) * 4. / FrameSize;
+  // Each octave weighs the same, without the DC
+  double sum = 0;
+  for (size_t k = 1 ; k < weight.size() ; ++k)
+    sum += 1. / k;
+  for (size_t k = 1 ; k < weight.size() ; ++k)
+    weight[k] = 1. / (k * sum);
+}
+
+std::vector<OnsetDetector::frame_t> OnsetDetector::process(const float* samples, size_t count, double time)
+{
+  std::vector<frame_t> frames;
+  found.clear();
+  // Time of the first buffered sample, from the caller's clock
+  double start = time - double(fill) / rate;
+  while (count)
+  {
+    const size_t n = std::min(count, FrameSize - fill);
+    memcpy(buffer.data() + fill, samples, n * sizeof(float));
+    fill += n;
+    samples += n;
+    count -= n;
+    if (fill < FrameSize)
+      break;
+
+    const frame_t frame{ start + 0.5 * FrameSize / rate, flux() };
+    memmove(buffer.data(), buffer.data() + HopSize, (FrameSize - HopSize) * sizeof(float));
+    fill -= HopSize;
+    start += HopSize / rate;
+    frames.push_back(frame);
+    pick(frame);
+  }
+  return frames;
+}
+
+float OnsetDetector::flux()
+{
+  for (size_t i = 0 ; i < FrameSize ; ++i)
+  {
+    re[i] = buffer[i] * window[i];
+    im[i] = 0;
+  }
+  fft.transform(re.data(), im.data());
+
+  const size_t bins = magnitude.size();
+  size_t k = 0;
+#ifdef __SSE__
+  for ( ; k + 4 <= bins ; k += 4)
+  {
+    const __m128 r = _mm_loadu_ps(&re[k]), i = _mm_loadu_ps(&im[k]);
+    _mm_storeu_ps(&magnitude[k], _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(i, i))));
+  }
+#endif
+  for ( ; k < bins ; ++k)
+    magnitude[k] = std::sqrt(re[k] * re[k] + im[k] * im[k]);
+  energies.process(magnitude.data(), HopSize / rate);
+  for (k = 0 ; k < bins ; ++k)
+    magnitude[k] = std::log1p(Compression * magnitude[k]);
+
+  // Only the increases : attacks, not releases
+  float sum = 0;
+  k = 0;
+#ifdef __SSE__
+  __m128 acc = _mm_setzero_ps();
+  for ( ; k + 4 <= bins ; k += 4)
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(&weight[k]),
+      _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_loadu_ps(&magnitude[k]), _mm_loadu_ps(&previous[k])))));
+  float lanes[4];
+  _mm_storeu_ps(lanes, acc);
+  sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+  for ( ; k < bins ; ++k)
+    sum += weight[k] * std::max(0.f, magnitude[k] - previous[k]);
+  std::swap(magnitude, previous);
+
+  if (!has_previous)
+  {
+    has_previous = true;
+    return 0;
+  }
+  return sum;
+}
+
+void OnsetDetector::pick(const frame_t& frame)
+{
+  recent.push_back(frame);
+  if (MeanFrames + 2 * PeakRadius + 1 < recent.size())
+    recent.erase(recent.begin());
+  if (recent.size() < 2 * PeakRadius + 1)
+    return;
+
+  // The candidate has 'PeakRadius' frames after it
+  const size_t candidate = recent.size() - 1 - PeakRadius;
+  const float flux = recent[candidate].flux;
+  for (size_t i = candidate - PeakRadius ; i < recent.size() ; ++i)
+    if (i < candidate ? flux <= recent[i].flux : flux < recent[i].flux)
+      return;
+
+  float mean = 0;
+  for (size_t i = 0 ; i < candidate ; ++i)
+    mean += recent[i].flux;
+  mean /= candidate;
+  if (flux < mean + Threshold || recent[candidate].time - last_onset < MinInterval)
+    return;
+  last_onset = recent[candidate].time;
+  found.push_back(last_onset);
+}
+
+BeatTracker::BeatTracker(double sample_rate) :
+  onsets{sample_rate}, frame_rate{onsets.frame_rate()},
+  history(size_t(HistorySeconds * onsets.frame_rate())), flux(history.size())
+{
+}
+
+void BeatTracker::process(const float* samples, size_t count, double time)
+{
+  for (auto& frame : onsets.process(samples, count, time))
+  {
+    history[written++ % history.size()] = frame.flux;
+    last_time = frame.time;
+    if (EstimateInterval * frame_rate <= ++since_estimate && history.size() <= written)
+    {
+      since_estimate = 0;
+      estimate();
+    }
+  }
+}
+
+float BeatTracker::at(double index) const
+{
+  if (index < 0)
+    return 0;
+  const size_t i = size_t(index);
+  const double f = index - i;
+  const float value = i + 1 < flux.size() ? flux[i] * (1 - f) + flux[i + 1] * f : flux[flux.size() - 1];
+  return std::max(0.f, value);
+}
+
+void BeatTracker::estimate()
+{
+  // Oldest first, without the mean
+  const size_t len = history.size();
+  float mean = 0;
+  for (size_t i = 0 ; i < len ; ++i)
+    mean += flux[i] = history[(written + i) % len];
+  mean /= len;
+  for (auto& value : flux)
+    value -= mean;
+
+  const size_t max_lag = std::min(len - 1, size_t(std::ceil(Multiples * 60. * frame_rate / MinBpm)) + 1);
+  correlation.resize(max_lag + 1);
+  for (size_t lag = 0 ; lag <= max_lag ; ++lag)
+    correlation[lag] = dot(flux.data(), flux.data() + lag, len - lag) / (len - lag);
+
+  // Tempo with the most flux correlation at its multiples
+  auto score = [&](double bpm) {
+    const double tau = 60. * frame_rate / bpm;
+    double sum = 0;
+    for (int m = 1 ; m <= Multiples ; ++m)
+    {
+      const double lag = m * tau;
+      const size_t i = std::min(size_t(lag), max_lag - 1);
+      const double f = lag - i;
+      sum += correlation[i] * (1 - f) + correlation[i + 1] * f;
+    }
+    return sum / Multiples;
+  };
+  auto weighted = [&](double bpm) {
+    const double octaves = std::log2(bpm / PriorBpm) / PriorOctaves;
+    return score(bpm) * std::exp(-0.5 * octaves * octaves);
+  };
+
+  double best = MinBpm;
+  for (double bpm = MinBpm ; bpm <= MaxBpm ; bpm += 0.5)
+    if (weighted(best) < weighted(bpm))
+      best = bpm;
+  // The grid is coarse and the flux peaky : the period is refined on the peak at the last multiple
+  const double lag = Multiples * 60. * frame_rate / best;
+  size_t peak = std::min(size_t(std::lround(lag)), max_lag - 1);
+  for (size_t i = std::max(size_t(lag) - 2, size_t(1)) ; i <= std::min(size_t(lag) + 3, max_lag - 1) ; ++i)
+    if (correlation[peak] < correlation[i])
+      peak = i;
+  const double left = correlation[peak - 1], center = correlation[peak], right = correlation[peak + 1];
+  const double curvature = left - 2 * center + right;
+  const double refined = peak + (curvature < 0 ? 0.5 * (left - right) / curvature : 0.);
+  if (std::abs(refined - lag) < 3)
+    best = Multiples * 60. * frame_rate / refined;
+
+  last_confidence = 0 < correlation[0] ? std::clamp(score(best) / correlation[0], 0., 1.) : 0.;
+  if (last_confidence < MinConfidence)
+  {
+    // Silence or no pulse
+    if (MaxMisses <= ++misses)
+    {
+      running = false;
+      stable = 0;
+    }
+    return;
+  }
+  misses = 0;
+
+  // Comb of beats ending in the last frames, recent beats weigh more
+  const double tau = 60. * frame_rate / best;
+  double best_phase = 0, best_sum = -1;
+  for (double phase = 0 ; phase < tau ; phase += 0.25)
+  {
+    double sum = 0, weight = 1;
+    for (double pos = len - 1 - phase ; 0 <= pos ; pos -= tau, weight *= CombDecay)
+      sum += weight * at(pos);
+    if (best_sum < sum)
+    {
+      best_sum = sum;
+      best_phase = phase;
+    }
+  }
+  const double beat_time = last_time - best_phase / frame_rate;
+  const double estimated = 60. / best;
+
+  if (!running)
+  {
+    running = true;
+    period = estimated;
+    origin_time = beat_time;
+    origin_beats = 0;
+    stable = 1;
+    candidate_count = 0;
+    return;
+  }
+
+  // The estimated beat is a whole beat, whatever the tempo found : it corrects the phase.
+  //  Close to the current tempo, it corrects the period too (second order loop, as ClockTracker),
+  //  the autocorrelation peaks being too coarse for the tempo itself
+  const double beats_at = beats(beat_time);
+  const double error = beats_at - std::round(beats_at);
+  origin_beats = beats_at - PhaseGain * error;
+  origin_time = beat_time;
+  if (std::abs(estimated - period) <= MaxDeviation * period)
+  {
+    candidate_count = 0;
+    stable++;
+    // Counting ahead of the beats : the period is too short
+    period += PeriodGain * error * period;
+    return;
+  }
+
+  // Another tempo : switch once it is confirmed, the beat count stays continuous
+  if (candidate_count && std::abs(estimated - candidate) <= MaxDeviation * candidate)
+    candidate_count++;
+  else
+  {
+    candidate = estimated;
+    candidate_count = 1;
+  }
+  if (candidate_count < StableEstimates)
+    return;
+  period = candidate;
+  candidate_count = 0;
+  stable = StableEstimates;
+  relocks_count++;
+  origin_beats = std::round(beats_at);
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include "clock-tracker.hpp"
+#include "../driver/state.h"
+
+#include <array>
+#include <vector>
+#include <optional>
+#include <cstddef>
+#include <cstdint>
+
+/// In place radix-2 FFT on split complex data, vectorized with SSE when available
+class Fft {
+public:
+
+  /// 'size' must be a power of two
+  explicit Fft(size_t size);
+
+  size_t size() const { return n; }
+
+  /// Forward transform, 'size' floats each
+  void transform(float* re, float* im) const;
+
+private:
+
+  size_t n;
+  std::vector<uint32_t> bitrev;
+  std::vector<float> twiddle_re, twiddle_im; ///!< The stage of half size 'h' reads its 'h' twiddles from 'h - 1'
+};
+
+/// Dot product of two float arrays, vectorized with SSE when available
+float dot(const float* a, const float* b, size_t count);
+
+/**
+ * Energies of log spaced bands, streamed to the driver 'audio' block as modulation sources.
+ *
+ * Each band is in dB under its own peak, decaying by 'PeakDecay' dB per second, so quiet
+ * and loud parts both use the whole range. Values rise at once and fall in 'Release'.
+ * The driver only shows one value per frame : 'message()' sends at most once per
+ * driver frame, as a single write of the whole block.
+ */
+class BandEnergies {
+public:
+
+  static constexpr size_t BandsCount = AUDIO_BANDS_COUNT;
+  static constexpr double MinHz = 40, MaxHz = 16000;
+  static constexpr float  Range = 30;       ///!< dB under the peak mapped to 0
+  static constexpr float  Floor = -50;      ///!< Lowest peak, in dB of full scale
+  static constexpr float  PeakDecay = 3;    ///!< dB per second
+  static constexpr float  Release = 0.2f;   ///!< Seconds from 255 to 0
+
+  /// 'bins' of the magnitude spectrum, from the DC to the Nyquist frequency
+  BandEnergies(double sample_rate, size_t bins);
+
+  /// Magnitudes of a frame, full scale sine at 1, 'dt' seconds after the previous one
+  void process(const float* magnitude, float dt);
+
+  const std::array<uint8_t, BandsCount>& values() const { return bands; }
+  /// Frames processed
+  uint32_t updates() const { return updates_count; }
+
+  /// Write of the whole block, if it changed and a driver frame has passed since the last one
+  std::optional<std::vector<uint8_t>> message(double now, double frame_period);
+
+private:
+
+  std::array<size_t, BandsCount + 1> edges; ///!< First bin of each band
+  std::array<float, BandsCount> peaks, levels;
+  std::array<uint8_t, BandsCount> bands{};
+  uint32_t updates_count = 0;
+  uint32_t sent_updates = 0;
+  double   last_sent = -1e9;
+};
+
+/**
+ * Spectral flux onset detection function.
+ *
+ * Hann windowed frames of 'FrameSize' samples every 'HopSize' samples : the flux is
+ * the sum of the log magnitudes increases over the bins, weighted by 1/f so each octave
+ * counts the same and broadband hats don't outweigh the kicks. An onset is a local
+ * maximum of the flux over 'PeakRadius' frames each side, above the recent mean
+ * by 'Threshold', so the detection is delayed by 'PeakRadius' hops.
+ */
+class OnsetDetector {
+public:
+
+  static constexpr size_t FrameSize = 1024;
+  static constexpr size_t HopSize = 512;
+  static constexpr float  Compression = 100;  ///!< log(1 + Compression * magnitude)
+  static constexpr size_t PeakRadius = 3;
+  static constexpr size_t MeanFrames = 32;   ///!< Recent flux mean, before the peak
+  static constexpr float  Threshold = 0.01f;  ///!< Above the recent mean
+  static constexpr double MinInterval = 0.05; ///!< Seconds between two onsets
+
+  struct frame_t
+  {
+    double time; ///!< Center of the frame, in seconds
+    float  flux;
+  };
+
+  explicit OnsetDetector(double sample_rate);
+
+  /// Feeds mono samples, 'time' is the one of the first sample. Returns the flux frames completed
+  std::vector<frame_t> process(const float* samples, size_t count, double time);
+
+  /// Onsets found by the last call to 'process'
+  const std::vector<double>& onsets() const { return found; }
+  /// Of the last frame
+  BandEnergies& bands() { return energies; }
+  const BandEnergies& bands() const { return energies; }
+
+  double frame_rate() const { return rate / HopSize; }
+
+private:
+
+  double rate;
+  Fft fft;
+  std::vector<float> window, buffer;
+  std::vector<float> re, im, magnitude, previous, weight;
+  BandEnergies energies;
+  size_t fill = 0;
+  bool   has_previous = false;
+
+  std::vector<frame_t> recent;  ///!< Flux history for the peak picking
+  std::vector<double> found;
+  double last_onset = -1e9;
+
+  float flux();
+  void pick(const frame_t& frame);
+};
+
+/**
+ * Tempo and beat phase of an audio input.
+ *
+ * Every 'EstimateInterval' the last 'HistorySeconds' of spectral flux are
+ * autocorrelated : the tempo maximizes the autocorrelation at 'Multiples' multiples
+ * of the beat period, weighted by a log-normal prior centered on 'PriorBpm' to
+ * settle the octave. The beat phase is the offset of the comb at this period
+ * matching most of the recent flux. Beats found close to the current tempo correct
+ * its phase and period, other tempos restart the lock once they agree with each other.
+ */
+class BeatTracker : public TempoSource {
+public:
+
+  static constexpr double MinBpm = 60, MaxBpm = 200;
+  static constexpr double PriorBpm = 120;
+  static constexpr double PriorOctaves = 1;     ///!< Standard deviation of the prior
+  static constexpr int    Multiples = 3;
+  static constexpr double HistorySeconds = 6;
+  static constexpr double EstimateInterval = 0.5;
+  static constexpr double MinConfidence = 0.1;  ///!< Normalized autocorrelation of a beat
+  static constexpr double CombDecay = 0.6;      ///!< Weight of each beat against the next one
+  static constexpr double MaxDeviation = 0.04;  ///!< Tempo change smoothed in, relative
+  static constexpr double PhaseGain = 0.3;
+  static constexpr double PeriodGain = 0.05;
+  static constexpr int    StableEstimates = 3;  ///!< Agreeing estimates before the lock
+  static constexpr int    MaxMisses = 4;        ///!< Unconfident estimates before stopping
+
+  explicit BeatTracker(double sample_rate);
+
+  /// Feeds mono samples, 'time' is the one of the first sample in the TempoSource time base
+  void process(const float* samples, size_t count, double time);
+
+  bool is_running() const override { return running; }
+  bool is_locked() const override { return running && StableEstimates <= stable; }
+  double bpm() const override { return 60. / period; }
+  double beats(double time) const override { return origin_beats + (time - origin_time) / period; }
+
+  OnsetDetector& detector() { return onsets; }
+  const OnsetDetector& detector() const { return onsets; }
+  /// Of the last estimate, 0 to 1
+  double confidence() const { return last_confidence; }
+  uint32_t relocks() const { return relocks_count; }
+
+private:
+
+  OnsetDetector onsets;
+  double frame_rate;
+  std::vector<float> history;   ///!< Flux ring
+  size_t written = 0;
+  double last_time = 0;         ///!< Of the last flux frame
+  size_t since_estimate = 0;
+
+  bool   running = false;
+  int    stable = 0;
+  int    misses = 0;
+  double period = 0.5;          ///!< Seconds per beat
+  double origin_time = 0;
+  double origin_beats = 0;
+  double candidate = 0;         ///!< Tempo disagreeing with the current one
+  int    candidate_count = 0;
+  double last_confidence = 0;
+  uint32_t relocks_count = 0;
+
+  std::vector<float> flux, correlation;
+
+  void estimate();
+  /// Onset strength at a fractional index of 'flux'
+  float at(double index) const;
+};
@@ -0,0 +1,72 @@
+#include "beat-scheduler.hpp"
+
+#include <stdio.h>
+
+#include <cmath>
+
+uint64_t BeatScheduler::tick_of(const TempoSource& source, double now) const
+{
+  return uint64_t(std::max(0., std::floor(source.beats(now + lead()) * TicksPerBeat)));
+}
+
+bool BeatScheduler::schedule(std::string command, double grid, const TempoSource& source, double now)
+{
+  if (grid <= 0 || !source.is_locked())
+    return false;
+  // An idle wheel jumps to the beat clock, rather than turning up to it
+  if (!wheel.size())
+    wheel.reset(tick_of(source, now), fired);
+  const double earliest = std::max(0., source.beats(now + lead()));
+  const double target = std::ceil(earliest / grid) * grid;
+  wheel.schedule(uint64_t(std::llround(target * TicksPerBeat)), std::move(command));
+  return true;
+}
+
+std::vector<BeatScheduler::batch_t> BeatScheduler::advance(const TempoSource& source, double now)
+{
+  std::vector<batch_t> batches;
+  if (!wheel.size())
+    return batches;
+
+  fired.clear();
+  const uint64_t tick = source.is_locked() ? tick_of(source, now) : 0;
+  const bool lost = !source.is_locked() || tick + TicksPerBeat < wheel.now();
+  if (lost)
+  {
+    // No beat to wait for anymore (stop, lost lock or restart) : all at once
+    wheel.reset(tick, fired);
+    error_stats.flushed += fired.size();
+    batches.emplace_back();
+    for (auto& entry : fired)
+      batches.back().commands.push_back(std::move(entry.item));
+    return batches;
+  }
+
+  wheel.advance(tick, fired);
+  const double seconds_per_beat = 60. / source.bpm();
+  const double beats = source.beats(now + lead());
+  for (size_t i = 0 ; i < fired.size() ; ++i)
+  {
+    auto& entry = fired[i];
+    if (i == 0 || entry.tick != fired[i - 1].tick)
+      batches.push_back(batch_t{ double(entry.tick) / TicksPerBeat, {} });
+    batches.back().commands.push_back(std::move(entry.item));
+
+    const double error = (beats - double(entry.tick) / TicksPerBeat) * seconds_per_beat;
+    ++error_stats.fired;
+    error_stats.sum += error;
+    error_stats.sum_squares += error * error;
+    error_stats.max = std::max(error_stats.max, std::fabs(error));
+  }
+  return batches;
+}
+
+std::string BeatScheduler::summary() const
+{
+  const double count = std::max<uint32_t>(error_stats.fired, 1);
+  char tmp[256];
+  snprintf(tmp, sizeof(tmp), "Quantized : %u on beat (error mean %.2f ms, rms %.2f ms, max %.2f ms), %u unquantized, %zu pending",
+    error_stats.fired, error_stats.sum / count * 1e3, std::sqrt(error_stats.sum_squares / count) * 1e3,
+    error_stats.max * 1e3, error_stats.flushed, pending());
+  return std::string(tmp);
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include "clock-tracker.hpp"
+
+#include <array>
+#include <string>
+#include <optional>
+#include <algorithm>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Hierarchical timer wheel of ticks.
+ *
+ * Level 'l' has 'Slots' slots of Slots^l ticks. An entry goes to the lowest level where
+ * its tick shares the higher bits of the current one, and cascades down when the
+ * current tick enters its window : scheduling and firing are constant time whatever
+ * the number of entries. Entries beyond the top level wait in an overflow list.
+ * Entries of the same tick fire in scheduling order.
+ */
+template <typename T>
+class TimerWheel {
+public:
+
+  static constexpr uint32_t SlotBits = 6;
+  static constexpr uint32_t Slots = 1 << SlotBits;
+  static constexpr uint32_t Levels = 3;
+
+  struct entry_t
+  {
+    uint64_t tick;
+    uint64_t sequence;
+    T        item;
+  };
+
+  uint64_t now() const { return current; }
+  size_t size() const { return count; }
+
+  /// Entries already due fire at the next 'advance'
+  void schedule(uint64_t tick, T item)
+  {
+    insert(entry_t{ tick, next_sequence++, std::move(item) });
+    ++count;
+  }
+
+  /// Removes every entry to 'removed', in order, and restarts the wheel at 'tick'
+  void reset(uint64_t tick, std::vector<entry_t>& removed)
+  {
+    const size_t first = removed.size();
+    take(due, removed);
+    take(overflow, removed);
+    for (auto& level : wheel)
+      for (auto& slot : level)
+        take(slot, removed);
+    std::stable_sort(removed.begin() + first, removed.end(), before);
+    current = tick;
+    count = 0;
+  }
+
+  /// Moves to 'tick' and appends the entries due to 'fired', in order
+  void advance(uint64_t tick, std::vector<entry_t>& fired)
+  {
+    const size_t first = fired.size();
+    take(due, fired);
+    if (current < tick && (uint64_t(1) << (SlotBits * Levels)) < tick - current)
+    {
+      // Far jump : everything is rescheduled from there
+      std::vector<entry_t> all;
+      take(overflow, all);
+      for (auto& level : wheel)
+        for (auto& slot : level)
+          take(slot, all);
+      current = tick;
+      for (auto& entry : all)
+        insert(std::move(entry));
+      take(due, fired);
+    }
+    while (current < tick)
+    {
+      ++current;
+      if (!(current & ((uint64_t(1) << (SlotBits * Levels)) - 1)))
+        cascade(overflow);
+      for (uint32_t level = Levels - 1 ; 0 < level ; --level)
+        if (!(current & ((uint64_t(1) << (SlotBits * level)) - 1)))
+          cascade(wheel[level][(current >> (SlotBits * level)) & (Slots - 1)]);
+      // Entries of the window's first tick cascade straight to 'due'
+      take(due, fired);
+      take(wheel[0][current & (Slots - 1)], fired);
+    }
+    // Cascades may mix the scheduling order of a tick
+    std::stable_sort(fired.begin() + first, fired.end(), before);
+    count -= fired.size() - first;
+  }
+
+private:
+
+  std::array<std::array<std::vector<entry_t>, Slots>, Levels> wheel;
+  std::vector<entry_t> overflow, due;
+  uint64_t current = 0;
+  uint64_t next_sequence = 0;
+  size_t   count = 0;
+
+  static bool before(const entry_t& a, const entry_t& b)
+  {
+    return a.tick != b.tick ? a.tick < b.tick : a.sequence < b.sequence;
+  }
+  void insert(entry_t&& entry)
+  {
+    if (entry.tick <= current)
+    {
+      due.push_back(std::move(entry));
+      return;
+    }
+    for (uint32_t level = 0 ; level < Levels ; ++level)
+      if ((entry.tick >> (SlotBits * (level + 1))) == (current >> (SlotBits * (level + 1))))
+      {
+        wheel[level][(entry.tick >> (SlotBits * level)) & (Slots - 1)].push_back(std::move(entry));
+        return;
+      }
+    overflow.push_back(std::move(entry));
+  }
+  void cascade(std::vector<entry_t>& slot)
+  {
+    std::vector<entry_t> entries;
+    entries.swap(slot);
+    for (auto& entry : entries)
+      insert(std::move(entry));
+  }
+  static void take(std::vector<entry_t>& from, std::vector<entry_t>& to)
+  {
+    for (auto& entry : from)
+      to.push_back(std::move(entry));
+    from.clear();
+  }
+};
+
+/**
+ * Commands quantized to the beat grid of the followed tempo.
+ *
+ * The wheel ticks 'TicksPerBeat' times per beat and runs ahead of the beat clock by the
+ * link latency : a command due on a beat is processed and sent early enough for the
+ * driver to show it on the beat, the commands of a same beat going as one batch.
+ * Without a locked tempo, or when the beats restart, pending commands fire at once.
+ *
+ * The scheduling error is the distance between the send time plus the latency and
+ * the beat, as seen by the tempo source. When the driver holds the writes until their
+ * beat (see Driver/quantize.h), the latency is a safe margin rather than the link delay.
+ */
+class BeatScheduler {
+public:
+
+  static constexpr uint32_t TicksPerBeat = 96;
+  static constexpr double   SendMargin = 0.001; ///!< Seconds added to the latency
+
+  /// Seconds from sending a write to the driver showing it
+  void set_latency(double seconds) { latency = seconds; }
+  double lead() const { return latency + SendMargin; }
+
+  /// Queues 'command' on the next multiple of 'grid' beats that can still be met. False
+  ///  without a locked tempo : the caller runs it at once
+  bool schedule(std::string command, double grid, const TempoSource& source, double now);
+
+  struct batch_t
+  {
+    std::optional<double> beat;  ///!< Due position, none when fired at once
+    std::vector<std::string> commands;
+  };
+  /// Commands to send now, by batch of a same beat
+  std::vector<batch_t> advance(const TempoSource& source, double now);
+
+  size_t pending() const { return wheel.size(); }
+
+  struct stats_t
+  {
+    uint32_t fired = 0;     ///!< On their beat
+    uint32_t flushed = 0;   ///!< At once, the tempo being lost
+    double   sum = 0, sum_squares = 0, max = 0; ///!< Of the errors of the fired, in seconds
+  };
+  const stats_t& stats() const { return error_stats; }
+  /// One line summary of the errors
+  std::string summary() const;
+
+private:
+
+  TimerWheel<std::string> wheel;
+  std::vector<TimerWheel<std::string>::entry_t> fired;
+  double latency = 0;
+  stats_t error_stats;
+
+  /// Wheel position of the beat clock, ahead by the lead
+  uint64_t tick_of(const TempoSource& source, double now) const;
+};
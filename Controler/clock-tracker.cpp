@@ -0,0 +1,156 @@
+#include "clock-tracker.hpp"
+
+#include "../driver/fixed_point.h"
+
+#include <cmath>
+
+void ClockTracker::process(const clock_event_t& event)
+{
+  switch (event.type)
+  {
+  case clock_event_t::START:
+    running = true;
+    ticks = 0;
+    stable = 0;
+    has_tick = has_period = false;
+    break;
+  case clock_event_t::CONTINUE:
+    // Keep the song position, but the tick timing restarts
+    running = true;
+    stable = 0;
+    has_tick = has_period = false;
+    break;
+  case clock_event_t::STOP:
+    running = false;
+    break;
+  case clock_event_t::TICK:
+    tick(event.time);
+    break;
+  }
+}
+
+void ClockTracker::tick(double time)
+{
+  ticks++;
+  if (!has_tick)
+  {
+    has_tick = true;
+    last_tick = raw_last = time;
+    return;
+  }
+
+  const double error = time - (last_tick + period);
+  if (!has_period || MaxError * period < std::abs(error))
+  {
+    // Acquisition, tempo jump or lost ticks : start over from the raw interval if it is plausible
+    const double interval = time - raw_last;
+    if (60. / (MaxBpm * TicksPerBeat) <= interval && interval <= 60. / (MinBpm * TicksPerBeat))
+      period = interval;
+    last_tick = time;
+    stable = 0;
+    relocks_count += has_period;
+    has_period = true;
+  }
+  else
+  {
+    last_tick += period + PhaseGain * error;
+    period += PeriodGain * error;
+    jitter_rms = std::sqrt(0.99 * jitter_rms * jitter_rms + 0.01 * error * error);
+    stable++;
+  }
+  raw_last = time;
+}
+
+double ClockTracker::beats(double time) const
+{
+  if (!has_tick)
+    return double(ticks) / TicksPerBeat;
+  // The first tick after a start is beat 0
+  return (double(ticks - 1) + (time - last_tick) / period) / TicksPerBeat;
+}
+
+TempoFollower::update_t TempoFollower::update(const TempoSource& tracker, double now, const TimeSync* sync)
+{
+  update_t result;
+  if (source != &tracker)
+  {
+    // Beats of another source have another origin
+    following = false;
+    source = &tracker;
+  }
+  if (!tracker.is_running())
+  {
+    following = false;
+    return result;
+  }
+  // While relocking the driver keeps the last sent tempo
+  if (!tracker.is_locked())
+    return result;
+
+  if (!following)
+  {
+    // The driver phase at lock time becomes the reference, as set by the manual sync
+    following = true;
+    sent_bpm = tracker.bpm();
+    sent_control = bpm_to_control(sent_bpm);
+    driver_cycles = 0;
+    tracked_origin = tracker.beats(now);
+    sent_correction = 0;
+    last_update = now;
+    result.bpm = sent_control;
+    return result;
+  }
+
+  if (now - last_update < MinUpdateInterval)
+    return result;
+
+  // The driver played the last sent tempo since the last update
+  driver_cycles += (now - last_update) * 1000. / master_cycle_ms(sent_control);
+  last_update = now;
+
+  if (BpmThreshold <= std::abs(tracker.bpm() - sent_bpm))
+  {
+    sent_bpm = tracker.bpm();
+    sent_control = bpm_to_control(sent_bpm);
+    result.bpm = sent_control;
+  }
+
+  if (sync && sync->is_synced())
+  {
+    // The driver locks on the bar itself, 'sync_correction' is left to the manual nudges
+    if (AnchorInterval <= now - last_anchor)
+    {
+      result.anchor = timesync::anchor_t{ sync->to_driver(uint64_t(now * 1e6)), bar_phase(tracker.beats(now)) };
+      last_anchor = now;
+    }
+    return result;
+  }
+
+  // 'sync_correction' wraps around like the driver phase, only the shortest way matters
+  const double drift = (tracker.beats(now) - tracked_origin) / BeatsPerMasterCycle - driver_cycles;
+  const int32_t correction = std::lround(drift * 256.);
+  result.sync_delta = int8_t(uint8_t(correction - sent_correction));
+  sent_correction += result.sync_delta;
+  return result;
+}
+
+float TempoFollower::bpm_to_control(double bpm)
+{
+  // Inverse of master_cycle_ms, up to the integer division
+  const double period = BeatsPerMasterCycle * 60000. / bpm - 1. / 8.;
+  return float(60. * 1000. * 100. / 2. / (period - 1.) - 1.);
+}
+
+double TempoFollower::master_cycle_ms(float control)
+{
+  const uint32_t bpm = fixed::uq16_16::from_float(control < 0 ? 0 : control).as<uint32_t, 8>().raw;
+  const uint32_t period = 1 + ((60lu * 1000lu * 100lu / 2) << 8) / (bpm + fixed::uq24_8::One);
+  // Clock::setPeriod turns once per (8 * period + 1) / 8 ms
+  return (8. * period + 1.) / 8.;
+}
+
+uint32_t TempoFollower::bar_phase(double beats)
+{
+  const double bar = beats / BeatsPerMasterCycle;
+  return uint32_t(int64_t(std::ldexp(bar - std::floor(bar), 32)));
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "time-sync.hpp"
+
+#include <cstdint>
+#include <optional>
+
+/// MIDI real time message, timestamped from its JACK frame
+struct clock_event_t
+{
+  enum type_e : uint8_t {
+    TICK     = 0xF8,
+    START    = 0xFA,
+    CONTINUE = 0xFB,
+    STOP     = 0xFC,
+  };
+
+  type_e type;
+  double time; ///!< In seconds
+};
+
+/// Tempo and beat position followed by TempoFollower, times in seconds
+class TempoSource {
+public:
+  virtual ~TempoSource() = default;
+
+  virtual bool is_running() const = 0;
+  /// Estimate stable enough to be sent to the driver
+  virtual bool is_locked() const = 0;
+  virtual double bpm() const = 0;
+  /// Beats since the start, extrapolated at the given time
+  virtual double beats(double time) const = 0;
+};
+
+/**
+ * Tempo and phase tracker for a 24 PPQN MIDI clock.
+ *
+ * A second order PLL predicts the time of the next tick : the prediction error
+ * corrects the phase (gain 'PhaseGain') and the tick period (gain 'PeriodGain'),
+ * smoothing the jitter of the clock source and the JACK period quantization.
+ * The first interval after a start, or a tick too far from the prediction
+ * (tempo jump, lost ticks), sets the period directly and restarts the lock.
+ */
+class ClockTracker : public TempoSource {
+public:
+
+  static constexpr int    TicksPerBeat = 24;
+  static constexpr double PhaseGain = 0.1;
+  static constexpr double PeriodGain = 0.005;
+  static constexpr double MaxError = 0.5;  ///!< Prediction error triggering a relock, in tick periods
+  static constexpr double MinBpm = 30, MaxBpm = 300;
+
+  void process(const clock_event_t& event);
+
+  bool is_running() const override { return running; }
+  bool is_locked() const override { return running && TicksPerBeat <= stable; }
+
+  /// Tracked tempo, in beats per minute
+  double bpm() const override { return 60. / (period * TicksPerBeat); }
+
+  /// Beats since the last start, extrapolated at the given time
+  double beats(double time) const override;
+
+  /// Moving RMS of the tick prediction error, in seconds
+  double jitter() const { return jitter_rms; }
+  uint32_t relocks() const { return relocks_count; }
+
+private:
+
+  bool     running = false;
+  bool     has_tick = false;
+  bool     has_period = false; ///!< False until the first interval after a start
+  int64_t  ticks = 0;       ///!< Ticks since the last start
+  int64_t  stable = 0;      ///!< Ticks since the last relock
+  double   period = 60. / (120. * TicksPerBeat);
+  double   last_tick = 0;   ///!< Filtered time of the last tick
+  double   raw_last = 0;    ///!< Actual time of the last tick
+  double   jitter_rms = 0;
+  uint32_t relocks_count = 0;
+
+  void tick(double time);
+};
+
+/**
+ * Turns the tracked tempo (MIDI clock or audio) into 'bpm' and 'sync_correction' updates.
+ *
+ * The driver phase can't be read back, but it only depends on the bpm values it
+ * has been sent : the follower integrates them the way the driver does and sends
+ * the drift against the tracked beats as a 'sync_correction' delta, so manual
+ * 'sync_left' / 'sync_right' nudges are kept. The reference is taken on the first
+ * lock after a start and kept through relocks, the beat count being continuous.
+ * Once the driver clock is known (see TimeSync), phase anchors replace the
+ * deltas : the driver slews its clocks to the tracked bar instead of jumping.
+ * Switching to another source restarts the follow from the current driver phase.
+ * Updates are rate limited, the link only carries a few writes per frame.
+ */
+class TempoFollower {
+public:
+
+  static constexpr double BeatsPerMasterCycle = 4;  ///!< The driver master clock turns once per bar
+  static constexpr double MinUpdateInterval = 0.25; ///!< Seconds between two updates
+  static constexpr double BpmThreshold = 0.05;      ///!< Smallest tempo change worth sending
+  static constexpr double AnchorInterval = 1;       ///!< Seconds between two phase anchors
+
+  struct update_t
+  {
+    std::optional<float> bpm; ///!< New value of the 'bpm' control
+    int8_t sync_delta = 0;    ///!< To add to 'sync_correction', in 1/256 of master cycle
+    std::optional<timesync::anchor_t> anchor; ///!< Tracked bar phase, when the driver clock is known
+  };
+
+  /// Called periodically with the current time, in the time base of 'sync' if any
+  update_t update(const TempoSource& tracker, double now, const TimeSync* sync = nullptr);
+
+  /// 'bpm' control value making the master cycle last 'BeatsPerMasterCycle' beats
+  static float bpm_to_control(double bpm);
+  /// Master cycle length in ms for a 'bpm' control value, as computed by the driver
+  static double master_cycle_ms(float control);
+  /// UQ0.32 master cycle phase of a beat position, once the driver is anchored
+  static uint32_t bar_phase(double beats);
+
+private:
+
+  bool    following = false;
+  const TempoSource* source = nullptr; ///!< Followed by the last update
+  double  last_update = 0;
+  double  last_anchor = 0;
+  double  sent_bpm = 0;
+  float   sent_control = 0;
+  double  driver_cycles = 0;  ///!< Master cycles played by the driver since the lock
+  double  tracked_origin = 0; ///!< Tracked beats at the lock
+  int32_t sent_correction = 0;///!< Sum of the sent deltas since the lock
+};
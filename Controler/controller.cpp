@@ -2,18 +2,125 @@
 #include "mapper.hpp"
 #include "manager.hpp"
 #include "arduino-bridge.hpp"
+#include "telemetry.hpp"
+#include "clock-tracker.hpp"
+#include "time-sync.hpp"
+#include "audio-tempo.hpp"
+#include "osc.hpp"
+#include "beat-scheduler.hpp"
+#include "persistence.hpp"
+#include "../driver/state.h"
 
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 
 #include <signal.h>
+#include <limits.h>
 
+#include <memory>
 #include <thread>
 #include <future>
 #include <string>
 #include <iostream>
+#include <optional>
+#include <algorithm>
+
+/// Triggers and blackout first, then live controls, then setup
+ArduinoBridge::priority_e priority_of(const control_t* ctrl)
+{
+  if ((ctrl->flags & control_t::CRITICAL) || (ctrl->flags & control_t::TRIGGER) == control_t::TRIGGER)
+    return ArduinoBridge::CRITICAL;
+  if (ctrl->flags & control_t::SETUP)
+    return ArduinoBridge::BULK;
+  return ArduinoBridge::PERFORMANCE;
+}
+
+/// Midi device, with its own mapping file
+struct device_t
+{
+  std::string name;
+  std::unique_ptr<Mapper> mapper;
+  /// Floor of its writes to the driver, and order among simultaneous events
+  ArduinoBridge::priority_e priority;
+};
+
+/// A relative mapping file is looked up in the current directory, then next to the executable,
+///   then in the source directory when built with CMake
+std::string mapping_path(const std::string& path)
+{
+  if (path.empty() || path[0] == '/' || access(path.c_str(), R_OK) == 0)
+    return path;
+  std::vector<std::string> directories;
+  char executable[PATH_MAX];
+  const ssize_t length = readlink("/proc/self/exe", executable, sizeof(executable));
+  if (0 < length && size_t(length) < sizeof(executable))
+  {
+    const std::string directory(executable, length);
+    directories.push_back(directory.substr(0, directory.rfind('/') + 1));
+  }
+#ifdef CONTROLLER_SOURCE_DIR
+  directories.push_back(CONTROLLER_SOURCE_DIR "/");
+#endif
+  for (auto& directory : directories)
+    if (access((directory + path).c_str(), R_OK) == 0)
+      return directory + path;
+  return path;
+}
+
+/// 'name:mapping-file[:priority]'
+std::optional<device_t> parse_device(const std::string& spec)
+{
+  const size_t colon = spec.find(':');
+  if (colon == std::string::npos || colon == 0)
+    return std::nullopt;
+  const size_t next = spec.find(':', colon + 1);
+  int priority = ArduinoBridge::CRITICAL;
+  if (next != std::string::npos && (sscanf(spec.c_str() + next + 1, "%d", &priority) != 1
+    || priority < ArduinoBridge::CRITICAL || ArduinoBridge::BULK < priority))
+    return std::nullopt;
+  const std::string path = spec.substr(colon + 1, next == std::string::npos ? next : next - colon - 1);
+  return device_t{ spec.substr(0, colon), std::make_unique<Mapper>(mapping_path(path)), ArduinoBridge::priority_e(priority) };
+}
+
+/// Sends the updated controls to the driver, and their feedback to the midi devices binding them.
+///   With a 'target', the driver holds the writes until that beat
+void dispatch(const dirty_list_t& result, std::vector<device_t>& devices, JackBridge& jack, ArduinoBridge& arduino,
+  ArduinoBridge::priority_e priority = ArduinoBridge::CRITICAL, std::optional<quantize::target_t> target = std::nullopt)
+{
+  std::vector<std::pair<size_t, std::vector<uint8_t>>> writes;
+  // A transaction goes with its least urgent control
+  for (auto& [ctrl, force] : result)
+  {
+    if (force || !(ctrl->flags & control_t::VOLATILE))
+    {
+      const std::string command = ctrl->to_command_string();
+      for (size_t i = 0 ; i < devices.size() ; ++i)
+        for (auto& msg : devices[i].mapper->command_to_midimsg(command))
+          jack.send_midi(i, msg);
+    }
+    writes.emplace_back(ctrl->addr_offset, ctrl->to_raw_message());
+    priority = std::max(priority, priority_of(ctrl));
+  }
+  // Multi-control changes (presets loads, resets) show on a single frame
+  if (writes.size() == 1 && !target)
+    arduino.send(writes.front().first, writes.front().second, priority);
+  else if (!writes.empty())
+    arduino.send_transaction(std::move(writes), priority, target);
+}
+
+/// Commands waiting for the main loop, from all the OSC ports
+static constexpr size_t OscQueueSize = 4096;
+/// Applied per loop, so a flood can't stall the midi and the driver
+static constexpr size_t OscBatch = 256;
+
+/// Seconds ahead of their beat quantized writes leave, when the driver is anchored and holds them
+static constexpr double DriverQuantizeLead = 0.1;
+
+/// Between two checks of the mapping files, in us
+static constexpr useconds_t MappingPollInterval = 500000;
 
 volatile int is_running = 1;
 void sighandler(int sig)
@@ -32,20 +139,105 @@ int main(int argc, char* const argv[])
 	signal(SIGTERM, sighandler);
 	signal(SIGINT, sighandler);
 
-  if (argc != 5)
+  bool with_audio = false;
+  double quantize = 0;
+  std::vector<device_t> devices;
+  std::vector<uint16_t> osc_ports;
+  bool valid = 5 <= argc;
+  for (int i = 5 ; valid && i < argc ; ++i)
+  {
+    if (!strcmp(argv[i], "--audio"))
+      with_audio = true;
+    else if (!strcmp(argv[i], "--quantize") && i + 1 < argc)
+      valid = 0 <= (quantize = atof(argv[++i]));
+    else if (!strcmp(argv[i], "--osc") && i + 1 < argc)
+    {
+      const int port = atoi(argv[++i]);
+      if ((valid = 0 < port && port <= UINT16_MAX))
+        osc_ports.push_back(port);
+    }
+    else if (!strcmp(argv[i], "--midi") && i + 1 < argc)
+    {
+      auto device = parse_device(argv[++i]);
+      if ((valid = device.has_value()))
+        devices.push_back(std::move(device.value()));
+    }
+    else
+      valid = false;
+  }
+  if (!valid)
   {
-    fprintf(stderr, "Usage : %s <setup-file> <save-file> <driver-ip> <driver-port>\n", argv[0]);
+    fprintf(stderr, "Usage : %s <setup-file> <save-file> <driver-ip> <driver-port> [--audio] [--quantize beats] [--midi name:mapping-file[:priority]]... [--osc port]...\n", argv[0]);
+    fprintf(stderr, "  beats : grid of the quantized midi commands, 1 the beat, 4 the bar, 0 none (default)\n");
+    fprintf(stderr, "  priority : 0 critical (default), 1 performance, 2 bulk\n");
+    fprintf(stderr, "  mapping-file : relative to the current directory, else to the executable's (default mappings/apc40.map)\n");
     exit(EXIT_FAILURE);
   }
+  // The APC40 on 'midi_in' and 'midi_out' by default
+  if (devices.empty())
+    devices.push_back(device_t{ "midi", std::make_unique<Mapper>(mapping_path("mappings/apc40.map")), ArduinoBridge::CRITICAL });
 
   JackBridge apc_bridge{"APC40-Bridge"};
-  Mapper apc_mapper{Mapper::APC40_mappings()};
+  for (auto& device : devices)
+    apc_bridge.add_midi_device(device.name, device.priority);
   Manager manager(argv[2], argv[1]);
+  // The live state is journaled next to the save file, and survives a crash
+  Persistence persistence(argv[2], manager.layout());
   ArduinoBridge arduino(argv[3], argv[4]);
+  Telemetry telemetry;
+  ClockTracker tracker;
+  TempoFollower follower;
+  TimeSync time_sync;
+  // Preset loads, strobes and palettes from the pads land on the beat grid
+  BeatScheduler scheduler;
+  // Follows the audio input tempo when there is no midi clock, and streams its band energies
+  std::optional<BeatTracker> beat_tracker;
+  bool following = false;
 
+  if (with_audio)
+  {
+    apc_bridge.enable_audio();
+    beat_tracker.emplace(apc_bridge.sample_rate());
+  }
   apc_bridge.activate();
 
-  std::future<std::optional<std::string>> input;
+  const dirty_list_t recovered = manager.attach(persistence);
+  fprintf(stderr, "Recovered %zu controls up to change %u in %.2f ms\n",
+    recovered.size(), persistence.recovered_sequence(), persistence.recovery_time() * 1e3);
+  dispatch(recovered, devices, apc_bridge, arduino, ArduinoBridge::BULK);
+
+  // Lighting desks, tablets and scripts drive the same controls over OSC
+  const OscAddressMap osc_addresses(manager);
+  MpscQueue<osc_command_t> osc_queue(OscQueueSize);
+  std::vector<std::unique_ptr<OscServer>> osc_servers;
+  for (uint16_t port : osc_ports)
+    osc_servers.push_back(std::make_unique<OscServer>(port, osc_addresses, osc_queue));
+
+  // Mapping files are reloaded when they change, to remap during the soundcheck
+  std::thread mapping_watcher([&devices]() {
+    while (is_running)
+    {
+      for (auto& device : devices)
+        if (device.mapper->poll())
+          fprintf(stderr, "Reloaded mapping : %s\n", device.mapper->file().c_str());
+      usleep(MappingPollInterval);
+    }
+  });
+
+  // The audio input tempo when there is no midi clock
+  auto tempo_source = [&]() -> const TempoSource& {
+    if (beat_tracker && !tracker.is_running())
+      return *beat_tracker;
+    return tracker;
+  };
+
+  // Stamped in the receiving task, the main loop only polls the future every 100 us and would bias the echo times
+  struct received_t
+  {
+    std::optional<std::string> str;
+    uint64_t time;
+  };
+  std::future<received_t> input;
 
   while (is_running)
   {
@@ -53,7 +245,8 @@ int main(int argc, char* const argv[])
     {
       input = std::async(std::launch::async, [&]() {
         std::cout << "Wait for arduino message" << '\n';
-        return arduino.receive();
+        auto str = arduino.receive();
+        return received_t{ std::move(str), uint64_t(apc_bridge.now() * 1e6) };
       });
     }
     else
@@ -61,36 +254,90 @@ int main(int argc, char* const argv[])
       std::future_status status = input.wait_for(std::chrono::microseconds(100));
       if (status == std::future_status::ready)
       {
-        auto str = input.get();
+        auto [str, received] = input.get();
         if (!str.has_value())
           std::cerr << "Failed retrieve value" << '\n';
         else
-          fprintf(stderr, "Recieved from arduino : %s\n", str.value().c_str());
+          for (auto& text : telemetry.feed(str.value()))
+            fprintf(stderr, "Recieved from arduino : %s\n", text.c_str());
+        for (auto& echo : telemetry.take_echoes())
+          time_sync.on_echo(echo, received);
       }
     }
-    auto messages = apc_bridge.incomming_midi();
-    for (auto& msg : messages)
+    if (auto log = telemetry.periodic_log())
     {
-      auto commands = apc_mapper.midimsg_to_command(msg);
-      for (auto& cmd : commands)
-      {
-        auto result = manager.process_command(cmd);
-        for (auto& [ctrl, force] : result)
-        {
-          if (force || !(ctrl->flags & control_t::VOLATILE))
-          {
-            auto messages = apc_mapper.command_to_midimsg(ctrl->to_command_string());
-            for (auto& msg : messages)
-            {
-              apc_bridge.send_midi(std::move(msg));
-            }
-          }
-          arduino.send(ctrl->addr_offset, ctrl->to_raw_message());
-        }
-      }
+      std::cerr << log.value() << '\n' << time_sync.summary() << '\n' << persistence.summary() << '\n';
+      if (quantize)
+        std::cerr << scheduler.summary() << '\n';
+      for (auto& server : osc_servers)
+        std::cerr << server->summary() << '\n';
+    }
+    // Pings are stamped with the JACK clock, as the midi clock events
+    if (time_sync.ping_due(apc_bridge.now() * 1e6))
+      arduino.send_ping([&apc_bridge]() { return uint32_t(apc_bridge.now() * 1e6); });
+    // All devices in a single stream, read in place from the JACK rings
+    apc_bridge.incomming_midi([&](const midi_event_t& event) {
+      device_t& device = devices[event.device];
+      for (auto& cmd : device.mapper->midimsg_to_command(event.data, event.size))
+        if (!quantize || !manager.is_quantized(cmd) || !scheduler.schedule(cmd, quantize, tempo_source(), apc_bridge.now()))
+          dispatch(manager.process_command(cmd), devices, apc_bridge, arduino, device.priority);
+    });
+    osc_command_t osc_command;
+    for (size_t i = 0 ; i < OscBatch && osc_queue.pop(osc_command) ; ++i)
+    {
+      const control_t& ctrl = manager.control(osc_command.control);
+      if (auto value = to_value(osc_command, ctrl.type))
+        dispatch(manager.process_control(osc_command.control, value.value()), devices, apc_bridge, arduino);
+      else
+        fprintf(stderr, "Invalid OSC value for %s\n", ctrl.name.c_str());
+    }
+
+    for (auto& event : apc_bridge.incomming_clock())
+      tracker.process(event);
+    if (beat_tracker)
+      for (auto& chunk : apc_bridge.incomming_audio())
+        beat_tracker->process(chunk.samples.data(), chunk.samples.size(), chunk.time);
+    const auto snapshot = telemetry.snapshot();
+    const double frame_period = snapshot.valid ? snapshot.report.period_us * 1e-6 : 0.01;
+    if (beat_tracker)
+    {
+      // Band energies go once per driver frame at most, it only shows the last value
+      if (auto msg = beat_tracker->detector().bands().message(apc_bridge.now(), frame_period))
+        arduino.send(offsetof(state_t, audio), msg.value(), ArduinoBridge::PERFORMANCE);
+    }
+    const bool use_audio = beat_tracker && !tracker.is_running();
+    const TempoSource& source = tempo_source();
+    const bool was_locked = following;
+    following = source.is_locked();
+    if (following != was_locked)
+      std::cerr << (use_audio ? "Audio tempo " : "Midi clock ")
+        << (following ? "locked at " + std::to_string(source.bpm()) + " BPM" : "lost") << '\n';
+    auto tempo = follower.update(source, apc_bridge.now(), &time_sync);
+    // Tempo updates are live controls, they never overtake a blackout
+    dispatch(manager.follow_tempo(tempo.bpm, tempo.sync_delta), devices, apc_bridge, arduino, ArduinoBridge::PERFORMANCE);
+    if (tempo.anchor)
+      arduino.send(protocol::PhaseAnchor, to_raw_message(tempo.anchor.value()), ArduinoBridge::PERFORMANCE);
+    // A beat's commands go as one transaction. Once the driver follows the phase anchors it holds
+    //  them until their beat, whatever the link jitter, else they are sent ahead by the link delay
+    const bool anchored = time_sync.is_synced() && source.is_locked();
+    scheduler.set_latency(anchored ? DriverQuantizeLead : frame_period);
+    for (auto& batch : scheduler.advance(source, apc_bridge.now()))
+    {
+      dirty_list_t result;
+      for (auto& cmd : batch.commands)
+        for (auto& [ctrl, force] : manager.process_command(cmd))
+          result[ctrl] = result[ctrl] || force;
+      std::optional<quantize::target_t> target;
+      if (anchored && batch.beat)
+        target = quantize::target_t{ quantize::MasterPhase, 0, 0, TempoFollower::bar_phase(batch.beat.value()) };
+      dispatch(result, devices, apc_bridge, arduino, ArduinoBridge::CRITICAL, target);
     }
+    // No mapping table is held from here to the next loop
+    for (auto& device : devices)
+      device.mapper->quiescent();
     usleep(100);
   }
+  mapping_watcher.join();
   std::cout << "Shuting down program" << std::endl;
   arduino.kill();
 
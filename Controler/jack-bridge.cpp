@@ -5,42 +5,61 @@
 #include <jack/jack.h>
 #include <jack/midiport.h>
 
+#include <stdio.h>
 #include <string.h>
 
 int jack_callback(jack_nframes_t nframes, void* args)
 {
   JackBridge* bridge = (JackBridge*)args;
 
+  const jack_nframes_t period_start = jack_last_frame_time(bridge->client);
+  for (size_t index = 0 ; index < bridge->devices.size() ; ++index)
   {
-    jack_nframes_t events_count;
+    auto& device = bridge->devices[index];
     jack_midi_event_t event;
-
-    void* in_buffer = jack_port_get_buffer(bridge->midi_in, nframes);
-    events_count = jack_midi_get_event_count(in_buffer);
+    void* in_buffer = jack_port_get_buffer(device->in, nframes);
+    const jack_nframes_t events_count = jack_midi_get_event_count(in_buffer);
 
     for (jack_nframes_t i = 0 ; i < events_count ; ++i)
     {
       if (0 != jack_midi_event_get(&event, in_buffer, i))
         continue;
-      std::vector<uint8_t> msg;
-      msg.reserve(event.size);
-      for (size_t i=0 ; i<event.size ; ++i)
-        msg.emplace_back(event.buffer[i]);
-      bridge->from_jack.push(std::move(msg));
+      // Real time messages keep their frame timestamp, for the tempo tracker
+      if (event.size == 1 && (event.buffer[0] == clock_event_t::TICK || event.buffer[0] == clock_event_t::START
+        || event.buffer[0] == clock_event_t::CONTINUE || event.buffer[0] == clock_event_t::STOP))
+      {
+        const jack_time_t time = jack_frames_to_time(bridge->client, period_start + event.time);
+        bridge->clock_from_jack.push(clock_event_t{ clock_event_t::type_e(event.buffer[0]), time * 1e-6 });
+        continue;
+      }
+      // Sysex don't fit, they have no binding anyway
+      if (3 < event.size)
+        continue;
+      midi_event_t msg{ period_start + event.time, uint8_t(index), uint8_t(event.size), {} };
+      memcpy(msg.data, event.buffer, event.size);
+      device->from_jack.push(msg);
     }
   }
+  // The main thread merges up to there : later periods can't overtake this one
+  bridge->completed_frame.store(period_start + nframes, std::memory_order_release);
 
+  if (bridge->audio_in)
   {
-    void* out_buffer = jack_port_get_buffer(bridge->midi_out, nframes);
+    // Dropped whole when the main thread lags, the next stamps keep the timing right
+    const float* samples = (const float*)jack_port_get_buffer(bridge->audio_in, nframes);
+    const jack_time_t time = jack_frames_to_time(bridge->client, jack_last_frame_time(bridge->client));
+    if (bridge->audio_stamps.space() && bridge->audio_from_jack.push(samples, nframes))
+      bridge->audio_stamps.push(JackBridge::audio_stamp_t{ time * 1e-6, nframes });
+  }
+
+  for (auto& device : bridge->devices)
+  {
+    void* out_buffer = jack_port_get_buffer(device->out, nframes);
     jack_midi_clear_buffer(out_buffer);
 
-    std::optional<std::vector<uint8_t>> optmsg;
-    while (std::nullopt != (optmsg = bridge->to_jack.pop()))
-    {
-      auto msg = optmsg.value();
-      void* raw = jack_midi_event_reserve(out_buffer, 0, msg.size());
-      memcpy(raw, msg.data(), msg.size());
-    }
+    midi_message_t msg;
+    while (device->to_jack.pop(&msg, 1))
+      jack_midi_event_write(out_buffer, 0, msg.data, msg.size);
   }
 
   return 0;
@@ -53,14 +72,6 @@ JackBridge::JackBridge(const char* name)
 	if (NULL == client)
 		throw std::runtime_error("Can't open jack client");
 	
-	midi_in = jack_port_register(client, "midi_in", JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
-	if (NULL == midi_in)
-		throw std::runtime_error("Can't open midi in");
-
-	midi_out = jack_port_register(client, "midi_out", JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput, 0);
-	if (NULL == midi_out)
-		throw std::runtime_error("Can't open midi out");
-	
 	if (0 != jack_set_process_callback(client, jack_callback, this))
 		throw std::runtime_error("Can't set process callback");
 }
@@ -73,17 +84,79 @@ void JackBridge::activate()
 {
 	if (0 != jack_activate(client))
 		throw std::runtime_error("Can't activvate client");
+  active = true;
+}
+
+size_t JackBridge::add_midi_device(const std::string& name, uint8_t priority)
+{
+  if (active)
+    throw std::runtime_error("Midi devices must be added before activate");
+
+  auto device = std::make_unique<device_t>();
+  device->priority = priority;
+	device->in = jack_port_register(client, (name + "_in").c_str(), JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
+	if (NULL == device->in)
+		throw std::runtime_error("Can't open " + name + " midi in");
+
+	device->out = jack_port_register(client, (name + "_out").c_str(), JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput, 0);
+	if (NULL == device->out)
+		throw std::runtime_error("Can't open " + name + " midi out");
+
+  devices.push_back(std::move(device));
+  return devices.size() - 1;
+}
+
+void JackBridge::send_midi(size_t device, const std::vector<uint8_t>& msg)
+{
+  midi_message_t raw{ uint8_t(msg.size()), {} };
+  if (sizeof(raw.data) < msg.size())
+  {
+    fprintf(stderr, "Unsupported midimsg : %zu\n", msg.size());
+    return;
+  }
+  memcpy(raw.data, msg.data(), msg.size());
+  devices.at(device)->to_jack.push(raw);
 }
 
-std::vector<std::vector<uint8_t>> JackBridge::incomming_midi()
+std::vector<clock_event_t> JackBridge::incomming_clock()
 {
-  std::vector<std::vector<uint8_t>> result;
-	std::optional<std::vector<uint8_t>> optmsg;
-  while (std::nullopt != (optmsg = from_jack.pop()))
-    result.push_back(optmsg.value());
+  std::vector<clock_event_t> result;
+  clock_event_t event;
+  while (clock_from_jack.pop(&event, 1))
+    result.push_back(event);
   return result;
 }
-void JackBridge::send_midi(std::vector<uint8_t>&& msg)
+double JackBridge::now() const
 {
-  to_jack.push(std::forward<std::vector<uint8_t>>(msg));
-}
\ No newline at end of file
+  return jack_get_time() * 1e-6;
+}
+
+void JackBridge::enable_audio(double seconds)
+{
+  const double frames = seconds * sample_rate();
+  audio_from_jack.reset(frames);
+  // Down to 32 frames periods
+  audio_stamps.reset(frames / 32);
+
+	audio_in = jack_port_register(client, "audio_in", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+	if (NULL == audio_in)
+		throw std::runtime_error("Can't open audio in");
+}
+
+std::vector<audio_chunk_t> JackBridge::incomming_audio()
+{
+  std::vector<audio_chunk_t> result;
+  audio_stamp_t stamp;
+  // Samples are pushed before their stamp
+  while (audio_stamps.pop(&stamp, 1))
+  {
+    audio_chunk_t chunk{ stamp.time, std::vector<float>(stamp.frames) };
+    audio_from_jack.pop(chunk.samples.data(), stamp.frames);
+    result.push_back(std::move(chunk));
+  }
+  return result;
+}
+double JackBridge::sample_rate() const
+{
+  return jack_get_sample_rate(client);
+}
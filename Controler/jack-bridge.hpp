@@ -3,10 +3,21 @@
 #include <jack/jack.h>
 
 #include <vector>
-#include <queue>
+#include <memory>
+#include <string>
+#include <atomic>
 #include <cstdint>
 
-#include "thread-queue.hpp"
+#include "spsc-ring.hpp"
+#include "midi-stream.hpp"
+#include "clock-tracker.hpp"
+
+/// Audio of a JACK period
+struct audio_chunk_t
+{
+  double time; ///!< Of the first sample, in the time base of the clock events
+  std::vector<float> samples;
+};
 
 class JackBridge {
 public :
@@ -15,15 +26,54 @@ public :
 
   void activate();
 
-  std::vector<std::vector<uint8_t>> incomming_midi();
-  void send_midi(std::vector<uint8_t>&& msg);
+  /// Registers the ports '<name>_in' and '<name>_out', before activate(). Returns the device index
+  size_t add_midi_device(const std::string& name, uint8_t priority = 0);
+  size_t midi_devices_count() const { return devices.size(); }
+
+  /// Calls 'handler(const midi_event_t&)' on the messages received since the last call, all devices
+  ///  merged by frame then by priority. Returns the number of events handled
+  template <typename Handler>
+  size_t incomming_midi(Handler&& handler)
+  {
+    return merge_midi(devices, completed_frame.load(std::memory_order_acquire), handler);
+  }
+  /// Queues a message to the output port of 'device', sysex aren't supported
+  void send_midi(size_t device, const std::vector<uint8_t>& msg);
+
+  /// MIDI clock and transport messages, timestamped from their frame
+  std::vector<clock_event_t> incomming_clock();
+  /// Current time, in the time base of the clock events
+  double now() const;
+
+  /// Registers the optional 'audio_in' port, before activate(). 'seconds' of audio wait for the main thread
+  void enable_audio(double seconds = 4);
+  /// Audio received since the last call, one chunk per JACK period. Empty without audio input
+  std::vector<audio_chunk_t> incomming_audio();
+  double sample_rate() const;
 
 private :
   friend int jack_callback(jack_nframes_t nframes, void* args);
 
+  struct device_t : midi_device_t
+  {
+    jack_port_t* in = nullptr;
+    jack_port_t* out = nullptr;
+  };
+
   jack_client_t* client = nullptr;
-  jack_port_t* midi_in = nullptr;
-  jack_port_t* midi_out = nullptr;
+  bool active = false;
+  jack_port_t* audio_in = nullptr;
+
+  struct audio_stamp_t
+  {
+    double   time;
+    uint32_t frames;
+  };
 
-  ThreadSafeQueue<std::vector<uint8_t>> from_jack, to_jack;
+  // The process callback can't wait for a lock nor allocate : devices are fixed once active
+  std::vector<std::unique_ptr<device_t>> devices;
+  std::atomic<uint32_t> completed_frame{0}; ///!< End of the last period pushed to all the devices
+  SpscRing<clock_event_t> clock_from_jack{1024};
+  SpscRing<float> audio_from_jack;
+  SpscRing<audio_stamp_t> audio_stamps;
 };
\ No newline at end of file
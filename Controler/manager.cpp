@@ -1,10 +1,13 @@
 #include "manager.hpp"
+#include "persistence.hpp"
 
 #include "../driver/state.h"
+#include "../driver/fixed_point.h"
 
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 
 std::string control_t::to_command_string() const
 {
@@ -23,6 +26,43 @@ std::string control_t::to_command_string() const
   }
   return std::string(tmp);
 }
+bool control_t::parse_value(const char* arg, value_u& value) const
+{
+  int vi;
+  float vf;
+  switch (type)
+  {
+  case control_t::UINT7:
+    if (1 != sscanf(arg, "%u", &vi))
+      return false;
+    value.u = vi;
+    return true;
+  case control_t::BOOL:
+    if (arg[0] != 'y' && arg[0] != 'n')
+      return false;
+    value.b = arg[0] == 'y';
+    return true;
+  case control_t::FLOAT:
+    if (1 != sscanf(arg, "%f", &vf))
+      return false;
+    value.f = vf;
+    return true;
+  }
+  return false;
+}
+bool control_t::has_value(const value_u& value) const
+{
+  switch (type)
+  {
+  case control_t::UINT7:
+    return val.u == value.u;
+  case control_t::BOOL:
+    return val.b == value.b;
+  case control_t::FLOAT:
+    return val.f == value.f;
+  }
+  return false;
+}
 std::vector<uint8_t> control_t::to_raw_message() const
 {
   char rawmsg[512];
@@ -42,11 +82,15 @@ std::vector<uint8_t> control_t::to_raw_message() const
     msglen = 4;
     break;
   case control_t::FLOAT:
-    rawmsg[2] = sizeof(float);
-    memcpy(rawmsg+3, &val.f, sizeof(float));
-    msglen = 3 + sizeof(float);
+  {
+    // The driver has no FPU, floats are sent as UQ16.16
+    const uint32_t raw = fixed::uq16_16::from_float(val.f < 0 ? 0 : val.f).raw;
+    rawmsg[2] = sizeof(raw);
+    memcpy(rawmsg+3, &raw, sizeof(raw));
+    msglen = 3 + sizeof(raw);
     break;
   }
+  }
   std::vector<uint8_t> msg;
   msg.reserve(msglen);
   for (size_t i=0 ; i<msglen ; ++i)
@@ -69,7 +113,8 @@ void toggle_callback(control_t* ctrl, dirty_list_t& dirty_controls, control_t::v
 Manager::Manager(const char* save_path, const char* setup_path) :
   controls_list(), controls_by_name(), controls_by_addr(),
   path_of_save(save_path), path_of_setup(setup_path),
-  presets_list(), current_preset_index(0)
+  presets_list(), current_preset_index(0), is_synced(false),
+  persistence(nullptr), journaled_preset(0)
 {
   // Generate controls
   size_t offset;
@@ -77,13 +122,13 @@ Manager::Manager(const char* save_path, const char* setup_path) :
   // triggers
   offset = offsetof(state_t, triggers);
   controls_list.emplace_back(control_t{ control_t::TRIGGER, "save", offset + offsetof(state_t::triggers_t, save), control_t::BOOL, {0}, [this](control_t* ctrl, dirty_list_t& dirty_contorls, control_t::value_u val){ this->save(ctrl, dirty_contorls, val); }});
-  controls_list.emplace_back(control_t{ control_t::TRIGGER, "load", offset + offsetof(state_t::triggers_t, load), control_t::BOOL, {0}, [this](control_t* ctrl, dirty_list_t& dirty_contorls, control_t::value_u val){ this->load(ctrl, dirty_contorls, val); }});
-  controls_list.emplace_back(control_t{ control_t::TRIGGER, "next_preset", offset + offsetof(state_t::triggers_t, next_preset), control_t::BOOL, {0}, 
+  controls_list.emplace_back(control_t{ control_t::TRIGGER | control_t::QUANTIZED, "load", offset + offsetof(state_t::triggers_t, load), control_t::BOOL, {0}, [this](control_t* ctrl, dirty_list_t& dirty_contorls, control_t::value_u val){ this->load(ctrl, dirty_contorls, val); }});
+  controls_list.emplace_back(control_t{ control_t::TRIGGER | control_t::QUANTIZED, "next_preset", offset + offsetof(state_t::triggers_t, next_preset), control_t::BOOL, {0}, 
   [this](control_t* ctrl, dirty_list_t& dirty_contorls, control_t::value_u val){
     current_preset_index = (current_preset_index+1) % presets_list.size();
-    load(ctrl, dirty_contorls, val);
+    load_preset(dirty_contorls, false);
   }});
-  controls_list.emplace_back(control_t{ control_t::TRIGGER, "prev_preset", offset + offsetof(state_t::triggers_t, prev_preset), control_t::BOOL, {0}, 
+  controls_list.emplace_back(control_t{ control_t::TRIGGER | control_t::QUANTIZED, "prev_preset", offset + offsetof(state_t::triggers_t, prev_preset), control_t::BOOL, {0}, 
   [this](control_t* ctrl, dirty_list_t& dirty_contorls, control_t::value_u val){
     if (presets_list.size() != 0)
     {
@@ -91,7 +136,7 @@ Manager::Manager(const char* save_path, const char* setup_path) :
         current_preset_index = presets_list.size();
       current_preset_index = current_preset_index-1;
     }
-    load(ctrl, dirty_contorls, val);
+    load_preset(dirty_contorls, false);
   }});
 
   controls_list.emplace_back(control_t{ control_t::TRIGGER, "reset_bpm", offset + offsetof(state_t::triggers_t, reset_bpm), control_t::BOOL, {0}, 
@@ -159,14 +204,19 @@ Manager::Manager(const char* save_path, const char* setup_path) :
     controls_list.emplace_back(control_t{ control_t::SETUP, "ribbons_lengths:" + std::to_string(i), offset + offsetof(state_t::setup_t, ribbons_lengths) + i, control_t::UINT7, {0}, default_callback });
   for (size_t i=0 ; i<SOLOS_COUNT ; ++i)
     controls_list.emplace_back(control_t{ control_t::SETUP, "soloribbons_location:" + std::to_string(i), offset + offsetof(state_t::setup_t, soloribbons_location) + i, control_t::UINT7, {0}, default_callback });
+  for (size_t i=0 ; i<MAX_RIBBONS_COUNT ; ++i)
+    controls_list.emplace_back(control_t{ control_t::SETUP, "ribbons_reversed:" + std::to_string(i), offset + offsetof(state_t::setup_t, ribbons_reversed) + i, control_t::BOOL, {0}, default_callback });
+  controls_list.emplace_back(control_t{ control_t::SETUP, "solo_ribbon", offset + offsetof(state_t::setup_t, solo_ribbon), control_t::UINT7, {MAX_RIBBONS_COUNT - 1}, default_callback});
+  controls_list.emplace_back(control_t{ control_t::SETUP, "module_length", offset + offsetof(state_t::setup_t, module_length), control_t::UINT7, {30}, default_callback});
+  controls_list.emplace_back(control_t{ control_t::SETUP, "telemetry_period", offset + offsetof(state_t::setup_t, telemetry_period), control_t::UINT7, {20}, default_callback});
 
   // master
   offset = offsetof(state_t, master);
   controls_list.emplace_back(control_t{ control_t::VOLATILE, "bpm",         offset + offsetof(state_t::master_t, bpm), control_t::FLOAT, {0}, default_callback});
   controls_list.emplace_back(control_t{ 0, "sync_correction", offset + offsetof(state_t::master_t, sync_correction), control_t::UINT7, {0}, default_callback});
 
-  controls_list.emplace_back(control_t{ control_t::PHYSICAL, "brightness",    offset + offsetof(state_t::master_t, brightness),   control_t::UINT7, {0}, default_callback});
-  controls_list.emplace_back(control_t{ control_t::PHYSICAL, "strobe_speed",  offset + offsetof(state_t::master_t, strobe_speed), control_t::UINT7, {0}, default_callback});
+  controls_list.emplace_back(control_t{ control_t::PHYSICAL | control_t::CRITICAL, "brightness",    offset + offsetof(state_t::master_t, brightness),   control_t::UINT7, {0}, default_callback});
+  controls_list.emplace_back(control_t{ control_t::PHYSICAL | control_t::CRITICAL, "strobe_speed",  offset + offsetof(state_t::master_t, strobe_speed), control_t::UINT7, {0}, default_callback});
 
   controls_list.emplace_back(control_t{ 0, "blur_enable",    offset + offsetof(state_t::master_t, blur_enable),   control_t::BOOL, {0}, toggle_callback});
   controls_list.emplace_back(control_t{ control_t::VOLATILE, "blur_qty",    offset + offsetof(state_t::master_t, blur_qty),   control_t::UINT7, {0}, default_callback});
@@ -176,24 +226,26 @@ Manager::Manager(const char* save_path, const char* setup_path) :
   controls_list.emplace_back(control_t{ control_t::VOLATILE, "solo_weak_dim",    offset + offsetof(state_t::master_t, solo_weak_dim),   control_t::UINT7, {0}, default_callback});
   controls_list.emplace_back(control_t{ control_t::VOLATILE, "solo_strong_dim",    offset + offsetof(state_t::master_t, solo_strong_dim),   control_t::UINT7, {0}, default_callback});
   
-  controls_list.emplace_back(control_t{ control_t::VOLATILE, "do_kill_lights",    offset + offsetof(state_t::master_t, do_kill_lights),   control_t::BOOL, {0}, default_callback});
+  controls_list.emplace_back(control_t{ control_t::VOLATILE | control_t::CRITICAL, "do_kill_lights",    offset + offsetof(state_t::master_t, do_kill_lights),   control_t::BOOL, {0}, default_callback});
 
   // presets
   for (size_t p=0 ; p<PRESETS_COUNT ; ++p)
   {
     offset = offsetof(state_t, presets) + p * sizeof(state_t::preset_t);
 
-    controls_list.emplace_back(control_t{ control_t::VOLATILE, "palette:" + std::to_string(p), offset + offsetof(state_t::preset_t, palette), control_t::UINT7, {0}, default_callback});
+    controls_list.emplace_back(control_t{ control_t::VOLATILE | control_t::QUANTIZED, "palette:" + std::to_string(p), offset + offsetof(state_t::preset_t, palette), control_t::UINT7, {0}, default_callback});
     
     controls_list.emplace_back(control_t{ 0, "colormod_enable:" + std::to_string(p), offset + offsetof(state_t::preset_t, colormod_enable), control_t::BOOL, {0}, toggle_callback});
     controls_list.emplace_back(control_t{ control_t::VOLATILE, "colormod_osc:" + std::to_string(p), offset + offsetof(state_t::preset_t, colormod_osc), control_t::UINT7, {0}, default_callback});
     controls_list.emplace_back(control_t{ control_t::VOLATILE, "colormod_width:" + std::to_string(p), offset + offsetof(state_t::preset_t, colormod_width), control_t::UINT7, {0}, default_callback});
     controls_list.emplace_back(control_t{ 0, "colormod_move:" + std::to_string(p), offset + offsetof(state_t::preset_t, colormod_move), control_t::BOOL, {0}, default_callback});
+    controls_list.emplace_back(control_t{ 0, "colormod_band:" + std::to_string(p), offset + offsetof(state_t::preset_t, colormod_band), control_t::UINT7, {0}, default_callback});
 
     controls_list.emplace_back(control_t{ 0, "maskmod_enable:" + std::to_string(p), offset + offsetof(state_t::preset_t, maskmod_enable), control_t::BOOL, {0}, toggle_callback});
     controls_list.emplace_back(control_t{ control_t::VOLATILE, "maskmod_osc:" + std::to_string(p), offset + offsetof(state_t::preset_t, maskmod_osc), control_t::UINT7, {0}, default_callback});
     controls_list.emplace_back(control_t{ control_t::VOLATILE, "maskmod_width:" + std::to_string(p), offset + offsetof(state_t::preset_t, maskmod_width), control_t::UINT7, {0}, default_callback});
     controls_list.emplace_back(control_t{ 0, "maskmod_move:" + std::to_string(p), offset + offsetof(state_t::preset_t, maskmod_move), control_t::BOOL, {0}, default_callback});
+    controls_list.emplace_back(control_t{ 0, "maskmod_band:" + std::to_string(p), offset + offsetof(state_t::preset_t, maskmod_band), control_t::UINT7, {0}, default_callback});
 
     controls_list.emplace_back(control_t{ control_t::VOLATILE, "slicer_nslices:" + std::to_string(p), offset + offsetof(state_t::preset_t, slicer_nslices), control_t::UINT7, {0}, default_callback});
     controls_list.emplace_back(control_t{ 0, "slicer_useuneven:" + std::to_string(p), offset + offsetof(state_t::preset_t, slicer_useuneven), control_t::BOOL, {0}, toggle_callback});
@@ -203,7 +255,7 @@ Manager::Manager(const char* save_path, const char* setup_path) :
     controls_list.emplace_back(control_t{ 0, "feedback_enable:" + std::to_string(p), offset + offsetof(state_t::preset_t, feedback_enable), control_t::BOOL, {0}, toggle_callback});
     controls_list.emplace_back(control_t{ control_t::VOLATILE, "feedback_qty:" + std::to_string(p), offset + offsetof(state_t::preset_t, feedback_qty), control_t::UINT7, {0}, default_callback});
 
-    controls_list.emplace_back(control_t{ 0, "strobe_enable:" + std::to_string(p), offset + offsetof(state_t::preset_t, strobe_enable), control_t::BOOL, {0}, toggle_callback});
+    controls_list.emplace_back(control_t{ control_t::QUANTIZED, "strobe_enable:" + std::to_string(p), offset + offsetof(state_t::preset_t, strobe_enable), control_t::BOOL, {0}, toggle_callback});
 
     controls_list.emplace_back(control_t{ control_t::VOLATILE, "speed_scale:" + std::to_string(p), offset + offsetof(state_t::preset_t, speed_scale), control_t::UINT7, {0}, default_callback});
     controls_list.emplace_back(control_t{ 0, "slicer_mergeribbon:" + std::to_string(p), offset + offsetof(state_t::preset_t, slicer_mergeribbon), control_t::BOOL, {0}, default_callback});
@@ -245,42 +297,136 @@ dirty_list_t Manager::process_command(const std::string& cmdstr)
   for (auto itr = begin; itr != end; ++itr)
   {
     auto& [_, ctrl] = *itr;
-    int vi;
-    float vf;
     control_t::value_u val;
-    switch(ctrl->type)
+    if (!ctrl->parse_value(arg, val))
     {
-    case control_t::UINT7:
-      if (1 != sscanf(arg, "%u", &vi))
-      {
-        fprintf(stderr, "Invalid value : %s\n", arg);
-        continue;
-      }
-      val.u = vi;
-      break;
-    case control_t::BOOL:
-      if (arg[0] != 'y' && arg[0] != 'n')
-      {
-        fprintf(stderr, "Invalid value : %s\n", arg);
-        continue;
-      }
-      val.b = arg[0] == 'y';
-      break;
-    case control_t::FLOAT:
-      if (1 != sscanf(arg, "%f", &vf))
-      {
-        fprintf(stderr, "Invalid value : %s\n", arg);
-        continue;
-      }
-      val.f = vf;
-      break;
+      fprintf(stderr, "Invalid value : %s\n", arg);
+      continue;
     }
     ctrl->on_update(ctrl, result, val);
   }
 
+  journal(result);
+  return result;
+}
+
+dirty_list_t Manager::process_control(uint16_t id, control_t::value_u val)
+{
+  dirty_list_t result;
+  control_t* ctrl = &controls_list.at(id);
+  ctrl->on_update(ctrl, result, val);
+  journal(result);
+  return result;
+}
+
+bool Manager::is_quantized(const std::string& cmdstr) const
+{
+  const std::string name = cmdstr.substr(0, cmdstr.find(' '));
+  auto [begin, end] = controls_by_name.equal_range(name);
+  for (auto itr = begin; itr != end; ++itr)
+    if (itr->second->flags & control_t::QUANTIZED)
+      return true;
+  return false;
+}
+
+dirty_list_t Manager::follow_tempo(std::optional<float> bpm, int8_t sync_delta)
+{
+  dirty_list_t result;
+  if (bpm)
+  {
+    auto& ctrl = controls_by_name["bpm"];
+    ctrl->val.f = bpm.value();
+    result.insert_or_assign(ctrl, false);
+  }
+  if (sync_delta)
+  {
+    auto& ctrl = controls_by_name["sync_correction"];
+    ctrl->val.u += sync_delta;
+    result.insert_or_assign(ctrl, false);
+  }
+  journal(result);
+  return result;
+}
+
+/// Journaled value of a control, whatever its type
+static uint32_t raw_value(const control_t& ctrl)
+{
+  uint32_t raw = 0;
+  switch (ctrl.type)
+  {
+  case control_t::UINT7:
+    raw = ctrl.val.u;
+    break;
+  case control_t::BOOL:
+    raw = ctrl.val.b;
+    break;
+  case control_t::FLOAT:
+    memcpy(&raw, &ctrl.val.f, sizeof(raw));
+    break;
+  }
+  return raw;
+}
+static control_t::value_u from_raw_value(control_t::type_e type, uint32_t raw)
+{
+  control_t::value_u val = {0};
+  switch (type)
+  {
+  case control_t::UINT7:
+    val.u = raw;
+    break;
+  case control_t::BOOL:
+    val.b = raw;
+    break;
+  case control_t::FLOAT:
+    memcpy(&val.f, &raw, sizeof(raw));
+    break;
+  }
+  return val;
+}
+
+uint64_t Manager::layout() const
+{
+  std::vector<std::string> names;
+  for (auto& ctrl : controls_list)
+    names.push_back(ctrl.name);
+  return Persistence::fingerprint(names);
+}
+
+dirty_list_t Manager::attach(Persistence& persistence)
+{
+  dirty_list_t result;
+  for (auto [key, raw] : persistence.recovered())
+  {
+    if (key == Persistence::PresetKey)
+      current_preset_index = raw;
+    else if (key < controls_list.size() && !(controls_list[key].flags & control_t::NON_SAVEABLE))
+    {
+      control_t& ctrl = controls_list[key];
+      ctrl.val = from_raw_value(ctrl.type, raw);
+      result.insert_or_assign(&ctrl, true);
+    }
+  }
+  // The recovered preset is the one saved to, if it is still listed
+  load_saves_list();
+  this->persistence = &persistence;
+  journaled_preset = current_preset_index;
   return result;
 }
 
+void Manager::journal(const dirty_list_t& dirty_controls)
+{
+  if (!persistence)
+    return;
+  for (auto& [ctrl, _] : dirty_controls)
+    if (!(ctrl->flags & control_t::NON_SAVEABLE))
+      persistence->record(ctrl - controls_list.data(), raw_value(*ctrl));
+  if (current_preset_index != journaled_preset)
+  {
+    journaled_preset = current_preset_index;
+    persistence->record(Persistence::PresetKey, current_preset_index);
+  }
+}
+
 void Manager::load_saves_list()
 {
   FILE* file = fopen(path_of_save, "r");
@@ -319,7 +465,7 @@ void Manager::load_saves_list()
     current_preset_index = 0;
   }
 }
-void Manager::load_file(const char* path, dirty_list_t& dirty_controls)
+void Manager::load_file(const char* path, dirty_list_t& dirty_controls, bool full)
 {
 FILE* file = fopen(path, "r");
   if (!file)
@@ -347,35 +493,16 @@ FILE* file = fopen(path, "r");
     for (auto itr = begin; itr != end; ++itr)
     {
       auto& [_, ctrl] = *itr;
-      int vi;
-      float vf;
-      switch(ctrl->type)
+      control_t::value_u val;
+      if (!ctrl->parse_value(arg, val))
       {
-      case control_t::UINT7:
-        if (1 != sscanf(arg, "%u", &vi))
-        {
-          fprintf(stderr, "Invalid value : %s\n", arg);
-          continue;
-        }
-        ctrl->val.u = vi;
-        break;
-      case control_t::BOOL:
-        if (arg[0] != 'y' && arg[0] != 'n')
-        {
-          fprintf(stderr, "Invalid value : %s\n", arg);
-          continue;
-        }
-        ctrl->val.b = arg[0] == 'y';
-        break;
-      case control_t::FLOAT:
-        if (1 != sscanf(arg, "%f", &vf))
-        {
-          fprintf(stderr, "Invalid value : %s\n", arg);
-          continue;
-        }
-        ctrl->val.f = vf;
-        break;
+        fprintf(stderr, "Invalid value : %s\n", arg);
+        continue;
       }
+      // Only changed controls are sent to the driver and the APC40
+      if (!full && ctrl->has_value(val))
+        continue;
+      ctrl->val = val;
       dirty_controls.insert_or_assign(ctrl, true);
     }
   }
@@ -384,6 +511,13 @@ FILE* file = fopen(path, "r");
 }
 void Manager::load(control_t*, dirty_list_t& dirty_controls, control_t::value_u)
 {
+  // An explicit load resends everything, to resync a rebooted driver
+  load_preset(dirty_controls, true);
+}
+void Manager::load_preset(dirty_list_t& dirty_controls, bool full)
+{
+  // Until a first full load, the driver and the APC40 state is unknown
+  full = full || !is_synced;
   load_saves_list();
   if (presets_list.size() == 0)
   {
@@ -391,8 +525,9 @@ void Manager::load(control_t*, dirty_list_t& dirty_controls, control_t::value_u)
     return;
   }
   dirty_controls.clear();
-  load_file(path_of_setup, dirty_controls);
-  load_file(presets_list[current_preset_index].c_str(), dirty_controls);
+  load_file(path_of_setup, dirty_controls, full);
+  load_file(presets_list[current_preset_index].c_str(), dirty_controls, full);
+  is_synced = true;
 }
 
 void Manager::save(control_t*, dirty_list_t& dirty_controls, control_t::value_u)
@@ -402,32 +537,33 @@ void Manager::save(control_t*, dirty_list_t& dirty_controls, control_t::value_u)
     fprintf(stderr, "ERROR : Failed to save\n");
     return;
   }
-  FILE* file = fopen(presets_list[current_preset_index].c_str(), "w");
-  if (!file)
-  {
-    perror("fopen save");
-    exit(EXIT_FAILURE);
-  }
+  std::string content;
+  char tmp[512];
   for (auto& ctrl : controls_list)
   {
     if (ctrl.flags & (control_t::NON_SAVEABLE | control_t::SETUP))
       continue;
     
-    fprintf(file, "%s ", ctrl.name.c_str());
     switch (ctrl.type)
     {
     case control_t::UINT7:
-      fprintf(file, "%0u", ctrl.val.u);
+      snprintf(tmp, sizeof(tmp), "%s %0u\n", ctrl.name.c_str(), ctrl.val.u);
       break;
     case control_t::BOOL:
-      fprintf(file, "%c", ctrl.val.b ? 'y' : 'n');
+      snprintf(tmp, sizeof(tmp), "%s %c\n", ctrl.name.c_str(), ctrl.val.b ? 'y' : 'n');
       break;
     case control_t::FLOAT:
-      fprintf(file, "%0.0f", ctrl.val.f);
+      snprintf(tmp, sizeof(tmp), "%s %0.0f\n", ctrl.name.c_str(), ctrl.val.f);
       break;
     }
-    fprintf(file, "\n");
+    content += tmp;
   }
-  fclose(file);
-  fprintf(stderr, "Successfully saved : %s\n", presets_list[current_preset_index].c_str());
+  // Written by the persistence thread when there is one, a failed save leaves the preset as it was
+  const std::string& path = presets_list[current_preset_index];
+  if (persistence)
+    persistence->write_file(path, std::move(content));
+  else if (Persistence::write_file_atomic(path, content))
+    fprintf(stderr, "Successfully saved : %s\n", path.c_str());
+  else
+    fprintf(stderr, "ERROR : Failed to save %s : %s\n", path.c_str(), strerror(errno));
 }
@@ -2,11 +2,14 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
 #include <utility>
+#include <optional>
 #include <functional>
 #include <unordered_map>
 
 struct control_t;
+class Persistence;
 using dirty_list_t = std::unordered_map<const control_t*, bool>; // (ctrl, force update)
 
 struct control_t
@@ -14,7 +17,7 @@ struct control_t
   enum type_e {
     UINT7,
     BOOL,
-    FLOAT,
+    FLOAT, ///!< Sent to the driver as UQ16.16 fixed point
   };
   union value_u {
     uint8_t u;
@@ -27,6 +30,8 @@ struct control_t
     NON_SAVEABLE  = 0x01,
     NON_LOADABLE  = 0x02,
     VOLATILE      = 0x04,
+    CRITICAL      = 0x10, ///!< Sent to the driver before any other pending write
+    QUANTIZED     = 0x20, ///!< Waits for the beat grid when the controller quantizes
     SETUP         = 0x80,
     PHYSICAL      = NON_SAVEABLE | NON_LOADABLE | VOLATILE,
     TRIGGER       = NON_SAVEABLE | VOLATILE,
@@ -41,6 +46,9 @@ struct control_t
 
   std::function<void(control_t*, dirty_list_t&, value_u)> on_update;
 
+  bool parse_value(const char* arg, value_u& value) const;
+  bool has_value(const value_u& value) const;
+
   std::string to_command_string() const;
   std::vector<uint8_t> to_raw_message() const;
 };
@@ -55,6 +63,10 @@ class Manager {
 
   std::vector<std::string> presets_list;
   size_t current_preset_index;
+  bool is_synced; ///!< False until the whole state has been loaded once
+
+  Persistence* persistence;      ///!< Journals every change once attached
+  size_t       journaled_preset;
 
 public:
 
@@ -62,10 +74,31 @@ public:
 
   dirty_list_t process_command(const std::string& cmd);
 
+  /// Controls by id, their index in the list
+  size_t controls_count() const { return controls_list.size(); }
+  const control_t& control(uint16_t id) const { return controls_list.at(id); }
+  /// As 'process_command', without the text on the way
+  dirty_list_t process_control(uint16_t id, control_t::value_u val);
+  /// Whether the command sets a control flagged QUANTIZED
+  bool is_quantized(const std::string& cmd) const;
+
+  /// Applies the MIDI clock tempo, the sync delta adds to the manual sync correction
+  dirty_list_t follow_tempo(std::optional<float> bpm, int8_t sync_delta);
+
+  /// Fingerprint of the controls, a journal from another one is not replayed
+  uint64_t layout() const;
+  /// Restores the state recovered by 'persistence' and journals each change from now on.
+  ///   Returns the restored controls, to resend
+  dirty_list_t attach(Persistence& persistence);
+
 private:
 
+  void journal(const dirty_list_t& dirty_controls);
+
   void load_saves_list();
-  void load_file(const char* path, dirty_list_t& dirty_controls);
+  /// Loads a setup or preset file, only marking the changed controls unless 'full'
+  void load_file(const char* path, dirty_list_t& dirty_controls, bool full);
+  void load_preset(dirty_list_t& dirty_controls, bool full);
   void load(control_t*, dirty_list_t& dirty_controls, control_t::value_u);
 
   void save(control_t*, dirty_list_t& dirty_controls, control_t::value_u);
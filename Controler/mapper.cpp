@@ -1,142 +1,93 @@
 #include "mapper.hpp"
 
-std::string uint8_to_str(const binding_t* bnd, uint8_t val)
-{
-  return std::to_string(val);
-}
-void str_to_uint8(const binding_t* bnd, const char* str, uint8_t val[3])
-{
-  int res;
-  sscanf(str, "%d", &res);
-  val[0] = bnd->midikey[0];
-  val[1] = bnd->midikey[1];
-  val[2] = res;
-}
+#include <sys/stat.h>
 
-std::string bool_to_str(const binding_t* bnd, uint8_t val)
-{
-  return 0x40 <= val ? "y" : "n";
-}
-void str_to_bool(const binding_t* bnd, const char* str, uint8_t val[3])
-{
-  val[0] = bnd->midikey[0];
-  val[1] = bnd->midikey[1];
-  val[2] = str[0] == 'y' ? 0x7F : 0x00;
-}
+#include <stdlib.h>
+#include <string.h>
 
-std::string pad_to_str(const binding_t* bnd, uint8_t val)
-{
-  return 0x90 == (bnd->midikey[0] & 0xF0) ? "y" : "n";
-}
-void str_to_pad(const binding_t* bnd, const char* str, uint8_t val[3])
+#include <algorithm>
+#include <stdexcept>
+
+std::optional<transform_e> parse_transform(const char* name)
 {
-  val[0] = str[0] == 'y' ? 0x90 : 0x80;
-  val[0] |= bnd->midikey[0] & 0x0F;
-  val[1] = bnd->midikey[1];
-  val[2] = 0x7F;
+  if (!strcmp(name, "none"))  return transform_e::NONE;
+  if (!strcmp(name, "value")) return transform_e::VALUE;
+  if (!strcmp(name, "bool"))  return transform_e::BOOL;
+  if (!strcmp(name, "pad"))   return transform_e::PAD;
+  return std::nullopt;
 }
 
-const std::vector<binding_t>& Mapper::APC40_mappings()
+std::optional<MappingTable> MappingTable::load(const char* path)
 {
-  static bool once = true;
-  if (!once) throw 0;
-  once = false;
-  
-  // Generate bindings
-  static std::vector<binding_t> bindings_list = {
-    { {0x90, 0x5b}, "load", bool_to_str, str_to_bool},
-    { {0x90, 0x5d}, "save", bool_to_str, str_to_bool},
-    { {0x90, 0x61}, "prev_preset", bool_to_str, str_to_bool},
-    { {0x90, 0x60}, "next_preset", bool_to_str, str_to_bool},
-
-    { {0x90, 0x63}, "reset_bpm", bool_to_str, str_to_bool},
-    { {0xb0, 0x2f}, "correct_bpm", bool_to_str, str_to_bool},
-    { {0x90, 0x65}, "sync_left", bool_to_str, str_to_bool},
-    { {0x90, 0x64}, "sync_right", bool_to_str, str_to_bool},
-
-    { {0xb0, 0x0e}, "brightness", uint8_to_str, str_to_uint8},
-    { {0xb0, 0x0f}, "strobe_speed", uint8_to_str, str_to_uint8},
-
-    { {0xb8, 0x13}, "blur_qty", uint8_to_str, str_to_uint8},
-
-    { {0xb8, 0x10}, "solo_weak_dim", uint8_to_str, str_to_uint8},
-    { {0xb8, 0x14}, "solo_strong_dim", uint8_to_str, str_to_uint8},
-  };
-
-  for (uint8_t o=0 ; o <= 0x10 ; o += 0x10)
+  FILE* file = fopen(path, "r");
+  if (!file)
   {
-    bindings_list.emplace_back(binding_t{{(uint8_t)(0x80 + o), 0x55}, "blur_enable", pad_to_str, str_to_pad});
-    bindings_list.emplace_back(binding_t{{(uint8_t)(0x80 + o), 0x51}, "do_kill_lights", pad_to_str, str_to_pad});
-
-    for (uint8_t i=0 ; i<4 ; ++i)
-      bindings_list.emplace_back(binding_t{{(uint8_t)(0x80 + o), (uint8_t)(0x57 + i)}, "solo:" + std::to_string(i), pad_to_str, str_to_pad});
+    perror("fopen mapping");
+    return std::nullopt;
   }
 
-  for (uint8_t p=0 ; p < 8 ; ++p)
+  MappingTable table;
+  std::unordered_map<std::string, uint16_t> command_index;
+  bool valid = true;
+  char buffer[512];
+  for (int line = 1 ; fgets(buffer, 512, file) ; ++line)
   {
-    bindings_list.emplace_back(binding_t{{0xb0, (uint8_t)(0x30 + p)}, "palette:" + std::to_string(p), uint8_to_str, str_to_uint8});
-
-    bindings_list.emplace_back(binding_t{{(uint8_t)(0xb0 + p), 0x10}, "colormod_osc:"   + std::to_string(p), uint8_to_str, str_to_uint8});
-    bindings_list.emplace_back(binding_t{{(uint8_t)(0xb0 + p), 0x14}, "colormod_width:" + std::to_string(p), uint8_to_str, str_to_uint8});
-
-    bindings_list.emplace_back(binding_t{{(uint8_t)(0xb0 + p), 0x11}, "maskmod_osc:"    + std::to_string(p), uint8_to_str, str_to_uint8});
-    bindings_list.emplace_back(binding_t{{(uint8_t)(0xb0 + p), 0x15}, "maskmod_width:"  + std::to_string(p), uint8_to_str, str_to_uint8});
-
-    bindings_list.emplace_back(binding_t{{(uint8_t)(0xb0 + p), 0x12}, "slicer_nslices:" + std::to_string(p), uint8_to_str, str_to_uint8});
-    bindings_list.emplace_back(binding_t{{(uint8_t)(0xb0 + p), 0x16}, "slicer_nuneven:" + std::to_string(p), uint8_to_str, str_to_uint8});
-
-    bindings_list.emplace_back(binding_t{{(uint8_t)(0xb0 + p), 0x13}, "feedback_qty:"   + std::to_string(p), uint8_to_str, str_to_uint8});
-
-    bindings_list.emplace_back(binding_t{{(uint8_t)(0xb0 + p), 0x17}, "speed_scale:" + std::to_string(p), uint8_to_str, str_to_uint8});
-
-    bindings_list.emplace_back(binding_t{{(uint8_t)(0xb0 + p), 0x07}, "brightness:" + std::to_string(p), uint8_to_str, str_to_uint8});
-
-    for (uint8_t o=0 ; o <= 0x10 ; o += 0x10)
+    if (char* comment = strchr(buffer, '#'))
+      *comment = '\0';
+    if (buffer[strspn(buffer, " \t\r\n")] == '\0')
+      continue;
+    char command[64] = "", transform[16] = "", feedback[16] = "";
+    unsigned status, d1;
+    int end = 0;
+    const int fields = sscanf(buffer, "%x:%x %63s %15s %15s %n", &status, &d1, command, transform, feedback, &end);
+    const auto to_midi = parse_transform(transform);
+    const auto to_feedback = parse_transform(feedback);
+    // Channel messages only, the clock never reaches the mapper
+    if (fields != 5 || buffer[end] != '\0' || status < 0x80 || 0xEF < status || 0x7F < d1
+      || !to_midi || to_midi == transform_e::NONE || !to_feedback)
     {
-      bindings_list.emplace_back(binding_t{{(uint8_t)(0x80 + p + o), 0x35}, "colormod_enable:"  + std::to_string(p), pad_to_str, str_to_pad});
-      bindings_list.emplace_back(binding_t{{(uint8_t)(0x80 + p + o), 0x3a}, "colormod_move:"    + std::to_string(p), pad_to_str, str_to_pad});
-      bindings_list.emplace_back(binding_t{{(uint8_t)(0x80 + p + o), 0x36}, "maskmod_enable:"   + std::to_string(p), pad_to_str, str_to_pad});
-      bindings_list.emplace_back(binding_t{{(uint8_t)(0x80 + p + o), 0x3b}, "maskmod_move:"     + std::to_string(p), pad_to_str, str_to_pad});
-      bindings_list.emplace_back(binding_t{{(uint8_t)(0x80 + p + o), 0x37}, "slicer_useuneven:" + std::to_string(p), pad_to_str, str_to_pad});
-      bindings_list.emplace_back(binding_t{{(uint8_t)(0x80 + p + o), 0x3c}, "slicer_useflip:"   + std::to_string(p), pad_to_str, str_to_pad});
-      bindings_list.emplace_back(binding_t{{(uint8_t)(0x80 + p + o), 0x38}, "feedback_enable:"  + std::to_string(p), pad_to_str, str_to_pad});
-      bindings_list.emplace_back(binding_t{{(uint8_t)(0x80 + p + o), 0x39}, "strobe_enable:"    + std::to_string(p), pad_to_str, str_to_pad});
-      bindings_list.emplace_back(binding_t{{(uint8_t)(0x80 + p + o), 0x3d}, "slicer_mergeribbon:"+ std::to_string(p), pad_to_str, str_to_pad});
-
-      bindings_list.emplace_back(binding_t{{(uint8_t)(0x80 + p + o), 0x32}, "is_active_on_master:"+ std::to_string(p), pad_to_str, str_to_pad});
-      bindings_list.emplace_back(binding_t{{(uint8_t)(0x80 + p + o), 0x31}, "is_active_on_solo:"+ std::to_string(p), pad_to_str, str_to_pad});
-      bindings_list.emplace_back(binding_t{{(uint8_t)(0x80 + p + o), 0x30}, "do_ignore_solo:"+ std::to_string(p), pad_to_str, str_to_pad});
-
-      bindings_list.emplace_back(binding_t{{(uint8_t)(0x80 + p + o), 0x34}, "do_litmax:"+ std::to_string(p), pad_to_str, str_to_pad});
+      fprintf(stderr, "%s:%d : Invalid binding : %s", path, line, buffer);
+      valid = false;
+      continue;
     }
+    auto [itr, inserted] = command_index.try_emplace(command, uint16_t(table.commands.size()));
+    if (inserted)
+      table.commands.emplace_back(command);
+    table.bindings.push_back(binding_t{ uint16_t(status << 8 | d1), itr->second, to_midi.value(), to_feedback.value() });
   }
-
-  return bindings_list;
-}
-
-Mapper::Mapper(const std::vector<binding_t>& bindings_list)
-{
-  // Generate tables
-  for (const auto& binding : bindings_list)
+  fclose(file);
+  if (0xFFFF <= table.bindings.size())
   {
-    midi_to_command_map.emplace(binding.key(), &binding);
-    command_to_midi_map.emplace(binding.command, &binding);
+    fprintf(stderr, "%s : Too many bindings\n", path);
+    valid = false;
   }
+  if (!valid)
+    return std::nullopt;
+
+  // Bindings of a key are contiguous, in the order of the file
+  std::stable_sort(table.bindings.begin(), table.bindings.end(),
+    [](const binding_t& a, const binding_t& b) { return a.key < b.key; });
+  table.slots.assign(1 << 16, 0);
+  for (size_t i = table.bindings.size() ; i-- ; )
+    table.slots[table.bindings[i].key] = i + 1;
+  for (size_t i = 0 ; i < table.bindings.size() ; ++i)
+    if (table.bindings[i].feedback != transform_e::NONE)
+      table.feedbacks.emplace(table.commands[table.bindings[i].command], i);
+  return table;
 }
 
-std::vector<std::string> Mapper::midimsg_to_command(const std::vector<uint8_t>& msg)
+std::vector<std::string> MappingTable::midimsg_to_command(const uint8_t* msg, size_t size) const
 {
   // convert raw midi in 'msg' to command str
-  if (msg.size() != 3)
+  if (size != 3)
   {
-    fprintf(stderr, "Unsupported midimsg : %lu\n", msg.size());
+    fprintf(stderr, "Unsupported midimsg : %zu\n", size);
     return {};
   }
 
   const uint16_t key = ((uint16_t)msg[0]) << 8 | msg[1];
-  // search for key in mappings
-  auto [begin, end] = midi_to_command_map.equal_range(key);
-  if (begin == end) // key not found
+  const uint16_t slot = slots[key];
+  if (!slot) // key not found
   {
     fprintf(stderr, "Unbounded midi msg %04x\n", key);
     return {};
@@ -144,42 +95,128 @@ std::vector<std::string> Mapper::midimsg_to_command(const std::vector<uint8_t>&
 
   const uint8_t value = msg[2];
   std::vector<std::string> result;
-  for (auto itr = begin; itr != end; ++itr)
+  for (size_t i = slot - 1 ; i < bindings.size() && bindings[i].key == key ; ++i)
   {
-    auto& [_, binding] = *itr;
-    char tmp[512];
-    sprintf(tmp, "%s %s", binding->command.c_str(), binding->midival_to_str(binding, value).c_str());
-    result.emplace_back(tmp);
+    const binding_t& binding = bindings[i];
+    const std::string& command = commands[binding.command];
+    switch (binding.transform)
+    {
+    case transform_e::VALUE:
+      result.emplace_back(command + ' ' + std::to_string(value));
+      break;
+    case transform_e::BOOL:
+      result.emplace_back(command + (0x40 <= value ? " y" : " n"));
+      break;
+    case transform_e::PAD:
+      // A note on of null velocity is a note off
+      result.emplace_back(command + ((msg[0] & 0xF0) == 0x90 && value ? " y" : " n"));
+      break;
+    case transform_e::NONE:
+      break;
+    }
   }
 
   return result;
 }
-std::vector<std::vector<std::uint8_t>> Mapper::command_to_midimsg(const std::string& cmd)
+
+std::vector<std::vector<std::uint8_t>> MappingTable::command_to_midimsg(const std::string& cmd) const
 {
   char cmdkey[64], arg[64];
-  if (sscanf(cmd.c_str(), "%s %s", cmdkey, arg) != 2)
+  if (sscanf(cmd.c_str(), "%63s %63s", cmdkey, arg) != 2)
   {
     fprintf(stderr, "Invalid command : %s\n", cmd.c_str());
     return {};
   }
 
-  auto [begin, end] = command_to_midi_map.equal_range(cmdkey);
-  if (begin == end) // key not found
-  {
-    fprintf(stderr, "Unbound command : %s\n", cmdkey);
-    return {};
-  }
-
+  // key not found is usual with several devices
+  auto [begin, end] = feedbacks.equal_range(cmdkey);
   std::vector<std::vector<uint8_t>> result;
   for (auto itr = begin; itr != end; ++itr)
   {
-    auto& [_, binding] = *itr;
-    uint8_t raw[3];
-    binding->str_to_midival(binding, arg, raw);
-
-    std::vector<uint8_t> msg = {raw[0], raw[1], raw[2]};
-    result.emplace_back(msg);
+    const binding_t& binding = bindings[itr->second];
+    switch (binding.feedback)
+    {
+    case transform_e::VALUE:
+      result.push_back({ binding.status(), binding.d1(), uint8_t(atoi(arg) & 0x7F) });
+      break;
+    case transform_e::BOOL:
+      result.push_back({ binding.status(), binding.d1(), uint8_t(arg[0] == 'y' ? 0x7F : 0x00) });
+      break;
+    case transform_e::PAD:
+      result.push_back({ uint8_t((arg[0] == 'y' ? 0x90 : 0x80) | (binding.status() & 0x0F)), binding.d1(), 0x7F });
+      break;
+    case transform_e::NONE:
+      break;
+    }
   }
-  
+
   return result;
-}
\ No newline at end of file
+}
+
+Mapper::Mapper(const std::string& path)
+  : path(path)
+{
+  changed();
+  auto table = MappingTable::load(path.c_str());
+  if (!table)
+    throw std::runtime_error("Can't load mapping " + path);
+  current.store(new MappingTable(std::move(table.value())), std::memory_order_release);
+}
+Mapper::~Mapper()
+{
+  delete current.load(std::memory_order_relaxed);
+  for (auto& [_, table] : retired)
+    delete table;
+}
+
+std::vector<std::string> Mapper::midimsg_to_command(const std::vector<uint8_t>& msg) const
+{
+  return midimsg_to_command(msg.data(), msg.size());
+}
+std::vector<std::string> Mapper::midimsg_to_command(const uint8_t* msg, size_t size) const
+{
+  return current.load(std::memory_order_acquire)->midimsg_to_command(msg, size);
+}
+std::vector<std::vector<std::uint8_t>> Mapper::command_to_midimsg(const std::string& cmd) const
+{
+  return current.load(std::memory_order_acquire)->command_to_midimsg(cmd);
+}
+void Mapper::quiescent()
+{
+  passed.store(published.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+bool Mapper::changed()
+{
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0)
+    return false;
+  const bool result = info.st_mtim.tv_sec != modified.tv_sec || info.st_mtim.tv_nsec != modified.tv_nsec;
+  modified = info.st_mtim;
+  return result;
+}
+
+bool Mapper::poll()
+{
+  // Tables replaced before the last quiescent point aren't read anymore
+  const uint64_t safe = passed.load(std::memory_order_acquire);
+  retired.erase(std::remove_if(retired.begin(), retired.end(), [safe](auto& item) {
+    if (safe < item.first)
+      return false;
+    delete item.second;
+    return true;
+  }), retired.end());
+
+  if (!changed())
+    return false;
+  auto table = MappingTable::load(path.c_str());
+  if (!table)
+  {
+    fprintf(stderr, "Keep the current mapping of %s\n", path.c_str());
+    return false;
+  }
+  const MappingTable* old = current.exchange(new MappingTable(std::move(table.value())), std::memory_order_acq_rel);
+  // The main thread may hold 'old' until it passes this publication
+  retired.emplace_back(published.fetch_add(1, std::memory_order_acq_rel) + 1, old);
+  return true;
+}
@@ -1,32 +1,104 @@
 #pragma once
 
+#include <stdio.h>
+#include <time.h>
+
 #include <string>
 #include <vector>
+#include <atomic>
+#include <utility>
 #include <optional>
-#include <functional>
+#include <cstdint>
 #include <unordered_map>
 
+/// Conversion between a midi value and a command argument
+enum class transform_e : uint8_t
+{
+  NONE,   ///!< No feedback
+  VALUE,  ///!< 0-127 as is
+  BOOL,   ///!< 'y' from 0x40
+  PAD,    ///!< 'y' on note on, 'n' on note off. The feedback lights the pad
+};
+
+/// Compiled line of a mapping file
 struct binding_t
 {
-  uint8_t         midikey[2];
-  std::string     command;
-  std::function<std::string(const binding_t*, uint8_t)>           midival_to_str;
-  std::function<void(const binding_t*, const char*, uint8_t[3])>  str_to_midival;
+  uint16_t    key;        ///!< status | channel << 8 | d1
+  uint16_t    command;    ///!< Index in the table commands
+  transform_e transform;  ///!< Midi to command
+  transform_e feedback;   ///!< Command to midi
 
-  uint16_t key() const { return ((uint16_t)midikey[0]) << 8 | midikey[1]; }
+  uint8_t status() const { return key >> 8; }
+  uint8_t d1() const { return key & 0xFF; }
 };
 
-struct Mapper {
+/**
+ * Mapping file compiled to a direct table of the 65536 (status | channel, d1) keys.
+ *
+ * One binding per line : '<status:d1> <control> <transform> <feedback>', keys in hex,
+ * '#' starts a comment. A midi message is a table lookup and a switch on its
+ * transform : no hashing nor 'std::function' on the way in.
+ */
+class MappingTable {
+public:
 
-  std::unordered_multimap<int16_t, const binding_t*>      midi_to_command_map;
-  std::unordered_multimap<std::string, const binding_t*>  command_to_midi_map;
+  /// Errors go to stderr, with their line. Any error rejects the whole file
+  static std::optional<MappingTable> load(const char* path);
 
-  static const std::vector<binding_t>& APC40_mappings();
+  std::vector<std::string> midimsg_to_command(const uint8_t* msg, size_t size) const;
+  std::vector<std::vector<uint8_t>> command_to_midimsg(const std::string& cmd) const;
+
+  size_t size() const { return bindings.size(); }
+
+private:
+
+  std::vector<std::string> commands;
+  std::vector<binding_t> bindings;  ///!< Sorted by key
+  std::vector<uint16_t> slots;      ///!< By key, 1 + index of its first binding, 0 if unbound
+  std::unordered_multimap<std::string, uint16_t> feedbacks; ///!< Command to its bindings with a feedback
+};
 
-  Mapper(const std::vector<binding_t>& bindings_list);
-  
-  std::vector<std::string> midimsg_to_command(const std::vector<uint8_t>& msg);
-  std::vector<std::vector<std::uint8_t>> command_to_midimsg(const std::string& cmd);
+/**
+ * Mapping table of a device, reloaded when its file changes.
+ *
+ * Read-copy-update : 'poll()' runs on a watcher thread, compiles the changed file and
+ * publishes it with a single atomic store. The main thread maps each message with one
+ * whole table and calls 'quiescent()' once it holds none : the replaced tables are freed
+ * by the next 'poll()' after that. A reload neither blocks nor drops a message, an
+ * invalid file keeps the current table.
+ */
+class Mapper {
+public:
+
+  /// Throws if the file can't be loaded
+  explicit Mapper(const std::string& path);
+  ~Mapper();
+  Mapper(const Mapper&) = delete;
+  Mapper& operator=(const Mapper&) = delete;
+
+  // Main thread
+  std::vector<std::string> midimsg_to_command(const std::vector<uint8_t>& msg) const;
+  std::vector<std::string> midimsg_to_command(const uint8_t* msg, size_t size) const;
+  std::vector<std::vector<std::uint8_t>> command_to_midimsg(const std::string& cmd) const;
+  /// No table reference is held anymore
+  void quiescent();
+
+  // Watcher thread
+  /// Reloads the file if it changed, returns true if a new table was published
+  bool poll();
+
+  const std::string& file() const { return path; }
+
+private:
+
+  std::string path;
+  timespec modified{};
+  std::atomic<const MappingTable*> current{nullptr};
+  std::atomic<uint64_t> published{0}; ///!< Tables published
+  std::atomic<uint64_t> passed{0};    ///!< Publications the main thread is known to be past
+  std::vector<std::pair<uint64_t, const MappingTable*>> retired; ///!< Watcher thread only
+
+  bool changed();
 };
 
 /*
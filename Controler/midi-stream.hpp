@@ -0,0 +1,72 @@
+#pragma once
+
+#include "spsc-ring.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+/// Short MIDI message (3 bytes at most, no sysex) received by a device
+struct midi_event_t
+{
+  uint32_t frame;   ///!< Absolute JACK frame, orders the events of all the devices
+  uint8_t  device;  ///!< Index of the receiving device
+  uint8_t  size;
+  uint8_t  data[3];
+};
+
+/// Short MIDI message to send to a device
+struct midi_message_t
+{
+  uint8_t size;
+  uint8_t data[3];
+};
+
+/// Rings between the JACK process callback and the main thread, one pair per device
+struct midi_device_t
+{
+  static constexpr size_t RingSize = 1024;
+
+  uint8_t priority;  ///!< Lower first among events of the same frame
+  SpscRing<midi_event_t>   from_jack{RingSize};
+  SpscRing<midi_message_t> to_jack{RingSize};
+};
+
+/// 'a' before 'b', across the frame counter wrap
+inline bool frame_before(uint32_t a, uint32_t b) { return int32_t(a - b) < 0; }
+
+/**
+ * Merges the input rings of 'devices', pointers to 'midi_device_t', in a single stream ordered
+ * by frame, then by device priority, then by arrival. Events are passed to 'handler' in place
+ * and dropped after it.
+ *
+ * Only events before 'limit' are taken : the callback publishes the end of a period once all
+ * the devices are pushed, the events of a later period would overtake the ones not pushed yet.
+ * Returns the number of events handled.
+ */
+template <typename Devices, typename Handler>
+size_t merge_midi(const Devices& devices, uint32_t limit, Handler&& handler)
+{
+  size_t handled = 0;
+  while (true)
+  {
+    midi_device_t* best = nullptr;
+    const midi_event_t* first = nullptr;
+    for (auto& device : devices)
+    {
+      const midi_event_t* event = device->from_jack.front();
+      if (!event || !frame_before(event->frame, limit))
+        continue;
+      if (!first || frame_before(event->frame, first->frame)
+        || (event->frame == first->frame && device->priority < best->priority))
+      {
+        best = &*device;
+        first = event;
+      }
+    }
+    if (!first)
+      return handled;
+    handler(*first);
+    best->from_jack.drop();
+    ++handled;
+  }
+}
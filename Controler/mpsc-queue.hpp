@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Bounded lock-free multiple producers / single consumer queue.
+ *
+ * Each cell carries a sequence number (D. Vyukov's bounded queue) : a producer claims
+ * a cell with a compare and swap on the head, then publishes it through its sequence,
+ * so producers never wait for a lock nor for each other. A full queue refuses the
+ * item and counts it. The capacity is rounded up to a power of two.
+ */
+template <typename T>
+class MpscQueue {
+public:
+
+  explicit MpscQueue(size_t capacity)
+  {
+    size_t size = 1;
+    while (size < capacity)
+      size <<= 1;
+    cells.reset(new cell_t[size]);
+    mask = size - 1;
+    for (size_t i = 0 ; i < size ; ++i)
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  /// Producers side, any thread
+  bool push(const T& item)
+  {
+    size_t position = head.load(std::memory_order_relaxed);
+    cell_t* cell;
+    while (true)
+    {
+      cell = &cells[position & mask];
+      const intptr_t diff = intptr_t(cell->sequence.load(std::memory_order_acquire)) - intptr_t(position);
+      if (diff == 0)
+      {
+        if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+          break;
+      }
+      else if (diff < 0)
+      {
+        // The consumer hasn't freed this cell yet
+        dropped_count.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      else
+        position = head.load(std::memory_order_relaxed);
+    }
+    cell->item = item;
+    cell->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Consumer side, a single thread
+  bool pop(T& item)
+  {
+    cell_t& cell = cells[tail & mask];
+    if (intptr_t(cell.sequence.load(std::memory_order_acquire)) - intptr_t(tail + 1) < 0)
+      return false;
+    item = cell.item;
+    cell.sequence.store(tail + mask + 1, std::memory_order_release);
+    ++tail;
+    return true;
+  }
+
+  /// Items refused by 'push'
+  uint64_t dropped() const { return dropped_count.load(std::memory_order_relaxed); }
+
+private:
+
+  struct cell_t
+  {
+    std::atomic<size_t> sequence;
+    T item;
+  };
+
+  std::unique_ptr<cell_t[]> cells;
+  size_t mask = 0;
+  alignas(64) std::atomic<size_t> head{0}; ///!< Claimed by the producers
+  alignas(64) size_t tail = 0;             ///!< Consumer only
+  std::atomic<uint64_t> dropped_count{0};
+};
@@ -0,0 +1,249 @@
+#include "osc.hpp"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+std::optional<control_t::value_u> to_value(const osc_command_t& command, control_t::type_e type)
+{
+  control_t::value_u value;
+  switch (type)
+  {
+  case control_t::UINT7:
+    if (command.type == 'i')
+      value.u = std::clamp<int32_t>(command.arg.i, 0, 127);
+    else if (command.type == 'f')
+      value.u = std::lround(std::clamp(command.arg.f, 0.f, 1.f) * 127);
+    else
+      value.u = command.type == 'T' ? 127 : 0;
+    return value;
+  case control_t::BOOL:
+    if (command.type == 'i')
+      value.b = command.arg.i != 0;
+    else if (command.type == 'f')
+      value.b = 0.5f <= command.arg.f;
+    else
+      value.b = command.type == 'T';
+    return value;
+  case control_t::FLOAT:
+    if (command.type == 'i')
+      value.f = command.arg.i;
+    else if (command.type == 'f' && std::isfinite(command.arg.f))
+      value.f = command.arg.f;
+    else
+      return std::nullopt;
+    return value;
+  }
+  return std::nullopt;
+}
+
+OscAddressMap::OscAddressMap(const Manager& manager)
+{
+  for (size_t id = 0 ; id < manager.controls_count() ; ++id)
+  {
+    std::string address = "/" + manager.control(id).name;
+    std::replace(address.begin(), address.end(), ':', '/');
+    addresses.emplace_back(std::move(address), id);
+  }
+  std::sort(addresses.begin(), addresses.end());
+}
+
+std::optional<uint16_t> OscAddressMap::find(std::string_view address) const
+{
+  auto itr = std::lower_bound(addresses.begin(), addresses.end(), address,
+    [](const auto& item, std::string_view key) { return std::string_view(item.first) < key; });
+  if (itr == addresses.end() || itr->first != address)
+    return std::nullopt;
+  return itr->second;
+}
+
+namespace osc {
+
+  /// OSC string at 'offset', padded to 4 bytes. Moves 'offset' after it
+  static std::optional<std::string_view> read_string(const uint8_t* data, size_t size, size_t& offset)
+  {
+    if (size <= offset)
+      return std::nullopt;
+    const char* begin = (const char*)data + offset;
+    const void* end = memchr(begin, '\0', size - offset);
+    if (!end)
+      return std::nullopt;
+    const size_t length = (const char*)end - begin;
+    offset += (length + 4) & ~size_t(3);
+    if (size < offset)
+      return std::nullopt;
+    return std::string_view(begin, length);
+  }
+
+  static uint32_t read_u32(const uint8_t* data)
+  {
+    return uint32_t(data[0]) << 24 | uint32_t(data[1]) << 16 | uint32_t(data[2]) << 8 | data[3];
+  }
+
+  static bool decode_message(const uint8_t* data, size_t size, const OscAddressMap& addresses, osc_command_t& out)
+  {
+    size_t offset = 0;
+    auto address = read_string(data, size, offset);
+    auto tags = address ? read_string(data, size, offset) : std::nullopt;
+    if (!tags || tags->size() < 2 || (*tags)[0] != ',')
+      return false;
+    auto control = addresses.find(*address);
+    if (!control)
+      return false;
+
+    out.control = control.value();
+    out.type = (*tags)[1];
+    switch (out.type)
+    {
+    case 'i':
+    case 'f':
+    {
+      if (size < offset + 4)
+        return false;
+      const uint32_t raw = read_u32(data + offset);
+      memcpy(&out.arg, &raw, sizeof(raw));
+      return true;
+    }
+    case 'T':
+    case 'F':
+      out.arg.i = 0;
+      return true;
+    }
+    return false;
+  }
+
+  static size_t decode_packet(const uint8_t* data, size_t size, const OscAddressMap& addresses,
+    osc_command_t* out, size_t capacity, stats_t& stats, int depth)
+  {
+    static const char BundleTag[8] = "#bundle";
+    if (size % 4 != 0 || size == 0)
+    {
+      ++stats.errors;
+      return 0;
+    }
+    if (size < sizeof(BundleTag) || memcmp(data, BundleTag, sizeof(BundleTag)))
+    {
+      if (capacity && decode_message(data, size, addresses, *out))
+      {
+        ++stats.messages;
+        return 1;
+      }
+      ++stats.errors;
+      return 0;
+    }
+
+    // '#bundle', time tag, then elements prefixed by their size
+    if (MaxBundleDepth <= depth)
+    {
+      ++stats.errors;
+      return 0;
+    }
+    size_t count = 0;
+    for (size_t offset = 16 ; offset + 4 <= size ; )
+    {
+      const uint32_t length = read_u32(data + offset);
+      offset += 4;
+      if (size - offset < length)
+      {
+        ++stats.errors;
+        break;
+      }
+      count += decode_packet(data + offset, length, addresses, out + count, capacity - count, stats, depth + 1);
+      offset += length;
+    }
+    return count;
+  }
+
+  size_t decode(const uint8_t* data, size_t size, const OscAddressMap& addresses,
+    osc_command_t* out, size_t capacity, stats_t& stats)
+  {
+    return decode_packet(data, size, addresses, out, capacity, stats, 0);
+  }
+}
+
+OscServer::OscServer(uint16_t port, const OscAddressMap& addresses, MpscQueue<osc_command_t>& queue)
+  : addresses(addresses), queue(queue)
+{
+  socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (socket_fd < 0)
+    throw std::runtime_error("Can't open OSC socket");
+
+  // Bursts of a lighting desk wait in the kernel while the thread decodes
+  const int buffer_size = 1 << 20;
+  setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+  timeval timeout{ 0, StopCheckMs * 1000 };
+  setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port);
+  socklen_t length = sizeof(address);
+  if (bind(socket_fd, (const sockaddr*)&address, sizeof(address)) != 0
+    || getsockname(socket_fd, (sockaddr*)&address, &length) != 0)
+  {
+    close(socket_fd);
+    throw std::runtime_error("Can't bind OSC port " + std::to_string(port));
+  }
+  bound_port = ntohs(address.sin_port);
+
+  thread = std::thread(&OscServer::run, this);
+}
+OscServer::~OscServer()
+{
+  running = false;
+  thread.join();
+  close(socket_fd);
+}
+
+void OscServer::run()
+{
+  // Everything the loop needs is allocated here, once
+  std::vector<uint8_t> buffers(BatchSize * osc::MaxPacketSize);
+  std::vector<iovec> vectors(BatchSize);
+  std::vector<mmsghdr> headers(BatchSize);
+  std::vector<osc_command_t> commands(osc::MaxPacketSize / 8);
+  for (size_t i = 0 ; i < BatchSize ; ++i)
+  {
+    vectors[i] = iovec{ &buffers[i * osc::MaxPacketSize], osc::MaxPacketSize };
+    headers[i] = mmsghdr{};
+    headers[i].msg_hdr.msg_iov = &vectors[i];
+    headers[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  while (running)
+  {
+    // Blocks for the first datagram only
+    const int received = recvmmsg(socket_fd, headers.data(), BatchSize, MSG_WAITFORONE, nullptr);
+    if (received <= 0)
+      continue;
+
+    osc::stats_t stats;
+    for (int i = 0 ; i < received ; ++i)
+    {
+      const size_t size = (headers[i].msg_hdr.msg_flags & MSG_TRUNC) ? 0 : headers[i].msg_len;
+      const size_t count = osc::decode((const uint8_t*)vectors[i].iov_base, size, addresses,
+        commands.data(), commands.size(), stats);
+      for (size_t c = 0 ; c < count ; ++c)
+        queue.push(commands[c]);
+    }
+    packets_count.fetch_add(received, std::memory_order_relaxed);
+    messages_count.fetch_add(stats.messages, std::memory_order_relaxed);
+    errors_count.fetch_add(stats.errors, std::memory_order_relaxed);
+  }
+}
+
+std::string OscServer::summary() const
+{
+  char tmp[256];
+  snprintf(tmp, sizeof(tmp), "OSC port %u : %lu packets, %lu messages, %lu errors",
+    bound_port, (unsigned long)packets(), (unsigned long)messages(), (unsigned long)errors());
+  return std::string(tmp);
+}
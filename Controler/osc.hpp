@@ -0,0 +1,104 @@
+#pragma once
+
+#include "manager.hpp"
+#include "mpsc-queue.hpp"
+
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
+#include <utility>
+#include <optional>
+#include <cstdint>
+#include <string_view>
+
+/// OSC message decoded to a control, with its first argument
+struct osc_command_t
+{
+  uint16_t control;  ///!< Manager control id
+  char     type;     ///!< OSC type tag : 'i', 'f', 'T' or 'F'
+  union {
+    int32_t i;
+    float   f;
+  } arg;
+};
+
+/// Value of a control from an OSC argument. Floats are faders (0 to 1) for UINT7 controls
+std::optional<control_t::value_u> to_value(const osc_command_t& command, control_t::type_e type);
+
+/**
+ * OSC addresses of the manager controls : '/' then the control name, ':' becoming '/'
+ * ('/brightness', '/colormod_osc/3', '/min_value/0/2'). Sorted, looked up without allocation.
+ */
+class OscAddressMap {
+public:
+
+  explicit OscAddressMap(const Manager& manager);
+
+  std::optional<uint16_t> find(std::string_view address) const;
+  size_t size() const { return addresses.size(); }
+
+private:
+
+  std::vector<std::pair<std::string, uint16_t>> addresses;
+};
+
+namespace osc {
+
+  static constexpr size_t MaxPacketSize = 1536;  ///!< One ethernet frame
+  static constexpr int    MaxBundleDepth = 4;
+
+  struct stats_t
+  {
+    uint32_t messages = 0;  ///!< Decoded to a command
+    uint32_t errors = 0;    ///!< Malformed, unknown address or unsupported argument
+  };
+
+  /**
+   * Decodes a packet, a message or a bundle, in place : the commands are written to
+   * 'out', up to 'capacity', and their count returned. A compact subset : no address
+   * patterns, the first argument only, of type 'i', 'f', 'T' or 'F'. Bundle time tags
+   * are ignored, commands apply as they arrive.
+   */
+  size_t decode(const uint8_t* data, size_t size, const OscAddressMap& addresses,
+    osc_command_t* out, size_t capacity, stats_t& stats);
+}
+
+/**
+ * UDP server feeding decoded OSC commands to a queue shared by all the ingress threads.
+ *
+ * The receiving thread reads datagrams by batches into buffers allocated once, decodes
+ * them in place and pushes the commands to the lock-free queue : the main thread applies
+ * them as it does for the midi commands.
+ */
+class OscServer {
+public:
+
+  static constexpr size_t BatchSize = 32;      ///!< Datagrams per system call
+  static constexpr int    StopCheckMs = 100;   ///!< Receive timeout, to notice the stop
+
+  /// Binds 'port' on every interface, throws if it can't
+  OscServer(uint16_t port, const OscAddressMap& addresses, MpscQueue<osc_command_t>& queue);
+  ~OscServer();
+  OscServer(const OscServer&) = delete;
+  OscServer& operator=(const OscServer&) = delete;
+
+  uint16_t port() const { return bound_port; }
+  uint64_t packets() const { return packets_count.load(std::memory_order_relaxed); }
+  uint64_t messages() const { return messages_count.load(std::memory_order_relaxed); }
+  uint64_t errors() const { return errors_count.load(std::memory_order_relaxed); }
+
+  std::string summary() const;
+
+private:
+
+  int socket_fd = -1;
+  uint16_t bound_port = 0;
+  const OscAddressMap& addresses;
+  MpscQueue<osc_command_t>& queue;
+  std::atomic<bool> running{true};
+  std::atomic<uint64_t> packets_count{0}, messages_count{0}, errors_count{0};
+  std::thread thread;
+
+  void run();
+};
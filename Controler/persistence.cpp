@@ -0,0 +1,390 @@
+#include "persistence.hpp"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <chrono>
+#include <algorithm>
+
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+
+  struct journal_header_t
+  {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint64_t layout;
+  };
+  static_assert(sizeof(journal_header_t) == 16, "Journal layout changed, bump Version");
+
+  struct snapshot_header_t
+  {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint64_t layout;
+    uint32_t sequence;  ///!< Of the last change included
+    uint32_t count;     ///!< Entries following, then the CRC-32 of the whole
+  };
+  static_assert(sizeof(snapshot_header_t) == 24, "Snapshot layout changed, bump Version");
+
+  struct snapshot_entry_t
+  {
+    uint16_t key;
+    uint16_t reserved;
+    uint32_t value;
+  };
+
+  /// CRC-32 (IEEE, reflected)
+  uint32_t crc32(const void* data, size_t size, uint32_t crc = 0)
+  {
+    static const auto table = []() {
+      std::array<uint32_t, 256> table;
+      for (uint32_t i = 0 ; i < 256 ; ++i)
+      {
+        uint32_t c = i;
+        for (int k = 0 ; k < 8 ; ++k)
+          c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        table[i] = c;
+      }
+      return table;
+    }();
+    crc = ~crc;
+    for (size_t i = 0 ; i < size ; ++i)
+      crc = table[(crc ^ ((const uint8_t*)data)[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+  }
+
+  uint32_t record_crc(const Persistence::record_t& record)
+  {
+    return crc32(&record, offsetof(Persistence::record_t, crc));
+  }
+
+  bool read_file(const std::string& path, std::vector<uint8_t>& content)
+  {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+      close(fd);
+      return false;
+    }
+    content.resize(info.st_size);
+    size_t done = 0;
+    while (done < content.size())
+    {
+      const ssize_t count = read(fd, content.data() + done, content.size() - done);
+      if (count < 0 && errno == EINTR)
+        continue;
+      if (count <= 0)
+        break;
+      done += count;
+    }
+    content.resize(done);
+    close(fd);
+    return true;
+  }
+
+  bool write_all(int fd, const void* data, size_t size)
+  {
+    size_t done = 0;
+    while (done < size)
+    {
+      const ssize_t count = write(fd, (const uint8_t*)data + done, size - done);
+      if (count < 0 && errno == EINTR)
+        continue;
+      if (count <= 0)
+        return false;
+      done += count;
+    }
+    return true;
+  }
+
+  double seconds_since(clock_type::time_point begin)
+  {
+    return std::chrono::duration<double>(clock_type::now() - begin).count();
+  }
+}
+
+Persistence::Persistence(const std::string& base, uint64_t layout)
+  : snapshot_path(base + ".snapshot"), journal_path(base + ".journal"), layout(layout)
+{
+  recover();
+  thread = std::thread(&Persistence::run, this);
+}
+
+Persistence::~Persistence()
+{
+  running = false;
+  thread.join();
+  if (0 <= journal_fd)
+    close(journal_fd);
+}
+
+void Persistence::recover()
+{
+  const auto begin = clock_type::now();
+  uint32_t snapshot_sequence = 0;
+  if (!read_snapshot(snapshot_sequence))
+    state.clear();
+  sequence = snapshot_sequence;
+  const size_t valid_length = replay_journal(snapshot_sequence);
+  if (!open_journal(valid_length))
+    fprintf(stderr, "ERROR : Can't open the journal %s, the state won't be persisted\n", journal_path.c_str());
+
+  recovered_last = sequence;
+  synced_sequence = sequence;
+  recovered_state.assign(state.begin(), state.end());
+  std::sort(recovered_state.begin(), recovered_state.end());
+  recovery_seconds = seconds_since(begin);
+}
+
+bool Persistence::read_snapshot(uint32_t& snapshot_sequence)
+{
+  std::vector<uint8_t> content;
+  if (!read_file(snapshot_path, content))
+    return false;
+  snapshot_header_t header;
+  if (content.size() < sizeof(header) + sizeof(uint32_t))
+    return false;
+  memcpy(&header, content.data(), sizeof(header));
+  if (header.magic != SnapshotMagic || header.version != Version || header.layout != layout
+    || content.size() != sizeof(header) + header.count * sizeof(snapshot_entry_t) + sizeof(uint32_t))
+  {
+    fprintf(stderr, "WARNING : Ignored snapshot %s, from another version\n", snapshot_path.c_str());
+    return false;
+  }
+  uint32_t crc;
+  memcpy(&crc, content.data() + content.size() - sizeof(crc), sizeof(crc));
+  if (crc != crc32(content.data(), content.size() - sizeof(crc)))
+  {
+    fprintf(stderr, "WARNING : Ignored corrupted snapshot %s\n", snapshot_path.c_str());
+    return false;
+  }
+  for (uint32_t i = 0 ; i < header.count ; ++i)
+  {
+    snapshot_entry_t entry;
+    memcpy(&entry, content.data() + sizeof(header) + i * sizeof(entry), sizeof(entry));
+    state[entry.key] = entry.value;
+  }
+  snapshot_sequence = header.sequence;
+  return true;
+}
+
+size_t Persistence::replay_journal(uint32_t snapshot_sequence)
+{
+  std::vector<uint8_t> content;
+  journal_header_t header;
+  if (!read_file(journal_path, content) || content.size() < sizeof(header))
+    return 0;
+  memcpy(&header, content.data(), sizeof(header));
+  if (header.magic != JournalMagic || header.version != Version || header.layout != layout)
+  {
+    fprintf(stderr, "WARNING : Ignored journal %s, from another version\n", journal_path.c_str());
+    return 0;
+  }
+
+  // Records are consecutive, the first torn or corrupted one ends the journal
+  size_t offset = sizeof(header);
+  std::optional<uint32_t> previous;
+  for ( ; offset + sizeof(record_t) <= content.size() ; offset += sizeof(record_t))
+  {
+    record_t record;
+    memcpy(&record, content.data() + offset, sizeof(record));
+    if (record.crc != record_crc(record) || (previous && record.sequence != previous.value() + 1))
+      break;
+    previous = record.sequence;
+    // Already in the snapshot, the journal was not cut yet
+    if (int32_t(record.sequence - snapshot_sequence) <= 0)
+      continue;
+    state[record.key] = record.value;
+    sequence = record.sequence;
+    ++journal_records;
+  }
+  if (offset != content.size())
+    fprintf(stderr, "WARNING : Journal %s cut after %zu bytes\n", journal_path.c_str(), offset);
+  return offset;
+}
+
+bool Persistence::open_journal(size_t valid_length)
+{
+  journal_fd = open(journal_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (journal_fd < 0)
+    return false;
+  if (valid_length < sizeof(journal_header_t))
+  {
+    // New, or from another layout
+    const journal_header_t header{ JournalMagic, Version, 0, layout };
+    return ftruncate(journal_fd, 0) == 0 && write_all(journal_fd, &header, sizeof(header)) && fdatasync(journal_fd) == 0;
+  }
+  return ftruncate(journal_fd, valid_length) == 0 && fdatasync(journal_fd) == 0;
+}
+
+bool Persistence::record(uint16_t key, uint32_t value)
+{
+  return changes.push(change_t{ key, value });
+}
+
+void Persistence::write_file(std::string path, std::string content)
+{
+  std::lock_guard<std::mutex> lock(files_mutex);
+  files.emplace_back(std::move(path), std::move(content));
+}
+
+bool Persistence::flush()
+{
+  batch.clear();
+  change_t buffer[256];
+  while (size_t count = changes.pop(buffer, std::size(buffer)))
+    for (size_t i = 0 ; i < count ; ++i)
+    {
+      record_t record{ ++sequence, buffer[i].key, 0, buffer[i].value, 0 };
+      record.crc = record_crc(record);
+      batch.push_back(record);
+      state[record.key] = record.value;
+    }
+  if (batch.empty())
+    return true;
+
+  journal_records += batch.size();
+  records_count.fetch_add(batch.size(), std::memory_order_relaxed);
+  // The state stays whole in memory, the next snapshot makes up for a failed write
+  if (journal_fd < 0 || !write_all(journal_fd, batch.data(), batch.size() * sizeof(record_t)) || fdatasync(journal_fd) != 0)
+    return false;
+  batches_count.fetch_add(1, std::memory_order_relaxed);
+  synced_sequence.store(sequence, std::memory_order_release);
+  return true;
+}
+
+bool Persistence::snapshot()
+{
+  std::vector<std::pair<uint16_t, uint32_t>> entries(state.begin(), state.end());
+  std::sort(entries.begin(), entries.end());
+  std::string content(sizeof(snapshot_header_t) + entries.size() * sizeof(snapshot_entry_t), '\0');
+  const snapshot_header_t header{ SnapshotMagic, Version, 0, layout, sequence, uint32_t(entries.size()) };
+  memcpy(content.data(), &header, sizeof(header));
+  for (size_t i = 0 ; i < entries.size() ; ++i)
+  {
+    const snapshot_entry_t entry{ entries[i].first, 0, entries[i].second };
+    memcpy(content.data() + sizeof(header) + i * sizeof(entry), &entry, sizeof(entry));
+  }
+  const uint32_t crc = crc32(content.data(), content.size());
+  content.append((const char*)&crc, sizeof(crc));
+  if (!write_file_atomic(snapshot_path, content))
+    return false;
+
+  // The snapshot holds it all, a crash before the cut only replays older records
+  journal_records = 0;
+  snapshots_count.fetch_add(1, std::memory_order_relaxed);
+  if (0 <= journal_fd)
+    ftruncate(journal_fd, sizeof(journal_header_t));
+  synced_sequence.store(sequence, std::memory_order_release);
+  return true;
+}
+
+void Persistence::run()
+{
+  auto last = clock_type::now();
+  while (true)
+  {
+    const bool stop = !running;
+    const auto begin = clock_type::now();
+
+    if (!flush())
+    {
+      errors_count.fetch_add(1, std::memory_order_relaxed);
+      snapshot_requested = true;
+    }
+
+    std::vector<std::pair<std::string, std::string>> pending;
+    {
+      std::lock_guard<std::mutex> lock(files_mutex);
+      pending.swap(files);
+    }
+    for (auto& [path, content] : pending)
+    {
+      if (write_file_atomic(path, content))
+        fprintf(stderr, "Successfully saved : %s\n", path.c_str());
+      else
+      {
+        fprintf(stderr, "ERROR : Failed to save %s : %s\n", path.c_str(), strerror(errno));
+        errors_count.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+
+    const bool periodic = journal_records && SnapshotInterval <= seconds_since(last);
+    if (snapshot_requested.exchange(false) || periodic)
+    {
+      if (snapshot())
+        last = clock_type::now();
+      else
+        errors_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    const uint32_t elapsed = seconds_since(begin) * 1e6;
+    if (max_batch_us.load(std::memory_order_relaxed) < elapsed)
+      max_batch_us.store(elapsed, std::memory_order_relaxed);
+    if (stop)
+      break;
+    usleep(SyncInterval);
+  }
+}
+
+bool Persistence::write_file_atomic(const std::string& path, const std::string& content)
+{
+  const std::string temporary = path + ".tmp";
+  const int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return false;
+  const bool written = write_all(fd, content.data(), content.size()) && fdatasync(fd) == 0;
+  close(fd);
+  if (!written || rename(temporary.c_str(), path.c_str()) != 0)
+  {
+    unlink(temporary.c_str());
+    return false;
+  }
+  // The rename itself is durable once the directory is
+  const size_t slash = path.rfind('/');
+  const std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+  const int dir_fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (0 <= dir_fd)
+  {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+  return true;
+}
+
+uint64_t Persistence::fingerprint(const std::vector<std::string>& names)
+{
+  // FNV-1a, names separated by a zero
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (auto& name : names)
+    for (size_t i = 0 ; i <= name.size() ; ++i)
+    {
+      hash ^= uint8_t(name.c_str()[i]);
+      hash *= 0x100000001b3ull;
+    }
+  return hash;
+}
+
+std::string Persistence::summary() const
+{
+  char tmp[256];
+  snprintf(tmp, sizeof(tmp), "Journal : %lu changes in %lu syncs (max %u us), synced up to %u, %lu snapshots, %lu dropped, %lu errors",
+    (unsigned long)records_count.load(), (unsigned long)batches_count.load(), max_batch_us.load(), synced(),
+    (unsigned long)snapshots_count.load(), (unsigned long)changes.dropped(), (unsigned long)errors_count.load());
+  return std::string(tmp);
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "spsc-ring.hpp"
+
+#include <sys/types.h>
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <unordered_map>
+
+/**
+ * Crash-safe persistence of the live state, off the main loop.
+ *
+ * The main loop hands each change to a lock-free ring ('record'), the persistence thread
+ * appends them to a binary journal and makes them durable with one 'fdatasync' per batch
+ * ('SyncInterval'). It keeps its own copy of the state, written periodically as a compacted
+ * snapshot ('<base>.snapshot', to a temporary file then renamed) after which the journal
+ * ('<base>.journal') starts over.
+ *
+ * Records carry a sequence number and a CRC : recovery reads the snapshot then replays the
+ * journal records past it, up to the first torn or corrupted one, and the journal is cut
+ * there before appending. Both files carry a fingerprint of the controls layout, a state
+ * written by another layout is ignored.
+ */
+class Persistence {
+public:
+
+  static constexpr uint32_t   SnapshotMagic = 0x50414e53; ///!< "SNAP"
+  static constexpr uint32_t   JournalMagic = 0x4e524a4c;  ///!< "LJRN"
+  static constexpr uint16_t   Version = 1;
+  static constexpr uint16_t   PresetKey = 0xFFFF;         ///!< Current preset index, not a control
+  static constexpr useconds_t SyncInterval = 10000;       ///!< Between two batches, in us
+  static constexpr double     SnapshotInterval = 60;      ///!< Seconds between two snapshots
+  static constexpr size_t     QueueSize = 1 << 16;
+
+  struct record_t
+  {
+    uint32_t sequence;
+    uint16_t key;       ///!< Control id, or 'PresetKey'
+    uint16_t reserved;
+    uint32_t value;     ///!< Raw value
+    uint32_t crc;       ///!< CRC-32 of the fields above
+  };
+  static_assert(sizeof(record_t) == 16, "Journal layout changed, bump Version");
+
+  /// Recovers the state of '<base>.snapshot' and '<base>.journal', then starts the thread
+  Persistence(const std::string& base, uint64_t layout);
+  /// Makes everything recorded durable
+  ~Persistence();
+  Persistence(const Persistence&) = delete;
+  Persistence& operator=(const Persistence&) = delete;
+
+  /// State found at the opening, as (key, value) pairs
+  const std::vector<std::pair<uint16_t, uint32_t>>& recovered() const { return recovered_state; }
+  /// Sequence of the last recovered change, and the time it took in seconds
+  uint32_t recovered_sequence() const { return recovered_last; }
+  double recovery_time() const { return recovery_seconds; }
+
+  // Main loop side, never blocks
+
+  /// Journals a change. False if the queue is full, the change is then lost
+  bool record(uint16_t key, uint32_t value);
+  /// Writes a file atomically from the thread (preset saves)
+  void write_file(std::string path, std::string content);
+  /// Snapshot on the next batch
+  void request_snapshot() { snapshot_requested = true; }
+
+  /// Sequence of the last durable change
+  uint32_t synced() const { return synced_sequence.load(std::memory_order_acquire); }
+  std::string summary() const;
+
+  /// Writes to a temporary file, syncs it and renames it over 'path'
+  static bool write_file_atomic(const std::string& path, const std::string& content);
+  /// Fingerprint of an ordered list of names
+  static uint64_t fingerprint(const std::vector<std::string>& names);
+
+private:
+
+  struct change_t
+  {
+    uint16_t key;
+    uint32_t value;
+  };
+
+  const std::string snapshot_path, journal_path;
+  const uint64_t layout;
+  int journal_fd = -1;
+
+  SpscRing<change_t> changes{QueueSize};
+
+  // Thread side, once recovered
+  std::unordered_map<uint16_t, uint32_t> state;
+  std::vector<std::pair<uint16_t, uint32_t>> recovered_state;
+  std::vector<record_t> batch;
+  uint32_t sequence = 0;         ///!< Of the last journaled change
+  uint32_t recovered_last = 0;
+  uint32_t journal_records = 0;  ///!< Since the last snapshot
+  double   recovery_seconds = 0;
+
+  std::mutex files_mutex;
+  std::vector<std::pair<std::string, std::string>> files;
+
+  std::atomic<bool>     running{true};
+  std::atomic<bool>     snapshot_requested{false};
+  std::atomic<uint32_t> synced_sequence{0};
+  std::atomic<uint64_t> batches_count{0}, records_count{0}, snapshots_count{0}, errors_count{0};
+  std::atomic<uint32_t> max_batch_us{0};
+  std::thread thread;
+
+  void recover();
+  bool read_snapshot(uint32_t& sequence);
+  /// Valid journal length, after replaying it
+  size_t replay_journal(uint32_t snapshot_sequence);
+  bool open_journal(size_t valid_length);
+  /// Writes the pending changes, returns false on a write error
+  bool flush();
+  bool snapshot();
+  void run();
+};
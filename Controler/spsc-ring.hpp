@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Lock-free single producer / single consumer ring.
+ *
+ * Safe to push from the JACK process callback : no lock nor allocation, a block
+ * that doesn't fit is dropped whole and counted. The capacity is rounded up to
+ * a power of two.
+ */
+template <typename T>
+class SpscRing {
+public:
+
+  explicit SpscRing(size_t capacity = 0) { reset(capacity); }
+
+  /// Allocates, neither side may run meanwhile
+  void reset(size_t capacity)
+  {
+    size_t size = 1;
+    while (size < capacity)
+      size <<= 1;
+    buffer.assign(size, T{});
+    mask = size - 1;
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+  }
+
+  /// Producer side, all or nothing
+  bool push(const T* data, size_t count)
+  {
+    const size_t h = head.load(std::memory_order_relaxed);
+    if (buffer.size() - (h - tail.load(std::memory_order_acquire)) < count)
+    {
+      dropped_count.fetch_add(count, std::memory_order_relaxed);
+      return false;
+    }
+    for (size_t i = 0 ; i < count ; ++i)
+      buffer[(h + i) & mask] = data[i];
+    head.store(h + count, std::memory_order_release);
+    return true;
+  }
+  bool push(const T& item) { return push(&item, 1); }
+
+  /// Producer side, free room
+  size_t space() const { return buffer.size() - (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire)); }
+
+  /// Consumer side, returns the number of items read
+  size_t pop(T* data, size_t count)
+  {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    const size_t available = head.load(std::memory_order_acquire) - t;
+    if (available < count)
+      count = available;
+    for (size_t i = 0 ; i < count ; ++i)
+      data[i] = buffer[(t + i) & mask];
+    tail.store(t + count, std::memory_order_release);
+    return count;
+  }
+
+  /// Consumer side, oldest item read in place, nullptr if empty. Valid until 'drop()'
+  const T* front() const
+  {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    return t == head.load(std::memory_order_acquire) ? nullptr : &buffer[t & mask];
+  }
+  /// Consumer side, forgets the oldest item
+  void drop() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  /// Items refused by 'push' since the reset
+  uint64_t dropped() const { return dropped_count.load(std::memory_order_relaxed); }
+
+private:
+
+  std::vector<T> buffer;
+  size_t mask = 0;
+  alignas(64) std::atomic<size_t> head{0}; ///!< Written by the producer
+  alignas(64) std::atomic<size_t> tail{0}; ///!< Written by the consumer
+  std::atomic<uint64_t> dropped_count{0};
+};
@@ -0,0 +1,112 @@
+#include "telemetry.hpp"
+
+#include <stdio.h>
+
+Telemetry::Telemetry(clock_t::duration log_period) :
+  log_period{log_period}, last_log{clock_t::now()}
+{
+  chunk.reserve(MaxChunkSize);
+}
+
+std::vector<std::string> Telemetry::feed(const std::string& bytes)
+{
+  std::vector<std::string> texts;
+  for (char c : bytes)
+  {
+    if (c == protocol::Delimiter)
+      end_chunk(texts);
+    else
+    {
+      chunk.push_back(c);
+      if (MaxChunkSize <= chunk.size())
+        end_chunk(texts);
+    }
+  }
+  // Text lines aren't delimited, flush them as they come.
+  //  Reports start with a small COBS code, so a partial report is never printable
+  if (!chunk.empty() && chunk.back() == '\n' && is_text(chunk))
+    end_chunk(texts);
+  return texts;
+}
+
+bool Telemetry::is_text(const std::vector<uint8_t>& bytes)
+{
+  for (uint8_t c : bytes)
+    if ((c < 0x20 || 0x7E < c) && c != '\n' && c != '\r' && c != '\t')
+      return false;
+  return true;
+}
+
+void Telemetry::end_chunk(std::vector<std::string>& texts)
+{
+  if (chunk.empty())
+    return;
+
+  telemetry_t report;
+  timesync::echo_t echo;
+  std::vector<uint8_t> frame{chunk};
+  std::vector<uint8_t> echo_frame{chunk};
+  if (timesync::decode(echo_frame.data(), echo_frame.size(), echo))
+  {
+    std::lock_guard lock(mutex);
+    echoes.push_back(echo);
+  }
+  else if (telemetry::decode(frame.data(), frame.size(), report))
+  {
+    std::lock_guard lock(mutex);
+    if (last.valid && report.sequence != last.report.sequence + 1)
+      last.lost_reports += report.sequence - last.report.sequence - 1;
+    last.report = report;
+    last.received = clock_t::now();
+    last.reports++;
+    last.valid = true;
+  }
+  else
+    texts.emplace_back(chunk.begin(), chunk.end());
+  chunk.clear();
+}
+
+Telemetry::snapshot_t Telemetry::snapshot() const
+{
+  std::lock_guard lock(mutex);
+  return last;
+}
+
+std::string Telemetry::summary() const
+{
+  const snapshot_t snap = snapshot();
+  if (!snap.valid)
+    return "No telemetry";
+
+  const telemetry_t& r = snap.report;
+  const char* names[telemetry_t::PhasesCount] = { "input", "compute", "show", "jitter" };
+  const unsigned fps_x10 = r.window_us ? (uint64_t(r.frames) * 10'000'000) / r.window_us : 0;
+
+  char tmp[512];
+  int len = snprintf(tmp, sizeof(tmp), "Driver #%u up %us : %u.%u fps, period %uus, late %u",
+    r.sequence, r.uptime_ms / 1000, fps_x10 / 10, fps_x10 % 10, r.period_us, r.late_frames);
+  for (uint8_t i = 0 ; i < telemetry_t::PhasesCount ; ++i)
+    len += snprintf(tmp + len, sizeof(tmp) - len, " : %s %u/%u/%uus",
+      names[i], r.phases[i].min, r.phases[i].avg, r.phases[i].max);
+  snprintf(tmp + len, sizeof(tmp) - len, " : frames %u, writes %u, drops %u (framing %u, crc %u, range %u), lost reports %u",
+    r.parser.frames, r.parser.writes, r.drops,
+    r.parser.framing_errors, r.parser.crc_errors, r.parser.range_errors, snap.lost_reports);
+  return std::string(tmp);
+}
+
+std::vector<timesync::echo_t> Telemetry::take_echoes()
+{
+  std::lock_guard lock(mutex);
+  std::vector<timesync::echo_t> result;
+  result.swap(echoes);
+  return result;
+}
+
+std::optional<std::string> Telemetry::periodic_log()
+{
+  const auto now = clock_t::now();
+  if (now - last_log < log_period || !snapshot().valid)
+    return std::nullopt;
+  last_log = now;
+  return summary();
+}
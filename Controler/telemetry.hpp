@@ -0,0 +1,58 @@
+#pragma once
+
+#include "../driver/telemetry.h"
+#include "../driver/timesync.h"
+
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <optional>
+
+/// Decodes the driver telemetry and clock sync echoes, keeps the last report for the rest of the controller
+class Telemetry {
+
+public:
+
+  using clock_t = std::chrono::steady_clock;
+
+  struct snapshot_t
+  {
+    telemetry_t       report;
+    clock_t::time_point received;
+    uint32_t          reports = 0;      ///!< Valid reports received
+    uint32_t          lost_reports = 0; ///!< Gaps in the reports sequence
+    bool              valid = false;    ///!< False until the first report
+  };
+
+  Telemetry(clock_t::duration log_period = std::chrono::seconds(10));
+
+  /// Feeds bytes received from the driver, returns the text messages found between reports
+  std::vector<std::string> feed(const std::string& bytes);
+
+  snapshot_t snapshot() const;
+
+  /// One line summary of the last report
+  std::string summary() const;
+
+  /// Returns the summary once per log period, if a report has been received
+  std::optional<std::string> periodic_log();
+
+  /// Clock sync echoes received since the last call
+  std::vector<timesync::echo_t> take_echoes();
+
+private:
+
+  static constexpr size_t MaxChunkSize = 1024;
+
+  mutable std::mutex mutex;
+  std::vector<uint8_t> chunk;
+  snapshot_t last;
+  std::vector<timesync::echo_t> echoes;
+
+  clock_t::duration log_period;
+  clock_t::time_point last_log;
+
+  void end_chunk(std::vector<std::string>& texts);
+  static bool is_text(const std::vector<uint8_t>& bytes);
+};
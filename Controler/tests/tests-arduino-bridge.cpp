@@ -0,0 +1,113 @@
+#include "controler/arduino-bridge.hpp"
+#include "driver/protocol.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <iostream>
+
+using clock_type = std::chrono::steady_clock;
+
+static constexpr size_t KillAddress = 0x1234;
+static constexpr size_t BulkWrites = 2000;
+static constexpr size_t Transactions = 20;
+static constexpr size_t TransactionSize = 250;
+
+/// Records when the kill write is received, and how many writes arrived
+struct recorder_t
+{
+  clock_type::time_point kill_received;
+  size_t writes = 0;
+  size_t writes_before_kill = 0;
+  bool kill_seen = false;
+
+  size_t size() const { return protocol::ControlBase; }
+  void write(size_t addr, const uint8_t*, size_t)
+  {
+    if (addr == KillAddress && !kill_seen)
+    {
+      kill_received = clock_type::now();
+      writes_before_kill = writes;
+      kill_seen = true;
+    }
+    writes++;
+  }
+  void control(uint16_t, const uint8_t*, size_t) {}
+  void end_frame() {}
+};
+
+std::vector<uint8_t> packet(size_t addr, uint8_t value)
+{
+  return { uint8_t(addr >> 8), uint8_t(addr & 0xFF), 1, value };
+}
+
+int main(int argc, char * const argv[])
+{
+  // Fake driver
+  int server = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  socklen_t addrlen = sizeof(addr);
+  if (bind(server, (sockaddr*)&addr, sizeof(addr)) || listen(server, 1) || getsockname(server, (sockaddr*)&addr, &addrlen))
+  {
+    perror("fake driver");
+    return 1;
+  }
+  const std::string port = std::to_string(ntohs(addr.sin_port));
+
+  recorder_t recorder;
+  const size_t expected = BulkWrites + Transactions * TransactionSize + 1;
+  std::thread driver([&]() {
+    int client = accept(server, nullptr, nullptr);
+    protocol::Parser parser;
+    uint8_t buffer[4096];
+    const auto deadline = clock_type::now() + std::chrono::seconds(10);
+    while (recorder.writes < expected && clock_type::now() < deadline)
+    {
+      ssize_t nread = read(client, buffer, sizeof(buffer));
+      if (nread <= 0)
+        break;
+      parser.feed(buffer, nread, recorder);
+    }
+    close(client);
+  });
+
+  ArduinoBridge bridge("127.0.0.1", port.c_str());
+
+  // Full preset load backlog : bulk setup writes and transactions
+  for (size_t i = 0 ; i < BulkWrites ; ++i)
+    bridge.send(i, packet(i, i), ArduinoBridge::BULK);
+  for (size_t t = 0 ; t < Transactions ; ++t)
+  {
+    std::vector<std::pair<size_t, std::vector<uint8_t>>> writes;
+    for (size_t i = 0 ; i < TransactionSize ; ++i)
+      writes.emplace_back(0x4000 + t * TransactionSize + i, packet(0x4000 + t * TransactionSize + i, t));
+    bridge.send_transaction(std::move(writes));
+  }
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  const auto kill_sent = clock_type::now();
+  bridge.send(KillAddress, packet(KillAddress, 0x7F), ArduinoBridge::CRITICAL);
+
+  driver.join();
+  const auto drained = clock_type::now();
+  close(server);
+
+  const auto latency = std::chrono::duration_cast<std::chrono::microseconds>(recorder.kill_received - kill_sent);
+  const auto drain = std::chrono::duration_cast<std::chrono::milliseconds>(drained - kill_sent);
+  std::cout << "Blackout latency : " << latency.count() << "us, "
+            << recorder.writes_before_kill << " writes before it, "
+            << recorder.writes << "/" << expected << " writes, backlog drained in " << drain.count() << "ms" << std::endl;
+
+  // One frame in flight plus at most one transaction (250 writes span 5 frames)
+  const bool ok = recorder.kill_seen && recorder.writes == expected && latency < std::chrono::milliseconds(15);
+  return ok ? 0 : 1;
+}
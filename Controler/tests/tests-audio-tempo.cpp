@@ -0,0 +1,334 @@
+#include "controler/audio-tempo.hpp"
+#include "driver/protocol.h"
+
+#include <cmath>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+/**
+ * Runs the audio beat tracker offline and reports its accuracy and cost.
+ *
+ * Without argument, synthetic tracks are generated (kicks on the beats, hats off
+ * the beats, noise, tempo jump, silence) and checked against their beat grid.
+ * With a WAV file argument (PCM 16/24/32 bits or float, any channel count),
+ * the tempo estimates are printed, along with the error against the expected
+ * tempo when given : tests-audio-tempo <file.wav> [bpm]
+ * The band energies are checked on the synthetic kicks and hats, with their cost
+ * and their link usage when sent once per driver frame.
+ */
+
+static constexpr size_t ChunkSize = 256; ///!< As a JACK period
+static constexpr double DriverFrame = 0.01;
+static constexpr double LinkBytesPerSecond = 115200 / 10; ///!< Serial link behind the TCP bridge
+
+struct result_t
+{
+  double lock_time = -1;  ///!< Seconds to the first lock
+  double phase_rms = 0;   ///!< Beat position error once locked, in ms
+  double bpm = 0;         ///!< At the end
+  double onset_recall = 0;
+  double onset_offset = 0;///!< Mean onset detection delay, in ms
+  double cpu = 0;         ///!< Processing time per second of audio, in ms
+  bool   running = false; ///!< At the end
+};
+
+/// 'beats' are the true beat times, empty if unknown
+result_t run(const std::vector<float>& audio, double rate, const std::vector<double>& beats, bool verbose = false)
+{
+  BeatTracker tracker(rate);
+  result_t result;
+  double cpu = 0, error_sum = 0, offset_sum = 0;
+  size_t samples = 0, matched = 0, next_report = 0;
+
+  for (size_t i = 0 ; i < audio.size() ; i += ChunkSize)
+  {
+    const double time = i / rate;
+    const auto start = std::chrono::steady_clock::now();
+    tracker.process(audio.data() + i, std::min(ChunkSize, audio.size() - i), time);
+    cpu += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (double onset : tracker.detector().onsets())
+    {
+      // Closest true beat
+      auto it = std::lower_bound(beats.begin(), beats.end(), onset - 0.05);
+      if (it != beats.end() && std::abs(*it - onset) < 0.05)
+      {
+        matched++;
+        offset_sum += onset - *it;
+      }
+    }
+
+    if (tracker.is_locked() && result.lock_time < 0)
+      result.lock_time = time;
+    if (verbose && next_report <= i)
+    {
+      std::cout << "  " << time << "s : " << (tracker.is_locked() ? "locked" : tracker.is_running() ? "running" : "stopped")
+        << " at " << tracker.bpm() << " BPM, confidence " << tracker.confidence() << std::endl;
+      next_report += 5 * rate;
+    }
+
+    // Phase error against the grid, once the lock had time to settle
+    if (tracker.is_locked() && !beats.empty() && result.lock_time + 5 < time && time < beats.back())
+    {
+      auto it = std::upper_bound(beats.begin(), beats.end(), time);
+      if (it == beats.begin() || it == beats.end())
+        continue;
+      const double previous = *(it - 1), next = *it;
+      const double truth = (time - previous) / (next - previous);
+      double error = tracker.beats(time) - truth;
+      error -= std::round(error);
+      error_sum += error * error * (next - previous) * (next - previous);
+      samples++;
+    }
+  }
+  result.phase_rms = samples ? std::sqrt(error_sum / samples) * 1000. : 0;
+  result.bpm = tracker.bpm();
+  result.running = tracker.is_running();
+  result.onset_recall = beats.empty() ? 0 : double(matched) / beats.size();
+  result.onset_offset = matched ? offset_sum / matched * 1000. : 0;
+  result.cpu = cpu * 1000. / (audio.size() / rate);
+  return result;
+}
+
+/// Kicks on the beats and hats between them, from 'bpm0' then 'bpm1' after 'change' seconds, over noise
+std::vector<float> generate(double rate, double duration, double bpm0, double bpm1, double change,
+  double noise, double jitter, std::vector<double>& beats)
+{
+  std::mt19937 rng(7);
+  std::normal_distribution<double> gauss(0, 1);
+  std::vector<float> audio(size_t(duration * rate));
+  for (auto& sample : audio)
+    sample = noise * gauss(rng);
+
+  auto add = [&](double at, bool kick) {
+    const size_t start = size_t(at * rate);
+    const size_t length = size_t((kick ? 0.15 : 0.04) * rate);
+    for (size_t i = 0 ; i < length && start + i < audio.size() ; ++i)
+    {
+      const double t = i / rate;
+      audio[start + i] += kick
+        ? 0.8 * std::exp(-t / 0.05) * std::sin(2 * M_PI * (50 + 100 * std::exp(-t / 0.01)) * t)
+        : 0.2 * std::exp(-t / 0.01) * gauss(rng);
+    }
+  };
+
+  beats.clear();
+  double t = 0.5;
+  while (t < duration)
+  {
+    const double period = 60. / (t < change ? bpm0 : bpm1);
+    const double at = t + jitter * gauss(rng);
+    beats.push_back(at);
+    add(at, true);
+    add(t + period / 2, false);
+    t += period;
+  }
+  return audio;
+}
+
+/// Band values after the kicks and after the hats, cost and link usage of the band writes
+bool check_bands(double rate)
+{
+  std::vector<double> beats;
+  const auto audio = generate(rate, 30, 128, 128, 1e9, 0.01, 0, beats);
+  OnsetDetector detector(rate);
+
+  size_t messages = 0, bytes = 0;
+  double on_kicks[2] = { 0, 0 }, on_hats[2] = { 0, 0 };
+  size_t kicks = 0, hats = 0;
+  for (size_t i = 0 ; i < audio.size() ; i += ChunkSize)
+  {
+    const double time = i / rate;
+    detector.process(audio.data() + i, std::min(ChunkSize, audio.size() - i), time);
+    auto msg = detector.bands().message(time, DriverFrame);
+    if (!msg)
+      continue;
+    // Alone in its frame, the worst case
+    uint8_t payload[protocol::MaxPayloadSize], frame[protocol::MaxEncodedSize + 1];
+    memcpy(payload, msg->data(), msg->size());
+    bytes += protocol::finish_frame(payload, msg->size(), frame);
+    messages++;
+
+    // The frames hold the previous 1024 samples : the one ending 20ms after a kick or a hat
+    auto it = std::upper_bound(beats.begin(), beats.end(), time);
+    if (it == beats.begin())
+      continue;
+    const double since = time - *(it - 1), period = 60. / 128.;
+    const auto& bands = detector.bands().values();
+    if (0.015 < since && since < 0.035)
+    {
+      on_kicks[0] += bands.front();
+      on_kicks[1] += bands.back();
+      kicks++;
+    }
+    else if (0.015 < since - period / 2 && since - period / 2 < 0.035)
+    {
+      on_hats[0] += bands.front();
+      on_hats[1] += bands.back();
+      hats++;
+    }
+  }
+  for (auto* values : { on_kicks, on_hats })
+    for (size_t b = 0 ; b < 2 ; ++b)
+      values[b] /= std::max<size_t>(1, values == on_kicks ? kicks : hats);
+
+  // Cost of the bands alone, on the spectrum of noise
+  std::vector<float> spectrum(OnsetDetector::FrameSize / 2 + 1);
+  std::mt19937 rng(3);
+  std::uniform_real_distribution<float> uniform(0, 0.1f);
+  for (auto& value : spectrum)
+    value = uniform(rng);
+  BandEnergies energies(rate, spectrum.size());
+  const size_t frames = 100000;
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0 ; i < frames ; ++i)
+    energies.process(spectrum.data(), OnsetDetector::HopSize / rate);
+  const double per_frame = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / frames;
+
+  const double duration = audio.size() / rate;
+  const double usage = bytes / duration / LinkBytesPerSecond;
+  std::cout << "bands : lows " << on_kicks[0] << " on kicks, " << on_hats[0] << " on hats, highs " << on_kicks[1]
+    << " on kicks, " << on_hats[1] << " on hats, " << per_frame * 1e6 << " us per frame, "
+    << messages / duration << " writes per second, " << bytes / duration << " B/s (" << usage * 100. << "% of the link)" << std::endl;
+
+  // Never more writes than driver frames
+  return on_hats[0] + 100 < on_kicks[0] && on_kicks[1] + 100 < on_hats[1]
+    && messages / duration <= 1. / DriverFrame + 1 && usage < 0.2;
+}
+
+bool read_wav(const char* path, std::vector<float>& audio, double& rate)
+{
+  std::ifstream file(path, std::ios::binary);
+  char id[4];
+  uint32_t size;
+  if (!file.read(id, 4) || std::string(id, 4) != "RIFF" || !file.read((char*)&size, 4) || !file.read(id, 4) || std::string(id, 4) != "WAVE")
+    return false;
+
+  uint16_t format = 0, channels = 0, bits = 0;
+  uint32_t sample_rate = 0;
+  while (file.read(id, 4) && file.read((char*)&size, 4))
+  {
+    const std::string chunk(id, 4);
+    if (chunk == "fmt ")
+    {
+      std::vector<char> fmt(size);
+      file.read(fmt.data(), size);
+      memcpy(&format, &fmt[0], 2);
+      memcpy(&channels, &fmt[2], 2);
+      memcpy(&sample_rate, &fmt[4], 4);
+      memcpy(&bits, &fmt[14], 2);
+      // WAVE_FORMAT_EXTENSIBLE : the format is the start of the sub format GUID
+      if (format == 0xFFFE && 26 <= size)
+        memcpy(&format, &fmt[24], 2);
+    }
+    else if (chunk == "data" && channels)
+    {
+      const size_t width = bits / 8;
+      std::vector<uint8_t> data(size);
+      file.read((char*)data.data(), size);
+      const size_t frames = file.gcount() / (width * channels);
+      audio.assign(frames, 0);
+      for (size_t i = 0 ; i < frames ; ++i)
+        for (size_t c = 0 ; c < channels ; ++c)
+        {
+          const uint8_t* p = &data[(i * channels + c) * width];
+          float value = 0;
+          if (format == 3 && width == 4)
+            memcpy(&value, p, 4);
+          else if (format == 1 && width == 2)
+            value = int16_t(p[0] | p[1] << 8) / 32768.f;
+          else if (format == 1 && width == 3)
+            value = int32_t(uint32_t(p[0] << 8 | p[1] << 16 | p[2] << 24)) / 2147483648.f;
+          else if (format == 1 && width == 4)
+            value = int32_t(uint32_t(p[0] | p[1] << 8 | p[2] << 16 | p[3] << 24)) / 2147483648.f;
+          else
+            return false;
+          audio[i] += value / channels;
+        }
+      rate = sample_rate;
+      return true;
+    }
+    else
+      file.seekg(size + (size & 1), std::ios::cur);
+  }
+  return false;
+}
+
+void print(const char* name, const result_t& result)
+{
+  std::cout << name << " : " << result.bpm << " BPM, locked after " << result.lock_time << "s, phase error "
+    << result.phase_rms << " ms rms, onsets " << result.onset_recall * 100. << "% found " << result.onset_offset
+    << " ms late, cpu " << result.cpu << " ms per second" << std::endl;
+}
+
+int main(int argc, char * const argv[])
+{
+  if (2 <= argc)
+  {
+    std::vector<float> audio;
+    double rate = 0;
+    if (!read_wav(argv[1], audio, rate))
+    {
+      std::cerr << "Can't read " << argv[1] << std::endl;
+      return 1;
+    }
+    const result_t result = run(audio, rate, {}, true);
+    print(argv[1], result);
+    if (argc == 3)
+    {
+      // Half and double tempos are the same beat grid, the prior picks one of them
+      const double expected = atof(argv[2]);
+      const double error = std::min({ std::abs(result.bpm - expected), std::abs(2 * result.bpm - expected), std::abs(result.bpm - 2 * expected) });
+      std::cout << "Tempo error " << error << " BPM (expected " << expected << ")" << std::endl;
+      return error < 1 ? 0 : 1;
+    }
+    return 0;
+  }
+
+  int errors = 0;
+  auto check = [&](const char* name, const result_t& result, double bpm, double max_phase) {
+    print(name, result);
+    if (result.lock_time < 0 || 0.5 < std::abs(result.bpm - bpm) || max_phase < result.phase_rms || result.onset_recall < 0.9)
+    {
+      std::cout << "  FAILED" << std::endl;
+      ++errors;
+    }
+  };
+
+  const double rate = 48000;
+  std::vector<double> beats;
+
+  auto steady = generate(rate, 60, 128, 128, 1e9, 0.01, 0, beats);
+  check("steady 128", run(steady, rate, beats), 128, 15.);
+
+  auto slow = generate(44100, 60, 95, 95, 1e9, 0.01, 0, beats);
+  check("steady 95 at 44.1kHz", run(slow, 44100, beats), 95, 15.);
+
+  auto noisy = generate(rate, 60, 140, 140, 1e9, 0.05, 0.005, beats);
+  check("noise and 5ms jitter 140", run(noisy, rate, beats), 140, 20.);
+
+  auto jump = generate(rate, 80, 120, 126, 40, 0.01, 0, beats);
+  check("jump 120-126", run(jump, rate, beats), 126, 20.);
+
+  if (!check_bands(rate))
+  {
+    std::cout << "  FAILED" << std::endl;
+    ++errors;
+  }
+
+  // Silence after a track : the tracker stops
+  auto stop = generate(rate, 60, 128, 128, 1e9, 0.01, 0, beats);
+  std::fill(stop.begin() + stop.size() / 2, stop.end(), 0.f);
+  const result_t stopped = run(stop, rate, {});
+  std::cout << "silence : " << (stopped.running ? "still running" : "stopped") << std::endl;
+  if (stopped.running)
+    ++errors;
+
+  return errors ? 1 : 0;
+}
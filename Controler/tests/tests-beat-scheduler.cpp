@@ -0,0 +1,168 @@
+#include "controler/beat-scheduler.hpp"
+
+#include <stdlib.h>
+
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+#include <iostream>
+
+/**
+ * Beat scheduler : the timer wheel against a sorted list on random ticks and steps,
+ * then the controller loop quantizing pad presses on a 128 BPM clock, reporting the
+ * scheduling error.
+ * Usage : tests-beat-scheduler [seed]
+ */
+
+static int failures = 0;
+void check(bool ok, const char* what)
+{
+  std::cout << (ok ? "  ok   " : "  FAIL ") << what << '\n';
+  failures += !ok;
+}
+
+/// Steady clock, as a locked tracker sees it
+struct FakeTempo : TempoSource
+{
+  double tempo = 128, origin = 0;
+  bool   locked = true;
+
+  bool is_running() const override { return locked; }
+  bool is_locked() const override { return locked; }
+  double bpm() const override { return tempo; }
+  double beats(double time) const override { return (time - origin) * tempo / 60; }
+};
+
+void test_wheel(std::mt19937& random)
+{
+  std::cout << "Timer wheel\n";
+  TimerWheel<uint32_t> wheel;
+  struct expected_t { uint64_t tick; uint32_t id; };
+  std::vector<expected_t> expected;
+  std::vector<TimerWheel<uint32_t>::entry_t> fired;
+  bool exact = true, ordered = true;
+  uint32_t next_id = 0, fired_count = 0;
+
+  // Near, far and beyond the top level, with many on the same ticks
+  std::uniform_int_distribution<int> kind(0, 3);
+  for (int round = 0 ; round < 2000 ; ++round)
+  {
+    for (int i = 0 ; i < 8 ; ++i)
+    {
+      uint64_t delay;
+      switch (kind(random))
+      {
+      case 0: delay = random() % 70; break;
+      case 1: delay = random() % 5000; break;
+      case 2: delay = random() % 300000; break;
+      default: delay = (random() % 8) * 64; break;
+      }
+      const uint64_t tick = wheel.now() + delay;
+      wheel.schedule(tick, next_id);
+      expected.push_back(expected_t{ tick, next_id++ });
+    }
+    const uint64_t step = random() % 4 ? random() % 200 : random() % 20000;
+    const uint64_t target = wheel.now() + step;
+    fired.clear();
+    wheel.advance(target, fired);
+
+    // What a sorted list would give : due by 'target', by tick then scheduling order
+    std::vector<expected_t> due;
+    std::vector<expected_t> rest;
+    for (auto& item : expected)
+      (item.tick <= target ? due : rest).push_back(item);
+    std::stable_sort(due.begin(), due.end(), [](auto& a, auto& b) { return a.tick < b.tick; });
+    expected.swap(rest);
+
+    exact &= fired.size() == due.size();
+    for (size_t i = 0 ; exact && i < due.size() ; ++i)
+      ordered &= fired[i].item == due[i].id && fired[i].tick == due[i].tick;
+    fired_count += fired.size();
+  }
+  check(exact, "entries fire on their tick");
+  check(ordered, "same tick in scheduling order");
+  check(wheel.size() == expected.size(), "pending count");
+  std::cout << "  " << fired_count << " fired, " << wheel.size() << " pending\n";
+
+  fired.clear();
+  wheel.reset(10, fired);
+  check(fired.size() == expected.size() && !wheel.size() && wheel.now() == 10, "reset removes everything");
+}
+
+void test_quantize(std::mt19937& random)
+{
+  std::cout << "Quantized commands\n";
+  FakeTempo tempo;
+  BeatScheduler scheduler;
+  scheduler.set_latency(0.004);
+  const double beat = 60 / tempo.tempo;
+
+  // One press, fired ahead of the bar by the lead
+  check(scheduler.schedule("next_preset 1", 4, tempo, 0.5) && scheduler.pending() == 1, "scheduled");
+  std::vector<BeatScheduler::batch_t> batches;
+  double fired_at = 0;
+  for (double now = 0.5 ; now < 3 && batches.empty() ; now += 100e-6)
+    if (!(batches = scheduler.advance(tempo, now)).empty())
+      fired_at = now;
+  const double expected = 4 * beat - scheduler.lead();
+  check(batches.size() == 1 && batches[0].commands[0] == "next_preset 1" && batches[0].beat == 4. && expected <= fired_at && fired_at < expected + 101e-6,
+    "fires a lead before the bar");
+
+  // Presses in the same beat go together
+  scheduler.schedule("strobe_enable:0 1", 1, tempo, 2.1);
+  scheduler.schedule("palette:0 3", 1, tempo, 2.2);
+  batches.clear();
+  for (double now = 2.2 ; now < 3 && batches.empty() ; now += 100e-6)
+    batches = scheduler.advance(tempo, now);
+  check(batches.size() == 1 && batches[0].commands.size() == 2 && batches[0].commands[0] == "strobe_enable:0 1", "one batch per beat");
+
+  // Too late for the coming beat : the next one
+  const double late = 5 * beat - scheduler.lead() / 2;
+  scheduler.schedule("load 1", 1, tempo, late);
+  check(scheduler.advance(tempo, late + 0.01).empty() && scheduler.pending() == 1, "a beat that can't be met is skipped");
+  check(scheduler.advance(tempo, 6 * beat).size() == 1, "fires on the next beat");
+
+  // Lost clock : at once, and nothing queued without a tempo
+  scheduler.schedule("load 1", 4, tempo, 3);
+  tempo.locked = false;
+  batches = scheduler.advance(tempo, 3.001);
+  check(batches.size() == 1 && !batches[0].beat && !scheduler.pending() && scheduler.stats().flushed == 1, "flushed when the clock is lost");
+  check(!scheduler.schedule("load 1", 4, tempo, 3.002), "not queued without a tempo");
+  tempo.locked = true;
+
+  // Restart : the beats go back to zero
+  scheduler.schedule("load 1", 4, tempo, 4);
+  tempo.origin = 4.1;
+  check(scheduler.advance(tempo, 4.11).size() == 1 && !scheduler.pending(), "flushed on a restart");
+
+  // Error over many presses, the loop period jittered around 100 us
+  std::uniform_real_distribution<double> loop(60e-6, 250e-6), press(0, 0.4);
+  std::uniform_int_distribution<int> grid(0, 2);
+  scheduler = BeatScheduler{};
+  scheduler.set_latency(0.0015 + 0.01);
+  tempo.origin = 0;
+  double next_press = 0;
+  for (double now = 0 ; now < 300 ; now += loop(random))
+  {
+    if (next_press <= now)
+    {
+      static const double grids[] = { 1, 2, 4 };
+      scheduler.schedule("next_preset 1", grids[grid(random)], tempo, now);
+      next_press = now + press(random);
+    }
+    scheduler.advance(tempo, now);
+  }
+  const auto& stats = scheduler.stats();
+  std::cout << "  " << scheduler.summary() << '\n';
+  check(stats.fired > 500 && stats.max < 260e-6 && 0 <= stats.sum, "error below a loop period, never early");
+}
+
+int main(int argc, char* const argv[])
+{
+  std::mt19937 random(argc >= 2 ? atoi(argv[1]) : 42);
+  test_wheel(random);
+  test_quantize(random);
+  std::cout << (failures ? "FAILED" : "PASSED") << '\n';
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,202 @@
+#include "controler/clock-tracker.hpp"
+
+#include <cmath>
+#include <random>
+#include <algorithm>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+/**
+ * Runs the tracker on clock streams and reports its jitter.
+ *
+ * Without argument, synthetic streams are generated : steady tempo, tick jitter,
+ * timestamps quantized to 1 ms (USB midi), tempo ramp and tempo jump.
+ * With a file argument, it holds a recorded stream : one event per line,
+ * "<time in seconds> <status byte>" (status defaults to 0xF8).
+ */
+
+struct result_t
+{
+  double phase_rms;   ///!< Error of the tracked beat positions against the true ones, in ms
+  double bpm_error;   ///!< Tempo error at the end, in BPM
+  double drift;       ///!< Driver phase error at the end, in beats
+  int    updates;     ///!< Writes sent to the driver
+  double duration;
+};
+
+/// 'truth(t)' is the true beat position, events are the received stream
+template <typename Truth>
+result_t run(const std::vector<clock_event_t>& events, Truth truth, double true_bpm_at_end)
+{
+  ClockTracker tracker;
+  TempoFollower follower;
+  result_t result = { 0, 0, 0, 0, 0 };
+  if (events.empty())
+    return result;
+
+  // Simulated driver : integrates the sent bpm and the sync deltas
+  double driver_cycles = 0, last_time = events.front().time, origin = 0;
+  float control = 0;
+  int correction = 0;
+  bool following = false;
+
+  double error_sum = 0;
+  int samples = 0;
+  for (auto& event : events)
+  {
+    if (following)
+      driver_cycles += (event.time - last_time) * 1000. / TempoFollower::master_cycle_ms(control);
+    last_time = event.time;
+
+    tracker.process(event);
+    auto update = follower.update(tracker, event.time);
+    if (update.bpm)
+    {
+      if (!following)
+        origin = truth(event.time);
+      following = true;
+      control = update.bpm.value();
+      result.updates++;
+    }
+    if (update.sync_delta)
+    {
+      correction += update.sync_delta;
+      result.updates++;
+    }
+
+    if (tracker.is_locked() && event.type == clock_event_t::TICK)
+    {
+      const double period = 60. / tracker.bpm();
+      const double error = (tracker.beats(event.time) - truth(event.time)) * period * 1000.;
+      error_sum += error * error;
+      samples++;
+    }
+  }
+  if (samples)
+    result.phase_rms = std::sqrt(error_sum / samples);
+  result.bpm_error = std::abs(tracker.bpm() - true_bpm_at_end);
+  // Beats played by the driver, against the true beats since the lock
+  const double driver_beats = (driver_cycles + correction / 256.) * TempoFollower::BeatsPerMasterCycle;
+  result.drift = driver_beats - (truth(last_time) - origin);
+  result.duration = last_time - events.front().time;
+  return result;
+}
+
+/// Clock stream at a tempo changing linearly from 'bpm0' to 'bpm1', with gaussian jitter and timestamp quantization
+std::vector<clock_event_t> generate(double bpm0, double bpm1, double duration, double jitter, double quantum,
+  std::vector<double>& ticks_time)
+{
+  std::mt19937 rng(42);
+  std::normal_distribution<double> noise(0, jitter);
+  std::vector<clock_event_t> events;
+  ticks_time.clear();
+  events.push_back({ clock_event_t::START, 0 });
+  double t = 0.001;
+  while (t < duration)
+  {
+    ticks_time.push_back(t);
+    double time = t + (jitter ? noise(rng) : 0);
+    if (quantum)
+      time = std::ceil(time / quantum) * quantum;
+    events.push_back({ clock_event_t::TICK, time });
+    const double bpm = bpm0 + (bpm1 - bpm0) * t / duration;
+    t += 60. / (bpm * ClockTracker::TicksPerBeat);
+  }
+  return events;
+}
+
+/// True beat position from the generated ticks
+auto truth_of(const std::vector<double>& ticks_time)
+{
+  return [&ticks_time](double time) {
+    auto it = std::upper_bound(ticks_time.begin(), ticks_time.end(), time);
+    if (it == ticks_time.begin())
+      return 0.;
+    const size_t i = it - ticks_time.begin() - 1;
+    const double next = i + 1 < ticks_time.size() ? ticks_time[i + 1] : ticks_time[i] + (ticks_time[i] - ticks_time[i - 1]);
+    return (i + (time - ticks_time[i]) / (next - ticks_time[i])) / ClockTracker::TicksPerBeat;
+  };
+}
+
+void print(const char* name, const result_t& result)
+{
+  std::cout << name << " : phase jitter " << result.phase_rms << " ms rms, bpm error " << result.bpm_error
+    << ", driver drift " << result.drift * 1000. << " mbeats, " << result.updates << " writes in "
+    << result.duration << " s" << std::endl;
+}
+
+int main(int argc, char * const argv[])
+{
+  if (argc == 2)
+  {
+    std::ifstream file(argv[1]);
+    std::vector<clock_event_t> events;
+    std::vector<double> ticks_time;
+    double time;
+    int status = 0xF8;
+    std::string line;
+    while (std::getline(file, line))
+    {
+      if (sscanf(line.c_str(), "%lf %i", &time, &status) < 1)
+        continue;
+      events.push_back({ clock_event_t::type_e(status), time });
+      if (status == 0xF8)
+        ticks_time.push_back(time);
+      status = 0xF8;
+    }
+    // The recorded ticks are their own truth, the phase jitter is the smoothing
+    ClockTracker tracker;
+    for (auto& event : events)
+      tracker.process(event);
+    print(argv[1], run(events, truth_of(ticks_time), tracker.bpm()));
+    return 0;
+  }
+
+  int errors = 0;
+  std::vector<double> ticks;
+  auto check = [&](const char* name, const result_t& result, double max_phase, double max_bpm) {
+    print(name, result);
+    // The driver must stay within 1/256 of a cycle of the tracked beats
+    const double max_drift = 1.5 * TempoFollower::BeatsPerMasterCycle / 256.;
+    if (max_phase < result.phase_rms || max_bpm < result.bpm_error || max_drift < std::abs(result.drift))
+    {
+      std::cout << "  FAILED" << std::endl;
+      ++errors;
+    }
+    // At most one bpm and one sync write per update interval
+    if (2 * result.duration / TempoFollower::MinUpdateInterval + 2 < result.updates)
+    {
+      std::cout << "  Too many writes" << std::endl;
+      ++errors;
+    }
+  };
+
+  auto steady = generate(128, 128, 120, 0, 0, ticks);
+  check("steady 128", run(steady, truth_of(ticks), 128), 0.1, 0.01);
+
+  auto jittered = generate(128, 128, 120, 0.002, 0, ticks);
+  check("jitter 2ms", run(jittered, truth_of(ticks), 128), 2., 0.5);
+
+  auto usb = generate(174, 174, 120, 0.0005, 0.001, ticks);
+  check("usb 1ms", run(usb, truth_of(ticks), 174), 1., 0.5);
+
+  auto ramp = generate(120, 130, 120, 0.0005, 0, ticks);
+  check("ramp 120-130", run(ramp, truth_of(ticks), 130), 2., 0.5);
+
+  // Tempo jump : the second half of the stream is at another tempo
+  auto first = generate(100, 100, 30, 0, 0, ticks);
+  std::vector<double> second_ticks;
+  auto second = generate(140, 140, 30, 0, 0, second_ticks);
+  std::vector<clock_event_t> jump = first;
+  std::vector<double> jump_ticks = ticks;
+  const double offset = ticks.back() + 60. / (100. * ClockTracker::TicksPerBeat);
+  for (size_t i = 0 ; i < second_ticks.size() ; ++i)
+  {
+    jump.push_back({ clock_event_t::TICK, second_ticks[i] - second_ticks.front() + offset });
+    jump_ticks.push_back(second_ticks[i] - second_ticks.front() + offset);
+  }
+  check("jump 100-140", run(jump, truth_of(jump_ticks), 140), 5., 0.1);
+
+  return errors ? 1 : 0;
+}
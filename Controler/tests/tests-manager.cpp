@@ -0,0 +1,48 @@
+#include "controler/manager.hpp"
+
+#include <stdio.h>
+#include <iostream>
+
+void write_file(const char* path, const char* content)
+{
+  FILE* file = fopen(path, "w");
+  fputs(content, file);
+  fclose(file);
+}
+
+int main(int argc, char * const argv[])
+{
+  int errors = 0;
+
+  write_file("/tmp/tests-manager-setup.txt", "ribbons_count 8\nmodule_length 30\n");
+  write_file("/tmp/tests-manager-a.txt", "bpm 1200\nbrightness 100\nstrobe_speed 10\nblur_enable n\n");
+  write_file("/tmp/tests-manager-b.txt", "bpm 1200\nbrightness 50\nstrobe_speed 10\nblur_enable y\n");
+  write_file("/tmp/tests-manager-save.txt", "/tmp/tests-manager-a.txt\n/tmp/tests-manager-b.txt\n");
+
+  Manager manager("/tmp/tests-manager-save.txt", "/tmp/tests-manager-setup.txt");
+
+  // First load sends the whole files
+  auto result = manager.process_command("load y");
+  std::cout << "load : " << result.size() << " controls" << std::endl;
+  if (result.size() != 6)
+    ++errors;
+
+  // Switching preset only sends what changed
+  result = manager.process_command("next_preset y");
+  std::cout << "next_preset : " << result.size() << " controls" << std::endl;
+  for (auto& [ctrl, force] : result)
+  {
+    std::cout << "  " << ctrl->to_command_string() << std::endl;
+    if (ctrl->name != "brightness" && ctrl->name != "blur_enable")
+      ++errors;
+  }
+  if (result.size() != 2)
+    ++errors;
+
+  // An explicit load still resends everything
+  result = manager.process_command("load y");
+  if (result.size() != 6)
+    ++errors;
+
+  return errors ? 1 : 0;
+}
@@ -1,17 +1,159 @@
 #include "controler/mapper.hpp"
 
+#include <stdio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <vector>
 #include <iostream>
 
-int main(int argc, char * const argv[])
+/**
+ * Mapping files : the APC40 file against the bindings it replaces, rejected files,
+ * and a hot reload every few milliseconds while the main thread maps messages.
+ * Usage : tests-mapper [mappings-directory]
+ */
+
+using clock_type = std::chrono::steady_clock;
+
+static int failures = 0;
+void check(bool ok, const char* what)
+{
+  std::cout << (ok ? "  ok   " : "  FAIL ") << what << '\n';
+  failures += !ok;
+}
+
+void write_file(const std::string& path, const char* text)
+{
+  // Renamed in place, as editors save
+  const std::string tmp = path + ".tmp";
+  FILE* file = fopen(tmp.c_str(), "w");
+  fputs(text, file);
+  fclose(file);
+  rename(tmp.c_str(), path.c_str());
+}
+
+std::vector<std::string> map(const Mapper& mapper, std::vector<uint8_t> msg)
+{
+  return mapper.midimsg_to_command(msg);
+}
+
+void test_files(const std::string& directory)
+{
+  std::cout << "Files\n";
+  Mapper apc{directory + "/apc40.map"};
+  Mapper pedal{directory + "/footswitch.map"};
+
+  check(map(apc, { 0xb0, 0x0e, 100 }) == std::vector<std::string>{ "brightness 100" }, "value");
+  check(map(apc, { 0xb3, 0x07, 12 }) == std::vector<std::string>{ "brightness:3 12" }, "value on a channel");
+  check(map(apc, { 0x90, 0x5b, 0x7F }) == std::vector<std::string>{ "load y" }, "bool");
+  check(map(apc, { 0x92, 0x35, 0x7F }) == std::vector<std::string>{ "colormod_enable:2 y" }
+    && map(apc, { 0x82, 0x35, 0x7F }) == std::vector<std::string>{ "colormod_enable:2 n" }
+    && map(apc, { 0x92, 0x35, 0x00 }) == std::vector<std::string>{ "colormod_enable:2 n" }, "pad");
+  check(map(apc, { 0xb0, 0x01, 0x00 }).empty() && map(apc, { 0xb0, 0x0e }).empty(), "unbound and short messages");
+  check(map(pedal, { 0xb0, 0x40, 0x7F }) == std::vector<std::string>{ "next_preset y" }, "foot switch");
+
+  check(apc.command_to_midimsg("strobe_speed 42") == std::vector<std::vector<uint8_t>>{ { 0xb0, 0x0f, 42 } }, "value feedback");
+  check(apc.command_to_midimsg("solo:1 y") == std::vector<std::vector<uint8_t>>{ { 0x90, 0x58, 0x7F } }, "pad feedback, once");
+  check(apc.command_to_midimsg("do_litmax:5 n") == std::vector<std::vector<uint8_t>>{ { 0x85, 0x34, 0x7F } }, "pad off");
+  check(pedal.command_to_midimsg("next_preset y").empty() && pedal.command_to_midimsg("brightness 3").empty(), "no feedback");
+
+  // Lookup cost
+  const uint8_t msg[3] = { 0xb5, 0x13, 64 };
+  const auto start = clock_type::now();
+  size_t count = 0;
+  for (int i = 0 ; i < 1000000 ; ++i)
+    count += apc.midimsg_to_command(msg, 3).size();
+  const double ns = std::chrono::duration<double, std::nano>(clock_type::now() - start).count() / 1e6;
+  std::cout << "  " << ns << "ns per message, command string included\n";
+  check(count == 1000000, "lookups");
+}
+
+void test_invalid()
+{
+  std::cout << "Invalid files\n";
+  const std::string path = "/tmp/tests-mapper-invalid.map";
+  const char* invalid[] = {
+    "b0:0e brightness value\n",
+    "b0:0e brightness value value extra\n",
+    "f8:00 tick value none\n",
+    "b0:80 brightness value value\n",
+    "b0:0e brightness scale value\n",
+    "b0:0e brightness none value\n",
+    "brightness\n",
+  };
+  bool rejected = true;
+  for (const char* text : invalid)
+  {
+    write_file(path, text);
+    rejected &= !MappingTable::load(path.c_str());
+  }
+  check(rejected, "rejected");
+
+  write_file(path, "# Comment\n\n  b0:0e brightness value value # trailing\n");
+  auto table = MappingTable::load(path.c_str());
+  check(table && table->size() == 1, "comments and blank lines");
+
+  Mapper mapper{path};
+  usleep(10000);
+  write_file(path, "b0:0e brightness value\n");
+  check(!mapper.poll() && map(mapper, { 0xb0, 0x0e, 1 }) == std::vector<std::string>{ "brightness 1" }, "an invalid edit keeps the table");
+  unlink(path.c_str());
+}
+
+void test_reload()
 {
-    Mapper mapper{Mapper::APC40_mappings()};
+  std::cout << "Hot reload\n";
+  const std::string path = "/tmp/tests-mapper-reload.map";
+  const char* versions[] = {
+    "b0:0e brightness value value\n",
+    "b0:0e strobe_speed value value\nb0:0f brightness value value\n",
+  };
+  write_file(path, versions[0]);
+  Mapper mapper{path};
 
-    auto [midi, trace] = mycelium::map_event<
-        std::string, 
-        std::unordered_multimap<std::string, const binding_t*>,
-        mycelium::optopoulpe_map_traits>("blur_enable t", mapper.command_to_midi_map);
+  std::atomic<bool> running{true};
+  int reloads = 0;
+  std::thread watcher([&]() {
+    for (int i = 1 ; i <= 200 ; ++i)
+    {
+      write_file(path, versions[i % 2]);
+      reloads += mapper.poll();
+      usleep(2000);
+    }
+    running = false;
+  });
 
-    std::cout << trace << std::endl;
+  // Every message maps to exactly one command of either version
+  const uint8_t msg[3] = { 0xb0, 0x0e, 7 };
+  size_t total = 0, mapped = 0, first = 0, second = 0;
+  while (running)
+  {
+    for (int i = 0 ; i < 100 ; ++i)
+    {
+      auto commands = mapper.midimsg_to_command(msg, 3);
+      ++total;
+      mapped += commands.size() == 1;
+      first += commands.size() == 1 && commands[0] == "brightness 7";
+      second += commands.size() == 1 && commands[0] == "strobe_speed 7";
+    }
+    mapper.quiescent();
+  }
+  watcher.join();
 
-    return 0;
-}
\ No newline at end of file
+  std::cout << "  " << reloads << " reloads, " << mapped << " messages\n";
+  check(reloads == 200, "every change published");
+  check(mapped == total && mapped == first + second && first && second, "no message dropped during reloads");
+  unlink(path.c_str());
+}
+
+int main(int argc, char* const argv[])
+{
+  test_files(argc == 2 ? argv[1] : "../mappings");
+  test_invalid();
+  test_reload();
+  std::cout << (failures ? "FAILED" : "PASSED") << '\n';
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,132 @@
+#include "controler/midi-stream.hpp"
+
+#include <atomic>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+/**
+ * Merge of the devices MIDI rings : order by frame then priority, the period limit,
+ * the frame counter wrap, and a producer thread standing for the JACK callback.
+ */
+
+using devices_t = std::vector<std::unique_ptr<midi_device_t>>;
+
+static int failures = 0;
+void check(bool ok, const char* what)
+{
+  std::cout << (ok ? "  ok   " : "  FAIL ") << what << '\n';
+  failures += !ok;
+}
+
+devices_t make_devices(std::initializer_list<uint8_t> priorities)
+{
+  devices_t devices;
+  for (uint8_t priority : priorities)
+  {
+    devices.push_back(std::make_unique<midi_device_t>());
+    devices.back()->priority = priority;
+  }
+  return devices;
+}
+
+void push(devices_t& devices, uint8_t device, uint32_t frame, uint8_t note)
+{
+  devices[device]->from_jack.push(midi_event_t{ frame, device, 3, { 0x90, note, 0x7F } });
+}
+
+void test_order()
+{
+  std::cout << "Order\n";
+  // The foot switch (device 1) goes before the controllers on the same frame
+  auto devices = make_devices({ 1, 0, 2 });
+  push(devices, 0, 10, 1);
+  push(devices, 0, 20, 4);
+  push(devices, 0, 20, 5);
+  push(devices, 1, 15, 2);
+  push(devices, 1, 20, 3);
+  push(devices, 2, 5, 0);
+  push(devices, 2, 20, 6);
+  push(devices, 1, 30, 7);
+
+  std::vector<uint8_t> notes;
+  const size_t handled = merge_midi(devices, 30, [&](const midi_event_t& event) { notes.push_back(event.data[1]); });
+  check(handled == 7 && notes == std::vector<uint8_t>{ 0, 1, 2, 3, 4, 5, 6 }, "by frame, priority, then arrival");
+  check(devices[1]->from_jack.front() && devices[1]->from_jack.front()->frame == 30, "events of the next period wait");
+
+  notes.clear();
+  merge_midi(devices, 31, [&](const midi_event_t& event) { notes.push_back(event.data[1]); });
+  check(notes == std::vector<uint8_t>{ 7 }, "taken once their period is complete");
+
+  // Across the frame counter wrap
+  push(devices, 0, 2, 11);
+  push(devices, 2, 0xFFFFFFF0, 10);
+  notes.clear();
+  merge_midi(devices, 16, [&](const midi_event_t& event) { notes.push_back(event.data[1]); });
+  check(notes == std::vector<uint8_t>{ 10, 11 }, "frame counter wrap");
+}
+
+void test_threads()
+{
+  std::cout << "Threads\n";
+  static constexpr uint32_t Periods = 20000;
+  static constexpr uint32_t PeriodFrames = 64;
+  auto devices = make_devices({ 2, 0, 1, 0 });
+  std::atomic<uint32_t> completed{0};
+  std::atomic<bool> done{false};
+  uint64_t pushed = 0;
+
+  // As the JACK callback : each device in turn, then the end of the period
+  std::thread producer([&]() {
+    std::mt19937 random(42);
+    for (uint32_t period = 0 ; period < Periods ; ++period)
+    {
+      const uint32_t start = period * PeriodFrames;
+      for (size_t i = 0 ; i < devices.size() ; ++i)
+      {
+        uint32_t frame = start + random() % 8;
+        for (uint32_t count = random() % 4 ; count-- ; frame += random() % 16)
+        {
+          if (start + PeriodFrames <= frame)
+            break;
+          // The callback would drop it, the test waits to count every event
+          while (devices[i]->from_jack.space() == 0)
+            std::this_thread::yield();
+          push(devices, i, frame, 0);
+          ++pushed;
+        }
+      }
+      completed.store(start + PeriodFrames, std::memory_order_release);
+    }
+    done = true;
+  });
+
+  uint64_t handled = 0;
+  bool ordered = true;
+  midi_event_t last{ 0, 0, 0, {} };
+  auto handler = [&](const midi_event_t& event) {
+    if (handled && (frame_before(event.frame, last.frame)
+      || (event.frame == last.frame && devices[event.device]->priority < devices[last.device]->priority)))
+      ordered = false;
+    last = event;
+    ++handled;
+  };
+  while (!done)
+    merge_midi(devices, completed.load(std::memory_order_acquire), handler);
+  producer.join();
+  merge_midi(devices, completed.load(std::memory_order_acquire), handler);
+
+  std::cout << "  " << handled << " events of " << devices.size() << " devices\n";
+  check(handled == pushed, "no event lost");
+  check(ordered, "single ordered stream");
+}
+
+int main(int argc, char* const argv[])
+{
+  test_order();
+  test_threads();
+  std::cout << (failures ? "FAILED" : "PASSED") << '\n';
+  return failures ? 1 : 0;
+}
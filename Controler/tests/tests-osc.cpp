@@ -0,0 +1,256 @@
+#include "controler/osc.hpp"
+#include "controler/mpsc-queue.hpp"
+#include "controler/manager.hpp"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <vector>
+#include <iostream>
+
+/**
+ * OSC ingress : decoding, argument conversion, the MPSC queue under concurrent
+ * producers, then a load generator blasting the server over loopback while the main
+ * thread applies the commands to a Manager, as the controller does.
+ * Usage : tests-osc [seconds] [senders]
+ */
+
+using clock_type = std::chrono::steady_clock;
+
+// Counts the allocations, to check the decoding makes none
+static std::atomic<uint64_t> allocations{0};
+void* operator new(size_t size)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* ptr = malloc(size))
+    return ptr;
+  throw std::bad_alloc();
+}
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+
+static int failures = 0;
+void check(bool ok, const char* what)
+{
+  std::cout << (ok ? "  ok   " : "  FAIL ") << what << '\n';
+  failures += !ok;
+}
+
+/// Minimal OSC encoder
+struct packet_t
+{
+  std::vector<uint8_t> bytes;
+
+  packet_t& string(const char* text)
+  {
+    const size_t length = strlen(text);
+    bytes.insert(bytes.end(), text, text + length);
+    bytes.resize(bytes.size() + 4 - length % 4, 0);
+    return *this;
+  }
+  packet_t& u32(uint32_t value)
+  {
+    for (int shift = 24 ; shift >= 0 ; shift -= 8)
+      bytes.push_back(value >> shift);
+    return *this;
+  }
+  packet_t& f32(float value)
+  {
+    uint32_t raw;
+    memcpy(&raw, &value, sizeof(raw));
+    return u32(raw);
+  }
+  packet_t& element(const packet_t& packet)
+  {
+    u32(packet.bytes.size());
+    bytes.insert(bytes.end(), packet.bytes.begin(), packet.bytes.end());
+    return *this;
+  }
+};
+
+packet_t message_i(const char* address, int32_t value) { return packet_t{}.string(address).string(",i").u32(value); }
+packet_t message_f(const char* address, float value) { return packet_t{}.string(address).string(",f").f32(value); }
+packet_t bundle() { return packet_t{}.string("#bundle").u32(0).u32(1); }
+
+void write_file(const char* path, const char* content)
+{
+  FILE* file = fopen(path, "w");
+  fputs(content, file);
+  fclose(file);
+}
+
+void test_decode(const Manager& manager, const OscAddressMap& addresses)
+{
+  std::cout << "Decode\n";
+  osc_command_t out[16];
+  osc::stats_t stats;
+  auto decode = [&](const packet_t& packet) {
+    return osc::decode(packet.bytes.data(), packet.bytes.size(), addresses, out, 16, stats);
+  };
+
+  check(decode(message_i("/brightness", 100)) == 1 && manager.control(out[0].control).name == "brightness"
+    && out[0].type == 'i' && out[0].arg.i == 100, "int message");
+  check(decode(message_f("/colormod_osc/3", 0.5f)) == 1 && manager.control(out[0].control).name == "colormod_osc:3"
+    && out[0].type == 'f' && out[0].arg.f == 0.5f, "float message, ':' as '/'");
+  check(decode(packet_t{}.string("/blur_enable").string(",T")) == 1 && out[0].type == 'T', "true message");
+
+  packet_t inner = bundle().element(message_i("/min_value/0/2", 3));
+  packet_t outer = bundle().element(message_i("/brightness", 1)).element(inner).element(message_f("/strobe_speed", 1.f));
+  check(decode(outer) == 3 && manager.control(out[1].control).name == "min_value:0:2", "nested bundles");
+
+  stats = osc::stats_t{};
+  const packet_t invalid[] = {
+    message_i("/nothing", 1),
+    packet_t{}.string("/brightness").string(",s").string("y"),
+    packet_t{}.string("/brightness").string(",i"),
+    packet_t{}.string("/brightness"),
+    packet_t{ { '/', 'b', 'r', 'i' } },
+    packet_t{ { '/', 'b', 'r' } },
+  };
+  size_t decoded = 0;
+  for (auto& packet : invalid)
+    decoded += decode(packet);
+  check(decoded == 0 && stats.errors == std::size(invalid), "invalid messages rejected");
+
+  packet_t truncated = bundle().element(message_i("/brightness", 1));
+  truncated.bytes.resize(truncated.bytes.size() - 4);
+  stats = osc::stats_t{};
+  check(decode(truncated) == 0 && stats.errors == 1, "truncated bundle");
+
+  const uint64_t before = allocations.load();
+  for (int i = 0 ; i < 1000 ; ++i)
+    decode(outer);
+  check(allocations.load() == before, "no allocation");
+
+  control_t::value_u value = *to_value(osc_command_t{ 0, 'f', { .f = 1.f } }, control_t::UINT7);
+  check(value.u == 127, "fader to UINT7");
+  value = *to_value(osc_command_t{ 0, 'i', { .i = 300 } }, control_t::UINT7);
+  check(value.u == 127, "int clamped");
+  value = *to_value(osc_command_t{ 0, 'F', { .i = 0 } }, control_t::BOOL);
+  check(!value.b && !to_value(osc_command_t{ 0, 'T', { .i = 0 } }, control_t::FLOAT), "booleans");
+}
+
+void test_queue()
+{
+  std::cout << "MPSC queue\n";
+  static constexpr uint32_t Producers = 4;
+  static constexpr uint32_t Items = 1000000;
+  struct item_t { uint32_t producer, sequence; };
+  MpscQueue<item_t> queue(1024);
+
+  std::vector<std::thread> producers;
+  for (uint32_t p = 0 ; p < Producers ; ++p)
+    producers.emplace_back([&queue, p]() {
+      for (uint32_t i = 0 ; i < Items ; ++i)
+        while (!queue.push(item_t{ p, i }))
+          std::this_thread::yield();
+    });
+
+  std::vector<uint32_t> next(Producers, 0);
+  bool ordered = true;
+  uint64_t received = 0;
+  item_t item;
+  while (received < Producers * Items)
+    if (queue.pop(item))
+    {
+      ordered &= item.sequence == next[item.producer]++;
+      ++received;
+    }
+  for (auto& producer : producers)
+    producer.join();
+  check(ordered && !queue.pop(item), "every item once, each producer in order");
+}
+
+void test_load(Manager& manager, const OscAddressMap& addresses, double seconds, int senders)
+{
+  MpscQueue<osc_command_t> queue(1 << 16);
+  OscServer server(0, addresses, queue);
+
+  for (size_t per_packet : { 1, 16 })
+  {
+    std::cout << "Load : " << senders << " senders, " << per_packet << " messages per packet\n";
+    packet_t packet;
+    if (per_packet == 1)
+      packet = message_f("/colormod_width/2", 0.5f);
+    else
+    {
+      packet = bundle();
+      for (size_t i = 0 ; i < per_packet ; ++i)
+        packet.element(message_i(i % 2 ? "/brightness" : "/feedback_qty/5", i));
+    }
+
+    const uint64_t packets_before = server.packets();
+    const uint64_t dropped_before = queue.dropped();
+    std::atomic<bool> running{true};
+    std::atomic<uint64_t> sent{0};
+    std::vector<std::thread> threads;
+    for (int s = 0 ; s < senders ; ++s)
+      threads.emplace_back([&]() {
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(server.port());
+        connect(fd, (const sockaddr*)&address, sizeof(address));
+        uint64_t count = 0;
+        while (running)
+          count += send(fd, packet.bytes.data(), packet.bytes.size(), 0) > 0;
+        sent += count;
+        close(fd);
+      });
+
+    // As the controller main loop
+    uint64_t applied = 0;
+    osc_command_t command;
+    const auto start = clock_type::now();
+    while (clock_type::now() - start < std::chrono::duration<double>(seconds))
+    {
+      while (queue.pop(command))
+        if (auto value = to_value(command, manager.control(command.control).type))
+          applied += !manager.process_control(command.control, value.value()).empty();
+    }
+    running = false;
+    for (auto& thread : threads)
+      thread.join();
+    // Drain what the server already decoded
+    usleep(200000);
+    while (queue.pop(command))
+      if (auto value = to_value(command, manager.control(command.control).type))
+        applied += !manager.process_control(command.control, value.value()).empty();
+
+    const uint64_t received = server.packets() - packets_before;
+    std::cout << "  " << uint64_t(applied / seconds) << " messages/s applied, " << received * 100. / sent << "% of "
+      << uint64_t(sent / seconds) << " packets/s received, " << queue.dropped() - dropped_before << " dropped by the queue\n";
+    check(received && applied == received * per_packet - (queue.dropped() - dropped_before), "every decoded message applied");
+  }
+  std::cout << "  " << server.summary() << '\n';
+}
+
+int main(int argc, char* const argv[])
+{
+  const double seconds = argc >= 2 ? atof(argv[1]) : 2;
+  const int senders = argc >= 3 ? atoi(argv[2]) : 2;
+
+  write_file("/tmp/tests-osc-setup.txt", "ribbons_count 8\n");
+  write_file("/tmp/tests-osc-save.txt", "/tmp/tests-osc-setup.txt\n");
+  Manager manager("/tmp/tests-osc-save.txt", "/tmp/tests-osc-setup.txt");
+  OscAddressMap addresses(manager);
+
+  test_decode(manager, addresses);
+  test_queue();
+  test_load(manager, addresses, seconds, senders);
+
+  std::cout << (failures ? "FAILED" : "PASSED") << '\n';
+  return failures ? 1 : 0;
+}
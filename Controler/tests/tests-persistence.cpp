@@ -0,0 +1,277 @@
+#include "controler/persistence.hpp"
+#include "controler/manager.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include <map>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+/**
+ * Persistence : the state through a restart, a snapshot, a torn journal and a killed process,
+ * then the manager journaling its controls, and the cost of a change on the main loop.
+ * Usage : tests-persistence [seed]
+ */
+
+static int failures = 0;
+void check(bool ok, const char* what)
+{
+  std::cout << (ok ? "  ok   " : "  FAIL ") << what << '\n';
+  failures += !ok;
+}
+
+using state_t = std::map<uint16_t, uint32_t>;
+
+static const std::string Base = "/tmp/tests-persistence";
+static constexpr uint64_t Layout = 0x1234;
+
+void remove_files(const std::string& base)
+{
+  unlink((base + ".journal").c_str());
+  unlink((base + ".snapshot").c_str());
+}
+
+state_t recovered(const Persistence& persistence)
+{
+  const auto& pairs = persistence.recovered();
+  return state_t(pairs.begin(), pairs.end());
+}
+
+/// Waits for the thread to make everything durable
+void wait_synced(const Persistence& persistence, uint32_t sequence)
+{
+  while (persistence.synced() < sequence)
+    usleep(1000);
+}
+
+/// Deterministic change 'i', as the crash test child makes them
+std::pair<uint16_t, uint32_t> change(uint32_t seed, uint32_t i)
+{
+  const uint32_t hash = (i + seed) * 2654435761u;
+  return { uint16_t(hash % 300), hash ^ i };
+}
+
+void test_restart()
+{
+  std::cout << "Restart\n";
+  remove_files(Base);
+  state_t expected;
+  {
+    Persistence persistence(Base, Layout);
+    check(persistence.recovered().empty() && persistence.recovered_sequence() == 0, "starts empty");
+    for (uint32_t i = 0 ; i < 1000 ; ++i)
+    {
+      persistence.record(i % 50, i);
+      expected[i % 50] = i;
+    }
+  }
+  {
+    Persistence persistence(Base, Layout);
+    check(recovered(persistence) == expected && persistence.recovered_sequence() == 1000, "journal replayed");
+
+    // Compacted : the journal starts over past the snapshot
+    persistence.record(3, 42);
+    expected[3] = 42;
+    wait_synced(persistence, 1001);
+    persistence.request_snapshot();
+    while (persistence.summary().find(", 1 snapshots") == std::string::npos)
+      usleep(1000);
+    persistence.record(4, 43);
+    expected[4] = 43;
+  }
+  {
+    std::ifstream journal(Base + ".journal", std::ios::binary | std::ios::ate);
+    check(journal.tellg() == std::streamoff(16 + sizeof(Persistence::record_t)), "journal cut after the snapshot");
+    Persistence persistence(Base, Layout);
+    check(recovered(persistence) == expected && persistence.recovered_sequence() == 1002, "snapshot then journal");
+  }
+  {
+    // Another controls layout : nothing replayed, and the files start over
+    Persistence persistence(Base, Layout + 1);
+    check(persistence.recovered().empty(), "other layout ignored");
+  }
+}
+
+void test_torn()
+{
+  std::cout << "Torn journal\n";
+  remove_files(Base);
+  state_t expected;
+  {
+    Persistence persistence(Base, Layout);
+    for (uint32_t i = 0 ; i < 100 ; ++i)
+    {
+      persistence.record(i, i * 3);
+      expected[i] = i * 3;
+    }
+  }
+  // Half a record, then a corrupted one
+  {
+    std::ofstream journal(Base + ".journal", std::ios::binary | std::ios::app);
+    journal.write("\x65\x00\x00\x00\x07\x00", 6);
+  }
+  {
+    Persistence persistence(Base, Layout);
+    check(recovered(persistence) == expected, "torn record dropped");
+    persistence.record(7, 1);
+    expected[7] = 1;
+  }
+  {
+    Persistence persistence(Base, Layout);
+    check(recovered(persistence) == expected && persistence.recovered_sequence() == 101, "appends after the cut");
+  }
+  {
+    std::fstream journal(Base + ".journal", std::ios::binary | std::ios::in | std::ios::out);
+    journal.seekp(16 + 50 * sizeof(Persistence::record_t) + 8);
+    journal.put('\xff');
+  }
+  {
+    Persistence persistence(Base, Layout);
+    check(persistence.recovered_sequence() == 50 && recovered(persistence).size() == 50, "stops at a corrupted record");
+  }
+}
+
+void test_crash(uint32_t seed)
+{
+  std::cout << "Killed process\n";
+  uint32_t worst = 0;
+  bool exact = true;
+  for (int trial = 0 ; trial < 10 ; ++trial)
+  {
+    remove_files(Base);
+    int fds[2];
+    if (pipe(fds) != 0)
+      return;
+    const pid_t child = fork();
+    if (child == 0)
+    {
+      // Changes as fast as the ring takes them, reporting what is durable
+      close(fds[0]);
+      Persistence persistence(Base, Layout);
+      for (uint32_t i = 0 ; ; )
+      {
+        for (int k = 0 ; k < 100 ; ++k, ++i)
+        {
+          const auto [key, value] = change(seed + trial, i);
+          while (!persistence.record(key, value))
+            usleep(100);
+        }
+        const uint32_t synced = persistence.synced();
+        if (write(fds[1], &synced, sizeof(synced)) != sizeof(synced))
+          _exit(1);
+        usleep(200);
+      }
+    }
+    close(fds[1]);
+    uint32_t synced = 0, reported;
+    usleep(50000 + trial * 20000);
+    kill(child, SIGKILL);
+    while (read(fds[0], &reported, sizeof(reported)) == sizeof(reported))
+      synced = reported;
+    close(fds[0]);
+    waitpid(child, nullptr, 0);
+
+    // Exactly the first changes, and at least all of those reported durable
+    Persistence persistence(Base, Layout);
+    const uint32_t last = persistence.recovered_sequence();
+    state_t expected;
+    for (uint32_t i = 0 ; i < last ; ++i)
+    {
+      const auto [key, value] = change(seed + trial, i);
+      expected[key] = value;
+    }
+    exact &= synced <= last && recovered(persistence) == expected;
+    worst = std::max(worst, last - synced);
+  }
+  check(exact, "recovers a prefix, with everything reported durable");
+  std::cout << "  at most " << worst << " changes past the last report\n";
+}
+
+void test_manager()
+{
+  std::cout << "Manager\n";
+  const std::string base = "/tmp/tests-persistence-save.txt";
+  remove_files(base);
+  std::ofstream("/tmp/tests-persistence-setup.txt") << "ribbons_count 8\n";
+  std::ofstream("/tmp/tests-persistence-a.txt") << "bpm 1200\nblur_enable n\n";
+  std::ofstream("/tmp/tests-persistence-b.txt") << "bpm 1200\nblur_enable y\n";
+  std::ofstream(base) << "/tmp/tests-persistence-a.txt\n/tmp/tests-persistence-b.txt\n";
+
+  {
+    Manager manager(base.c_str(), "/tmp/tests-persistence-setup.txt");
+    Persistence persistence(base, manager.layout());
+    check(manager.attach(persistence).empty(), "nothing to restore");
+    manager.process_command("next_preset y");
+    manager.process_command("blur_enable y");
+    manager.process_command("module_length 42");
+  }
+  {
+    Manager manager(base.c_str(), "/tmp/tests-persistence-setup.txt");
+    Persistence persistence(base, manager.layout());
+    const auto restored = manager.attach(persistence);
+    bool values = restored.size() >= 3;
+    for (auto& [ctrl, force] : restored)
+    {
+      values &= force;
+      if (ctrl->name == "blur_enable")
+        values &= !ctrl->val.b;
+      if (ctrl->name == "module_length")
+        values &= ctrl->val.u == 42;
+    }
+    check(values, "live state restored");
+
+    // Saved from the persistence thread, into the recovered preset
+    manager.process_command("save y");
+  }
+  std::stringstream saved;
+  saved << std::ifstream("/tmp/tests-persistence-b.txt").rdbuf();
+  check(saved.str().find("blur_enable n\n") != std::string::npos && saved.str().find("bpm ") != std::string::npos, "preset saved");
+  check(access("/tmp/tests-persistence-b.txt.tmp", F_OK) != 0, "no temporary left");
+}
+
+void test_timing()
+{
+  std::cout << "Timing\n";
+  remove_files(Base);
+  const size_t count = 200000;
+  double worst = 0;
+  {
+    Persistence persistence(Base, Layout);
+    for (size_t i = 0 ; i < count ; )
+    {
+      const auto begin = std::chrono::steady_clock::now();
+      for (size_t k = 0 ; k < 1000 ; ++k, ++i)
+        while (!persistence.record(i % 400, i))
+          ;
+      worst = std::max(worst, std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() / 1000);
+      usleep(1000);
+    }
+    std::cout << "  " << persistence.summary() << '\n';
+  }
+  Persistence persistence(Base, Layout);
+  std::cout << "  record : " << worst * 1e9 << " ns at worst, recovery of " << count << " changes : "
+    << persistence.recovery_time() * 1e3 << " ms\n";
+  check(persistence.recovered_sequence() == count && persistence.recovered().size() == 400, "all recovered");
+  check(persistence.recovery_time() < 0.5, "recovery within milliseconds");
+}
+
+int main(int argc, char* const argv[])
+{
+  const uint32_t seed = argc >= 2 ? atoi(argv[1]) : 42;
+  test_restart();
+  test_torn();
+  test_crash(seed);
+  test_manager();
+  test_timing();
+  remove_files(Base);
+  std::cout << (failures ? "FAILED" : "PASSED") << '\n';
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,61 @@
+#include "controler/telemetry.hpp"
+
+#include <iostream>
+
+telemetry_t make_report(uint32_t sequence)
+{
+  telemetry_t report;
+  memset(&report, 0, sizeof(report));
+  report.magic = telemetry_t::Magic;
+  report.version = telemetry_t::Version;
+  report.phases_count = telemetry_t::PhasesCount;
+  report.sequence = sequence;
+  report.window_us = 2'000'000;
+  report.frames = 200;
+  report.phases[1] = { 1500, 4200, 2000 };
+  report.parser.crc_errors = 3;
+  return report;
+}
+
+std::string encode(const telemetry_t& report)
+{
+  uint8_t frame[telemetry::MaxEncodedSize];
+  const size_t len = telemetry::encode(report, frame);
+  return std::string((const char*)frame, len);
+}
+
+int main(int argc, char * const argv[])
+{
+  int errors = 0;
+  Telemetry telemetry;
+
+  // Text and reports mixed in the stream, report 2 is lost
+  std::string stream = "Boot message\n" + encode(make_report(0)) + "Written 3 bytes\n"
+    + encode(make_report(1)) + encode(make_report(3));
+
+  // Fed by small chunks, as they come from the socket
+  std::vector<std::string> texts;
+  for (size_t i = 0 ; i < stream.size() ; i += 7)
+    for (auto& text : telemetry.feed(stream.substr(i, 7)))
+      texts.push_back(text);
+
+  const auto snap = telemetry.snapshot();
+  if (!snap.valid || snap.reports != 3 || snap.lost_reports != 1 || snap.report.sequence != 3)
+  {
+    std::cout << "Bad snapshot : " << snap.reports << " reports, " << snap.lost_reports << " lost" << std::endl;
+    ++errors;
+  }
+  if (snap.report.phases[1].max != 4200 || snap.report.parser.crc_errors != 3)
+  {
+    std::cout << "Bad report content" << std::endl;
+    ++errors;
+  }
+  if (texts.size() != 2 || texts[0] != "Boot message\n" || texts[1] != "Written 3 bytes\n")
+  {
+    std::cout << "Bad texts : " << texts.size() << std::endl;
+    ++errors;
+  }
+
+  std::cout << telemetry.summary() << std::endl;
+  return errors ? 1 : 0;
+}
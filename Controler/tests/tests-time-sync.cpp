@@ -0,0 +1,226 @@
+#include "controler/time-sync.hpp"
+#include "controler/clock-tracker.hpp"
+#include "controler/telemetry.hpp"
+#include "controler/arduino-bridge.hpp"
+#include "driver/protocol.h"
+#include "driver/state.h"
+#include "driver/clock.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+/**
+ * Driver emulator over loopback : measures how far the emulated driver master
+ * clock is from the controller's tracked bar, once the time sync has settled.
+ *
+ * The emulated driver clock runs 'DriverSkew' fast with an arbitrary offset,
+ * renders for 'ComputeUs' then reads its input until the end of each 10ms frame,
+ * as driver.ino does. Usage : tests-time-sync [seconds]
+ */
+
+using clock_type = std::chrono::steady_clock;
+
+static constexpr double   Bpm = 128;
+static constexpr double   DriverSkew = 100e-6;
+static constexpr uint32_t DriverOffset = 0x9E3779B9;
+static constexpr uint32_t FrameUs = 10000;
+static constexpr uint32_t ComputeUs = 6000;
+
+static const clock_type::time_point start = clock_type::now();
+
+uint64_t host_us()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - start).count();
+}
+uint32_t driver_us(uint64_t host)
+{
+  return uint32_t(uint64_t(host * (1. + DriverSkew))) + DriverOffset;
+}
+
+/// Tracked bar phase at a host time, in master cycles
+double truth(uint64_t host)
+{
+  return host * 1e-6 * Bpm / 60. / TempoFollower::BeatsPerMasterCycle;
+}
+
+struct emulator_t
+{
+  int client = -1;
+  state_t state{};
+  timesync::PhaseLock lock;
+  Clock master;
+
+  std::vector<double> errors_ms; ///!< Phase error of each frame
+  std::vector<uint64_t> times;
+
+  // Parser sink, as driver.ino
+  size_t size() const { return sizeof(state_t); }
+  void write(size_t addr, const uint8_t* data, size_t size) { memcpy(((uint8_t*)&state) + addr, data, size); }
+  void end_frame() {}
+  void control(uint16_t marker, const uint8_t* data, size_t size)
+  {
+    if (marker == protocol::TimePing)
+    {
+      timesync::echo_t echo{ timesync::echo_t::Magic, timesync::echo_t::Version, 0, 0, 0, 0 };
+      memcpy(&echo.t1, data, sizeof(echo.t1));
+      echo.t2 = driver_us(host_us());
+      uint8_t frame[timesync::MaxEncodedSize];
+      echo.t3 = driver_us(host_us());
+      if (write_all(frame, timesync::encode(echo, frame)) < 0)
+        perror("echo");
+    }
+    else if (marker == protocol::PhaseAnchor)
+    {
+      timesync::anchor_t anchor;
+      memcpy(&anchor, data, sizeof(anchor));
+      lock.set(anchor);
+    }
+  }
+
+  ssize_t write_all(const uint8_t* data, size_t len) { return send(client, data, len, MSG_NOSIGNAL); }
+
+  void run(std::atomic<bool>& running)
+  {
+    protocol::Parser parser;
+    uint8_t buffer[1024];
+    uint64_t deadline = host_us();
+    while (running)
+    {
+      // Frame : clocks, then rendering, then input until the deadline
+      deadline += FrameUs;
+      const uint64_t now = host_us();
+      const uint32_t bpm = fixed::uq16_16::from_raw(state.master.bpm).as<uint32_t, 8>().raw;
+      if (bpm)
+      {
+        master.setPeriod(1 + ((60lu * 1000lu * 100lu / 2) << 8) / (bpm + fixed::uq24_8::One));
+        master.tick(lock.time_ms(driver_us(now) / 1000));
+        lock.update(driver_us(now), master.clock << 3, master._dt << 3);
+
+        double error = double(master.clock << 3) / 4294967296. - truth(now);
+        error -= std::round(error);
+        errors_ms.push_back(error * TempoFollower::BeatsPerMasterCycle * 60000. / Bpm);
+        times.push_back(now);
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(ComputeUs));
+      while (host_us() < deadline)
+      {
+        const ssize_t nread = recv(client, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (0 < nread)
+          parser.feed(buffer, nread, *this);
+        else
+          std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+    }
+  }
+};
+
+int main(int argc, char * const argv[])
+{
+  const double duration = argc == 2 ? atof(argv[1]) : 20.;
+
+  int server = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  socklen_t addrlen = sizeof(addr);
+  if (bind(server, (sockaddr*)&addr, sizeof(addr)) || listen(server, 1) || getsockname(server, (sockaddr*)&addr, &addrlen))
+  {
+    perror("emulator");
+    return 1;
+  }
+  const std::string port = std::to_string(ntohs(addr.sin_port));
+
+  std::atomic<bool> running{true};
+  emulator_t emulator;
+  std::thread driver([&]() {
+    emulator.client = accept(server, nullptr, nullptr);
+    emulator.run(running);
+    close(emulator.client);
+  });
+
+  ArduinoBridge bridge("127.0.0.1", port.c_str());
+  Telemetry telemetry;
+  TimeSync sync;
+  ClockTracker tracker;
+  TempoFollower follower;
+  const size_t bpm_addr = offsetof(state_t, master) + offsetof(state_t::master_t, bpm);
+
+  std::future<std::optional<std::string>> input;
+  tracker.process({ clock_event_t::START, host_us() * 1e-6 });
+  uint64_t ticks = 0;
+  while (host_us() < duration * 1e6)
+  {
+    // Midi clock at the exact tempo, starting on the first bar
+    const uint64_t now = host_us();
+    while (ticks * 60e6 / (Bpm * ClockTracker::TicksPerBeat) <= now)
+      tracker.process({ clock_event_t::TICK, ticks++ * 60. / (Bpm * ClockTracker::TicksPerBeat) });
+
+    if (!input.valid())
+      input = std::async(std::launch::async, [&]() { return bridge.receive(); });
+    else if (input.wait_for(std::chrono::microseconds(100)) == std::future_status::ready)
+    {
+      const uint64_t received = host_us();
+      if (auto bytes = input.get())
+        telemetry.feed(bytes.value());
+      for (auto& echo : telemetry.take_echoes())
+        sync.on_echo(echo, received);
+    }
+
+    if (sync.ping_due(now))
+      bridge.send_ping([]() { return uint32_t(host_us()); });
+
+    auto update = follower.update(tracker, now * 1e-6, &sync);
+    if (update.bpm)
+    {
+      const uint32_t raw = fixed::uq16_16::from_float(update.bpm.value()).raw;
+      std::vector<uint8_t> msg{ uint8_t(bpm_addr >> 8), uint8_t(bpm_addr & 0xFF), sizeof(raw) };
+      msg.insert(msg.end(), (const uint8_t*)&raw, (const uint8_t*)&raw + sizeof(raw));
+      bridge.send(bpm_addr, msg);
+    }
+    if (update.anchor)
+      bridge.send(protocol::PhaseAnchor, to_raw_message(update.anchor.value()));
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  running = false;
+  driver.join();
+  bridge.kill();
+  shutdown(emulator.client, SHUT_RDWR);
+  close(server);
+
+  // Estimate against the emulated clock
+  const uint64_t now = host_us();
+  const int32_t offset_error = int32_t(sync.to_driver(now) - driver_us(now));
+
+  // Residual phase error over the second half, the first one holds the lock
+  double sum = 0, worst = 0;
+  size_t count = 0;
+  for (size_t i = 0 ; i < emulator.errors_ms.size() ; ++i)
+    if (duration * 1e6 / 2 <= emulator.times[i])
+    {
+      sum += emulator.errors_ms[i] * emulator.errors_ms[i];
+      worst = std::max(worst, std::abs(emulator.errors_ms[i]));
+      count++;
+    }
+  const double rms = count ? std::sqrt(sum / count) : 1e9;
+
+  std::cout << sync.summary() << ", offset error " << offset_error << "us (true skew " << DriverSkew * 1e6 << "ppm)" << std::endl;
+  std::cout << "Phase error : " << rms << "ms rms, " << worst << "ms max over " << count << " frames, "
+    << emulator.lock.anchors << " anchors, " << emulator.lock.jumps << " jumps" << std::endl;
+
+  // Clocks tick by whole milliseconds
+  const bool ok = count && rms < 2. && worst < 5. && std::abs(offset_error) < 1000;
+  return ok ? 0 : 1;
+}
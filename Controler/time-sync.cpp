@@ -0,0 +1,110 @@
+#include "time-sync.hpp"
+
+#include <cmath>
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+
+bool TimeSync::ping_due(uint64_t now)
+{
+  if (now - last_ping < next_ping)
+    return false;
+  last_ping = now;
+  // Between 3/4 and 5/4 of the interval
+  const uint64_t interval = is_synced() ? PingInterval : FastPingInterval;
+  next_ping = interval * 3 / 4 + dither() % (interval / 2);
+  return true;
+}
+
+void TimeSync::on_echo(const timesync::echo_t& echo, uint64_t received)
+{
+  // Only the low 32 bits of the ping time went through the driver
+  const uint64_t sent = received - uint32_t(uint32_t(received) - echo.t1);
+  const uint32_t round_trip = received - sent;
+  const uint32_t processing = echo.t3 - echo.t2;
+  if (round_trip < processing || MaxDelay < round_trip - processing)
+    return;
+  const uint32_t delay = round_trip - processing;
+
+  // Driver time - host time, the driver received the ping half a delay after it was sent
+  const uint32_t raw = echo.t2 - uint32_t(sent) - delay / 2;
+  if (!has_base)
+  {
+    base = raw;
+    has_base = true;
+  }
+  samples.push_back(sample_t{ sent + round_trip / 2, int32_t(raw - base), delay });
+  if (HistorySize < samples.size())
+    samples.pop_front();
+  fit();
+}
+
+uint32_t TimeSync::min_delay() const
+{
+  uint32_t result = UINT32_MAX;
+  for (auto& sample : samples)
+    result = std::min(result, sample.delay);
+  return result;
+}
+
+void TimeSync::fit()
+{
+  // Samples close to the shortest round trip only
+  const uint32_t threshold = 2 * min_delay() + 100;
+  std::vector<const sample_t*> good;
+  for (auto& sample : samples)
+    if (sample.delay <= threshold)
+      good.push_back(&sample);
+
+  reference = good.back()->time;
+  if (good.size() < 2 || good.back()->time - good.front()->time < MinSkewSpan)
+  {
+    // Not enough history for the skew : the best of the last samples
+    const sample_t* best = &samples.back();
+    for (size_t i = samples.size() > RecentSamples ? samples.size() - RecentSamples : 0 ; i < samples.size() ; ++i)
+      if (samples[i].delay <= best->delay)
+        best = &samples[i];
+    intercept = best->offset + skew * (double(reference) - double(best->time));
+    return;
+  }
+
+  // Least squares, times relative to the reference
+  double st = 0, so = 0, stt = 0, sto = 0;
+  for (auto* sample : good)
+  {
+    const double t = double(sample->time) - double(reference);
+    st += t;
+    so += sample->offset;
+    stt += t * t;
+    sto += t * sample->offset;
+  }
+  const double n = good.size();
+  const double det = n * stt - st * st;
+  skew = det != 0 ? (n * sto - st * so) / det : 0;
+  intercept = (so - skew * st) / n;
+}
+
+uint32_t TimeSync::to_driver(uint64_t host) const
+{
+  const double offset = intercept + skew * (double(host) - double(reference));
+  return uint32_t(host) + base + uint32_t(int64_t(std::llround(offset)));
+}
+
+std::string TimeSync::summary() const
+{
+  char tmp[256];
+  if (!is_synced())
+    snprintf(tmp, sizeof(tmp), "Time sync : %zu samples", samples.size());
+  else
+    snprintf(tmp, sizeof(tmp), "Time sync : %zu samples, min round trip %uus, skew %.1fppm",
+      samples.size(), min_delay(), skew_ppm());
+  return std::string(tmp);
+}
+
+std::vector<uint8_t> to_raw_message(const timesync::anchor_t& anchor)
+{
+  std::vector<uint8_t> msg{ uint8_t(protocol::PhaseAnchor >> 8), uint8_t(protocol::PhaseAnchor & 0xFF), sizeof(anchor) };
+  const uint8_t* data = (const uint8_t*)&anchor;
+  msg.insert(msg.end(), data, data + sizeof(anchor));
+  return msg;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "../driver/timesync.h"
+
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Estimates the driver clock from the ping echoes (see Driver/timesync.h).
+ *
+ * Samples with the shortest round trips are the least delayed by queues on both
+ * sides, only those close to the minimum are kept. Once they span long enough,
+ * a line is fitted through them so the crystals drift (skew) is followed between pings.
+ * Ping intervals are dithered, so pings don't keep landing at the same point of the driver frame.
+ * Host times are microseconds of the caller's clock, the one the echoes are stamped with.
+ */
+class TimeSync {
+public:
+
+  static constexpr uint64_t FastPingInterval = 250'000; ///!< Until synced
+  static constexpr uint64_t PingInterval = 1'000'000;
+  static constexpr uint32_t MaxDelay = 200'000;         ///!< Longer round trips are dropped
+  static constexpr size_t   HistorySize = 64;
+  static constexpr size_t   RecentSamples = 8;      ///!< Used until the skew is known
+  static constexpr size_t   MinSamples = 4;
+  static constexpr uint64_t MinSkewSpan = 5'000'000;    ///!< Samples span needed to fit the skew
+
+  /// Returns true when a ping should be sent
+  bool ping_due(uint64_t now);
+
+  /// 'received' is the host time the echo arrived at
+  void on_echo(const timesync::echo_t& echo, uint64_t received);
+
+  bool is_synced() const { return MinSamples <= samples.size(); }
+
+  /// Driver time at a host time
+  uint32_t to_driver(uint64_t host) const;
+
+  uint32_t min_delay() const;
+  double skew_ppm() const { return skew * 1e6; }
+
+  /// One line summary of the estimate
+  std::string summary() const;
+
+private:
+
+  struct sample_t
+  {
+    uint64_t time;   ///!< Host time, middle of the round trip
+    int64_t  offset; ///!< Driver time - host time, relative to 'base'
+    uint32_t delay;  ///!< Round trip, without the driver processing
+  };
+
+  std::deque<sample_t> samples;
+  uint64_t last_ping = 0;
+  uint64_t next_ping = 0;  ///!< Dithered interval to the next ping
+  std::minstd_rand dither;
+  bool     has_base = false;
+  uint32_t base = 0;       ///!< First raw offset, to unwrap the following ones
+
+  // offset(t) = intercept + skew * (t - reference)
+  uint64_t reference = 0;
+  double   intercept = 0;
+  double   skew = 0;
+
+  void fit();
+};
+
+/// Anchor record for ArduinoBridge::send, as control_t::to_raw_message
+std::vector<uint8_t> to_raw_message(const timesync::anchor_t& anchor);
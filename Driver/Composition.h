@@ -11,14 +11,14 @@ struct Composition {
     Mask mask;
     Slicer slicer;
 
-    CRGB eval(const ColorPalette& palette,
-              uint8_t time,
+    /// Time only acts through the modulations folded in the controllers
+    CRGB eval(const PaletteLUT& palette,
               uint32_t position_in_ribbon,
               uint32_t ribbon_size) const
     {
         const uint8_t rel_pos = slicer.map_ribbon_to_slice(position_in_ribbon, ribbon_size);
-        return mask.should_hide(rel_pos) ? CRGB::Black : ::eval(palette,
+        return mask.should_hide(rel_pos) ? CRGB::Black : palette[
             position_in_palette(palette_range_ctrl.range(), rel_pos)
-        );
+        ];
     }
 };
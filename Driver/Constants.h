@@ -5,3 +5,6 @@
 static constexpr uint32_t MaxLedsPerRibbon = 30 * 8;
 static constexpr uint32_t MaxRibbonsCount = 8;
 static constexpr uint32_t MaxLedsCount = MaxRibbonsCount * MaxLedsPerRibbon;
+
+/// Leds per module when the setup doesn't specify it
+static constexpr uint32_t DefaultModuleLength = 30;
@@ -1,5 +1,8 @@
 #pragma once
 
+#include "noise.h"
+#include "state.h"
+
 enum class OscillatorKind {
     Sin,
     Triangle,
@@ -12,17 +15,23 @@ OscillatorKind map_to_oscillator_kind(uint8_t x)
   return static_cast<OscillatorKind>((x * (int)4) / 255);
 }
 
-uint8_t eval_oscillator(OscillatorKind oscillator, uint8_t x)
+/// 'seed' is only used by the Noise oscillator, see noise::seed()
+uint8_t eval_oscillator(OscillatorKind oscillator, uint8_t x, uint32_t seed = 0)
 {
-  uint8_t tmp;
   switch (oscillator)
   {    
     case OscillatorKind::Sin:      return sin8(x);
     case OscillatorKind::SawTooth: return x;
     case OscillatorKind::Triangle: return triwave8(x);
-    case OscillatorKind::Noise:   
-      tmp = random8();
-      return random8() ^ ((tmp << 4) | (tmp >> 4));
+    case OscillatorKind::Noise:    return noise::eval8(seed, 0);
     default:                       return 0;
   }
 }
+
+/// Modulation source of a preset : the oscillator, or an audio band energy when 'band' is set (see state_t::audio_t)
+uint8_t eval_modulation(OscillatorKind oscillator, uint8_t band, uint8_t x, uint32_t seed, const state_t::audio_t& audio)
+{
+  if (band)
+    return audio.bands[(band < AUDIO_BANDS_COUNT ? band : AUDIO_BANDS_COUNT) - 1];
+  return eval_oscillator(oscillator, x, seed);
+}
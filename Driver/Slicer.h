@@ -13,8 +13,9 @@ struct Slicer
     uint8_t map_ribbon_to_slice(uint32_t pos_in_ribbon, uint32_t ribbon_size) const {
         if (!use_uneven_slices) {
             const uint32_t slice_size = ribbon_size / slices_count;
-            const uint8_t pos8 = map_32_to_8(pos_in_ribbon % slice_size, slice_size);
-            return maybe_flip(pos8, pos_in_ribbon / slice_size);
+            const uint32_t slice = pos_in_ribbon / slice_size;
+            const uint8_t pos8 = map_32_to_8(pos_in_ribbon - slice * slice_size, slice_size);
+            return maybe_flip(pos8, slice);
         }
         else {
             const uint8_t p = map_32_to_8(pos_in_ribbon, ribbon_size);
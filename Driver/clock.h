@@ -1,5 +1,7 @@
 #pragma once
 
+#include "fixed_point.h"
+
 template <typename T, uint8_t _Size>
 struct Instanced
 {
@@ -14,11 +16,12 @@ template <typename T, uint8_t _Size>  T* Instanced<T, _Size>::_instances[_Size];
 
 struct Clock : public Instanced<Clock, 16>
 {
-  uint32_t clock = 0;
+  uint32_t clock = 0;         ///!< UQ0.32 phase, one turn every 8 periods
+
   uint32_t period = 0;
   uint32_t last_timestamp = 0;
 
-  uint32_t _dt;
+  uint32_t _dt;               ///!< UQ0.32 phase increment per millisecond
 
   void tick(uint32_t timestamp)
   {
@@ -29,11 +32,12 @@ struct Clock : public Instanced<Clock, 16>
   void setPeriod(uint32_t period)
   {
     this->period = period << 3;
-    _dt = 0xFFFFFFFFu / (((period) << 3) +1);
+    _dt = fixed::recip32((period << 3) + 1);
   }
 
-  uint8_t get8(uint8_t exp = 0) const { return ((clock & (0xFFFFFFFFu >> (3 - exp))) << (3 - exp)) >> 24; }
-  uint16_t get16(uint8_t exp = 0) const { return ((clock & (0xFFFFFFFFu >> (3 - exp))) << (3 - exp)) >> 16; }
+  /// Phase of a period scaled by 2^exp, the overflowing turns are shifted out
+  uint8_t get8(uint8_t exp = 0) const { return fixed::hi8(clock << (3 - exp)); }
+  uint16_t get16(uint8_t exp = 0) const { return fixed::hi16(clock << (3 - exp)); }
 
   static void Tick(uint32_t time) {
     for (uint8_t i = 0 ; i < _index ; ++i)
@@ -45,6 +49,7 @@ struct FallDetector : public Instanced<FallDetector, 16>
 {
   Clock* clock = nullptr;
   uint16_t last_value = 0;
+  uint32_t count = 0; ///!< Number of falls since boot
   bool trigger = false;
   
   void tick()
@@ -53,7 +58,10 @@ struct FallDetector : public Instanced<FallDetector, 16>
     if (trigger == true)
       trigger = false;
     if (time < last_value)
+    {
       trigger = true;
+      count++;
+    }
     last_value = time;
   }
 
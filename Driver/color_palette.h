@@ -1,6 +1,7 @@
 #pragma once
 
 #include "state.h"
+#include "fixed_point.h"
 
 #include <FastLED.h>
 
@@ -21,11 +22,48 @@ inline ColorPalette lerp_palette(const ColorPalette& A, const ColorPalette& B, u
   return res;
 }
 
+/// Linear palette value, gamma is applied by the TransferLUT
 inline uint8_t eval(const ColorPalette::params_t& p, uint8_t t)
 {
-  return dim8_video(map8(cos8(p.frequency_times_60 * t / 60 + p.phase), p.min_value, p.max_value));
+  return map8(cos8(fixed::div_by<60>(p.frequency_times_60 * t) + p.phase), p.min_value, p.max_value);
 }
 inline CRGB eval(const ColorPalette& p, uint8_t t)
 {
   return { eval(p.params[0], t), eval(p.params[1], t), eval(p.params[2], t) };
 }
+
+/// Palette sampled on its 256 positions,
+///   built once per preset per frame so each pixel only costs a lookup
+struct PaletteLUT
+{
+  CRGB colors[256];
+
+  void build(const ColorPalette& p)
+  {
+    for (uint16_t t = 0 ; t < 256 ; ++t)
+      colors[t] = eval(p, t);
+  }
+
+  const CRGB& operator[] (uint8_t t) const { return colors[t]; }
+};
+
+/// Output transfer stage : gamma, preset brightness and master level folded in one table
+///   rebuilt only when the level changes, each pixel then costs one lookup per channel
+struct TransferLUT
+{
+  uint8_t table[256];
+  uint8_t level = 0;
+  bool is_valid = false;
+
+  void build(uint8_t level)
+  {
+    if (is_valid && level == this->level)
+      return;
+    for (uint16_t x = 0 ; x < 256 ; ++x)
+      table[x] = scale8_video(dim8_video(x), level);
+    this->level = level;
+    is_valid = true;
+  }
+
+  CRGB operator() (const CRGB& c) const { return CRGB(table[c.r], table[c.g], table[c.b]); }
+};
@@ -5,6 +5,15 @@
 #include "math.h"
 #include "Composition.h"
 #include "state.h"
+#include "topology.h"
+#include "effects.h"
+#include "lfo.h"
+#include "scheduler.h"
+#include "protocol.h"
+#include "telemetry.h"
+#include "shadow.h"
+#include "timesync.h"
+#include "quantize.h"
 
 #ifdef ARDUINO_SAM_DUE
 #else // ifdef ARDUINO_SAM_DUE
@@ -25,7 +34,6 @@
  * 
  * Fix color blending when computing leds colors
  * Fix colopalettes
- * Add continuous blending between palettes instead of hard transitions
  * 
  * Reintroduce sync correction
  * Evaluate time with 16 bits instead of 8
@@ -41,49 +49,234 @@
  *  Rework colormodulation controls ??
  */
 
-#define SerialUSB_MESSAGE_TIMEOUT 1
-#define SerialUSB_SLEEP_TIMEOUT 0
-#define FRAME_REFRESH_TIMEOUT 0
+// Target frame period, the scheduler stretches it up to the max period when compute doesn't fit
+#define FRAME_PERIOD_US 10000
+#define FRAME_MAX_PERIOD_US 40000
+// Strobe periods and feedback decay were tuned in frames of the former 50 fps pacing, they are timed on it
+#define EFFECTS_FRAME_MS 20
+// Period of the text status message, when the binary telemetry is disabled
+#define STATUS_PERIOD_US 2000000
+
+// Render ribbons through the opto::Effect chain instead of the inlined loop
+#define USE_EFFECT_CHAIN 0
+// Print the cost of both render paths at boot
+// #define BENCHMARK_EFFECT_CHAIN
+// Print the cost of the fixed point LFO bank against the float LFOs at boot
+// #define BENCHMARK_LFO_BANK
 
 using color_t = CRGB;
 using index_t = uint32_t;
 using coef_t = float;
 
 color_t leds[MaxLedsCount];
+CLEDController* leds_controller = nullptr;
+Topology topology;
 
 Clock master_clock;
 Clock osc_clocks[PRESETS_COUNT];
+RibbonSync osc_syncs[PRESETS_COUNT]; ///!< The preset clocks, as seen by the effect chains
+RibbonTime osc_times[PRESETS_COUNT]; ///!< The preset clocks shifted by the sync correction
+opto::SyncGraph<uint32_t, PRESETS_COUNT> ribbon_graph; ///!< Samples 'osc_times' once per frame, node i is preset i
 FallDetector beat_detectors[PRESETS_COUNT];
-uint8_t holded_values[PRESETS_COUNT][MaxRibbonsCount][2];
 
-FastClock strobe_clock;
+PaletteLUT palette_lut;
+TransferLUT output_lut;
+
+Clock strobe_clock;
+FallDetector strobe_detector;
 uint8_t coarse_framerate;
 
+FrameScheduler scheduler(FRAME_PERIOD_US, FRAME_MAX_PERIOD_US);
+
 bool connection_lost = false;
 
 state_t global;
+protocol::Parser controller_parser;
+ShadowState<state_t> shadow_state; ///!< Receives the controller writes until the next frame
+timesync::PhaseLock phase_lock;    ///!< Keeps the clocks on the controller phase anchors
+quantize::PendingQueue<> pending_writes; ///!< Quantized transactions waiting for their beat
+
+/// Parser output : writes go to the shadow state, or wait for their beat, clock sync markers are handled at once
+struct controller_sink_t
+{
+  size_t size() const { return shadow_state.size(); }
+  void write(size_t addr, const uint8_t* data, size_t size)
+  {
+    if (!pending_writes.write(addr, data, size))
+      shadow_state.write(addr, data, size);
+  }
+  void end_frame() { shadow_state.end_frame(); }
+
+  void control(uint16_t marker, const uint8_t* data, size_t size)
+  {
+    if (marker == protocol::TimePing)
+    {
+      timesync::echo_t echo;
+      echo.magic = timesync::echo_t::Magic;
+      echo.version = timesync::echo_t::Version;
+      echo.reserved = 0;
+      memcpy(&echo.t1, data, sizeof(echo.t1));
+      echo.t2 = micros();
+      uint8_t frame[timesync::MaxEncodedSize];
+      echo.t3 = micros();
+      SERIAL.write(frame, timesync::encode(echo, frame));
+    }
+    else if (marker == protocol::PhaseAnchor)
+    {
+      timesync::anchor_t anchor;
+      memcpy(&anchor, data, sizeof(anchor));
+      phase_lock.set(anchor);
+    }
+    else if (marker == protocol::Quantize)
+    {
+      // Only the writes of a transaction are held, an unknown preset is applied on the next frame
+      if (!shadow_state.in_transaction)
+        return;
+      quantize::target_t target;
+      memcpy(&target, data, sizeof(target));
+      if (target.mode == quantize::PresetFall && target.preset < PRESETS_COUNT)
+        pending_writes.begin(target, beat_detectors[target.preset].count);
+      else
+      {
+        if (target.mode != quantize::MasterPhase)
+          target = quantize::target_t{ quantize::MasterPhase, 0, 0, master_clock.clock << 3 };
+        pending_writes.begin(target, master_clock.clock << 3);
+      }
+    }
+    else
+    {
+      if (marker == protocol::BeginTransaction || marker == protocol::Commit)
+        pending_writes.close();
+      shadow_state.control(marker, data, size);
+    }
+  }
+} controller_sink;
 
 void setup()
 {
   SERIAL.begin(115200);
 
-  FastLED.addLeds<WS2811_PORTD, MaxRibbonsCount>(leds, MaxLedsPerRibbon);
+  leds_controller = &FastLED.addLeds<WS2811_PORTD, MaxRibbonsCount>(leds, MaxLedsPerRibbon);
   
   FastLED.setMaxPowerInVoltsAndMilliamps(5, 10000);
-  FastLED.setMaxRefreshRate(50);
+  // Frames are paced by the scheduler
+  FastLED.setMaxRefreshRate(0);
 
   for (size_t i=0 ; i<PRESETS_COUNT ; ++i)
   {
     beat_detectors[i].clock = osc_clocks + i;
+    osc_syncs[i] = clock_sync(osc_clocks[i]);
+    osc_times[i] = ribbon_time(osc_syncs[i], 0);
+    ribbon_graph.add(osc_times + i);
   }
+  strobe_detector.clock = &strobe_clock;
+
+  // Historical wiring : last port drives the solo ribbon
+  global.setup.solo_ribbon = MaxRibbonsCount - 1;
+  shadow_state.reset(global);
+
+#ifdef BENCHMARK_EFFECT_CHAIN
+  benchmark_effect_chain();
+#endif
+#ifdef BENCHMARK_LFO_BANK
+  benchmark_lfo_bank();
+#endif
 
   FastLED.delay(1000);
 }
 
+#ifdef BENCHMARK_EFFECT_CHAIN
+void benchmark_effect_chain()
+{
+  static constexpr uint16_t iterations = 100;
+  const uint16_t length = MaxLedsPerRibbon;
+
+  palette_lut.build(global.palettes[0]);
+  output_lut.build(255);
+  const Composition compo{
+    PaletteRangeController{ 128, 255 },
+    Mask{ 128, 64, true, true },
+    Slicer{ 4, 128, true, false },
+  };
+
+  unsigned long begin = micros();
+  for (uint16_t n = 0 ; n < iterations ; ++n)
+    for (uint16_t i = 0 ; i < length ; ++i)
+    {
+      CRGB c = output_lut(compo.eval(palette_lut, i, length));
+      CRGB o = leds[i];
+      leds[i] = CRGB(max8(c.r, o.r), max8(c.g, o.g), max8(c.b, o.b));
+    }
+  unsigned long inlined = micros() - begin;
+
+  const composition_params_t params{compo, &palette_lut, &output_lut, 1};
+  const RibbonEffect::node_t chain[] = { {composition_effect, &params} };
+  begin = micros();
+  for (uint16_t n = 0 ; n < iterations ; ++n)
+    RibbonEffect::run(make_ribbon_datas(leds, length, 0, 1, ribbon_graph, 0), chain, chain + 1);
+  unsigned long chained = micros() - begin;
+
+  SERIAL.print("Inlined composition : ");
+  SERIAL.print(inlined / iterations);
+  SERIAL.print(" us : Effect chain : ");
+  SERIAL.print(chained / iterations);
+  SERIAL.println(" us");
+}
+#endif
+
+#ifdef BENCHMARK_LFO_BANK
+void benchmark_lfo_bank()
+{
+  static constexpr uint16_t iterations = 100;
+  static constexpr uint8_t lfos_count = 32;
+  using Bank = opto::LFOBank<lfos_count>;
+
+  Bank bank;
+  opto::LFO<float> lfos[lfos_count];
+  for (uint8_t i = 0 ; i < lfos_count ; ++i)
+  {
+    const Bank::WaveForm w = static_cast<Bank::WaveForm>(i % Bank::WaveForm::Count);
+    bank.add(w, 0x8000, 3);
+    lfos[i].tfunc = opto::LFO<float>::castWaveform(w);
+    lfos[i].param1 = 0.5f;
+    lfos[i].param2 = 3.f;
+  }
+
+  volatile float sink = 0;
+  unsigned long begin = micros();
+  for (uint16_t n = 0 ; n < iterations ; ++n)
+    for (uint8_t i = 0 ; i < lfos_count ; ++i)
+      sink = lfos[i].eval(float(n) / iterations);
+  unsigned long floats = micros() - begin;
+
+  begin = micros();
+  for (uint16_t n = 0 ; n < iterations ; ++n)
+  {
+    for (uint8_t i = 0 ; i < lfos_count ; ++i)
+      bank.phase[i] = (uint32_t(n) << 16) / iterations;
+    bank.eval();
+  }
+  unsigned long fixed = micros() - begin;
+
+  SERIAL.print("Float LFOs : ");
+  SERIAL.print(floats / iterations);
+  SERIAL.print(" us : LFO bank : ");
+  SERIAL.print(fixed / iterations);
+  SERIAL.print(" us for ");
+  SERIAL.print(lfos_count);
+  SERIAL.println(" LFOs");
+}
+#endif
+
 void update_clocks()
 {
-  master_clock.setPeriod(1 + ((60lu * 1000lu * 100lu) / ((global.master.bpm + 1) * 2)));
-  strobe_clock.setPeriod(max8(2, scale8(10, 255 - (global.master.strobe_speed << 1))));
+  // bpm is UQ16.16, narrowed to UQ24.8 so the division fits in 32 bits
+  // 'One' is wide (it does not fit in 'Raw' for pure fractions), keep it from promoting the division to 64 bits
+  const uint32_t bpm = fixed::uq16_16::from_raw(global.master.bpm).as<uint32_t, 8>().raw;
+  const uint32_t one = fixed::uq24_8::One;
+  static_assert(sizeof(bpm + one) == 4, "period division must stay 32 bits");
+  master_clock.setPeriod(1 + (uint32_t(60lu * 1000lu * 100lu / 2) << 8) / (bpm + one));
+  strobe_clock.setPeriod(EFFECTS_FRAME_MS * max8(2, scale8(10, 255 - (global.master.strobe_speed << 1))));
 
   for (size_t i=0 ; i<PRESETS_COUNT ; ++i)
   {
@@ -98,28 +291,55 @@ void update_clocks()
     osc_clocks[i].setPeriod(clockperiod);
   }
 
-  Clock::Tick(millis());
-  FastClock::Tick();
+  // Clocks run on the driver time shifted toward the controller phase anchors
+  Clock::Tick(phase_lock.time_ms(millis()));
+  phase_lock.update(micros(), master_clock.clock << 3, master_clock._dt << 3);
   FallDetector::Tick();
+
+  for (size_t i=0 ; i<PRESETS_COUNT ; ++i)
+    osc_times[i].phase = ribbon_time(osc_syncs[i], global.master.sync_correction).phase;
+  ribbon_graph.tick();
 }
 
 void loop()
 {
-    // Receive new datas from SerialUSB
+    // Receive new datas from SerialUSB until the next frame is due
     static unsigned long drop_count = 0;
-    
-    unsigned long update_begin = millis();
-    drop_count += read_from_controller();
-    unsigned long update_end = millis();
 
-    // Compute next frame  
-    unsigned long compute_begin = millis();
+    uint32_t input_us = 0;
+    do
+    {
+      if (0 < SERIAL.available())
+      {
+        const uint32_t input_begin = micros();
+        drop_count += read_from_controller();
+        input_us += micros() - input_begin;
+      }
+    } while (!scheduler.is_due(micros()));
+
+    // Compute next frame
+    const uint32_t compute_begin = micros();
+    scheduler.begin_frame(compute_begin);
+    scheduler.record(FrameScheduler::INPUT, input_us);
+
+    // Received writes become visible all at once, at the frame boundary
+    shadow_state.commit(global);
 
     update_clocks();
-    
+
+    // Quantized writes show on the frame crossing their beat
+    pending_writes.release(master_clock.clock << 3,
+      [](uint8_t preset) { return beat_detectors[preset].count; },
+      [](size_t addr, const uint8_t* data, size_t size) { shadow_state.apply(global, addr, data, size); });
+
+    // Repack leds when the setup changes, the parallel output then only sends used leds
+    if (topology.update(global))
+    {
+      fill_solid(leds, MaxLedsCount, CRGB::Black);
+      leds_controller->setLeds(leds, topology.port_stride);
+    }
 
     uint8_t feedback_per_group[3] = { 0 };
-    const uint8_t ribbons_count = global.setup.ribbons_count;
 
     // Firt reset the ribbon according to fade out
     for (uint8_t preset_index = 0 ; preset_index < 8 ; ++preset_index)
@@ -137,18 +357,29 @@ void loop()
           feedback_per_group[preset_group] = max8(feedback_per_group[preset_group], preset.feedback_qty << 1);
       }
     }
-    for (uint8_t ribbon = 0 ; ribbon < ribbons_count ; ++ribbon)
+    // The trails keep (feedback + 1) / 256 every EFFECTS_FRAME_MS, as 'fadeToBlackBy(255 - feedback)'
+    //  did once per frame at 50 fps. Below 1/256 per frame, the fade is carried to the next frames
+    static uint32_t feedback_residue = 0;
+    const uint32_t feedback_fade = 0x10000 + feedback_residue
+      - decay_for_elapsed(uint32_t(feedback_per_group[0] + 1) << 8, scheduler.elapsed, EFFECTS_FRAME_MS * 1000, FRAME_MAX_PERIOD_US);
+    feedback_residue = feedback_fade & 0xFF;
+    const uint8_t feedback_fade8 = 0xFFFF < feedback_fade ? 255 : feedback_fade >> 8;
+    for (uint8_t ribbon = 0 ; ribbon < topology.segments_count ; ++ribbon)
     {
       uint8_t feedback = feedback_per_group[0];//Global.ribbons[ribbon].group];
-      uint32_t ribbon_length = 30 * global.setup.ribbons_lengths[ribbon];
-      CRGB* ribbon_ptr = leds + ribbon * MaxLedsPerRibbon;
+      uint32_t ribbon_length = topology.segments[ribbon].length;
+      CRGB* ribbon_ptr = leds + topology.segments[ribbon].offset;
       
       if (feedback == 0)
         fill_solid(ribbon_ptr, ribbon_length, CRGB::Black);
       else
-        fadeToBlackBy(ribbon_ptr, ribbon_length, 255 - feedback);
+        fadeToBlackBy(ribbon_ptr, ribbon_length, feedback_fade8);
     }
 
+    // Flashes on the first frame of each period, and as long as a frame of the former pacing
+    const uint32_t strobe_ms = (uint32_t(strobe_clock.get16()) * (strobe_clock.period >> 3)) >> 16;
+    const bool strobe_lit = strobe_detector.trigger || strobe_ms < EFFECTS_FRAME_MS;
+
     /*
      * We apply each preset on all grouped ribbons
      */
@@ -159,84 +390,51 @@ void loop()
       if (!preset.do_litmax && preset.brightness == 0)
         continue;
       
-      if (preset.strobe_enable && !strobe_clock.coarse_value)
+      if (preset.strobe_enable && !strobe_lit)
         continue;
 
-      const uint8_t time = osc_clocks[preset_index].get8() + global.master.sync_correction;
+      // Same as osc_clocks[preset_index].get8() + sync_correction, sampled once per frame
+      const uint8_t time = ribbon_graph.phase(preset_index) >> 8;
         
       // The group which the preset is attached to
       const uint8_t preset_group = 0; //Global.ribbons[preset_index].group;
       //const objects::Group& group = Global.groups[preset_group];
       const uint8_t palette_index = preset.palette >> (7 - 3);
       const uint8_t palette_subindex = (preset.palette % 16) << 4;
-      const auto& palette = global.palettes[palette_index];
-      //const auto& paletteB = global.palettes[(palette_index +1) % 8];
-      //const auto& palette = lerp_palette(paletteA, paletteB, palette_subindex);
+      const auto& paletteA = global.palettes[palette_index];
+      const auto& paletteB = global.palettes[min8(palette_index +1, PALETTES_COUNT -1)];
+      // Blend once per preset, pixels then only sample the LUT
+      palette_lut.build(lerp_palette(paletteA, paletteB, palette_subindex));
 
-      for (uint8_t ribbon_index = 0 ; ribbon_index < ribbons_count ; ++ribbon_index)
+      for (uint8_t ribbon_index = 0 ; ribbon_index < topology.segments_count ; ++ribbon_index)
       {
-//        bool is_solodriver = ribbon_index == 7;
-//        if (is_solodriver)
-//        {
-//          if (global.master.solo_enable)
-//            if ((solodriver_index * 2 + ribbon_index) != )
-//              continue;
-//        }
-
-        bool is_solo_ribbon = ribbon_index == 7;
+        const render_plan_t& plan = topology.plans[ribbon_index];
+        const bool is_solo_ribbon = plan.is_solo;
         
-        uint8_t ribbon_modules_count = 0;
-        uint32_t ribbon_leds_count = 0;
-        CRGB* ribbon_ptr = leds + ribbon_index * MaxLedsPerRibbon;
-
         if (!is_solo_ribbon && !preset.is_active_on_master)
             continue;
         if (global.master.solo_enable && is_solo_ribbon && !preset.is_active_on_solo)
             continue;
         
-        if (is_solo_ribbon)
-        {
-          if (global.master.solo_enable)
-          {
-            ribbon_modules_count = 1;
-            ribbon_leds_count = 30;
-            ribbon_ptr += global.setup.soloribbons_location[global.master.solo_index] * 30;
-          }
-          else
-          {
-            ribbon_modules_count = 4;
-            ribbon_leds_count = 30 * 4;
-          }
-        }
-        else
-        {
-          ribbon_modules_count = global.setup.ribbons_lengths[ribbon_index];
-          ribbon_leds_count = 30 * global.setup.ribbons_lengths[ribbon_index];
-        }
-        const size_t ribbon_byte_size = ribbon_leds_count * sizeof(CRGB);
+        const uint8_t ribbon_modules_count = plan.modules;
+        const uint32_t ribbon_leds_count = plan.length;
+        // Backward segments are rendered from their last led
+        const int8_t ribbon_step = plan.direction;
+        CRGB* ribbon_ptr = leds + plan.offset + (ribbon_step < 0 ? ribbon_leds_count - 1 : 0);
 
         // Break if ribbon is associated with another group
         //if (ribbon.group != preset_group)
         //  continue;
 
+        // Noise is seeded by the beat count, so it holds its value for a whole beat
+        const uint32_t beat = beat_detectors[preset_index].count;
+        const uint32_t colormod_seed = noise::seed(preset_index, ribbon_index, beat, 0);
+        const uint32_t maskmod_seed = noise::seed(preset_index, ribbon_index, beat, 1);
+
         OscillatorKind colormod_kind = map_to_oscillator_kind(preset.colormod_osc << 1);
         OscillatorKind maskmod_kind = map_to_oscillator_kind(preset.maskmod_osc << 1);
-        uint8_t colormod_osc = eval_oscillator(colormod_kind, OscillatorKind::Noise == colormod_kind ? time << 2 : time);
-        uint8_t maskmod_osc  = eval_oscillator(maskmod_kind, OscillatorKind::Noise == maskmod_kind ? time << 2 : time);
-        
-        if (OscillatorKind::Noise == colormod_kind || OscillatorKind::Noise == maskmod_kind)
-        {
-          if (beat_detectors[preset_index].trigger)
-          {
-            holded_values[preset_index][ribbon_index][0] = colormod_osc;
-            holded_values[preset_index][ribbon_index][1] = maskmod_osc;
-          }
-          else
-          {
-            if (OscillatorKind::Noise == colormod_kind) colormod_osc = holded_values[preset_index][ribbon_index][0];
-            if (OscillatorKind::Noise == maskmod_kind) maskmod_osc = holded_values[preset_index][ribbon_index][1];
-          }
-        }
+        uint8_t colormod_osc = eval_modulation(colormod_kind, preset.colormod_band, time, colormod_seed, global.audio);
+        uint8_t maskmod_osc  = eval_modulation(maskmod_kind, preset.maskmod_band, time, maskmod_seed, global.audio);
   
         // Build the compo according to parameters
         const Composition compo{
@@ -266,7 +464,7 @@ void loop()
             // width
             preset.maskmod_move ?
               preset.maskmod_width
-              : scale8(eval_oscillator(map_to_oscillator_kind(preset.maskmod_osc << 1), time), preset.maskmod_width << 1),
+              : scale8(maskmod_osc, preset.maskmod_width << 1),
             // wraparound or saturate
             preset.maskmod_move,
             preset.maskmod_enable
@@ -290,109 +488,163 @@ void loop()
           // a number between 0 and 4 excluded indicating which ribbon is soloing
           uint8_t soloindex = global.setup.soloribbons_location[global.master.solo_index];
           uint8_t soloside = soloindex / 2;
-          uint8_t ribbonside = ribbon_index < (ribbons_count /2);
+          uint8_t ribbonside = plan.side;
 
           bright = scale8_video(bright, dim8_video(ribbonside == soloside ? global.master.solo_weak_dim : global.master.solo_strong_dim));
         }
           
-        for (uint32_t i = 0; i < ribbon_leds_count; ++i) {
-          CRGB c = compo.eval(palette, time, i, ribbon_leds_count);
-          CRGB o = ribbon_ptr[i];
-          nscale8_video(&c, 1, bright);
+        // Master brightness is folded in the output LUT instead of FastLED.show
+        output_lut.build(scale8_video(bright, global.master.brightness));
+          
+#if USE_EFFECT_CHAIN
+        const composition_params_t compo_params{compo, &palette_lut, &output_lut, ribbon_step};
+        const RibbonEffect::node_t chain[] = {
+          {composition_effect, &compo_params},
+        };
+        RibbonEffect::run(
+          make_ribbon_datas(leds + plan.offset, ribbon_leds_count, ribbon_index, topology.segments_count,
+            ribbon_graph, preset_index),
+          chain, chain + sizeof(chain) / sizeof(*chain));
+#else
+        for (uint32_t i = 0; i < ribbon_leds_count; ++i, ribbon_ptr += ribbon_step) {
+          CRGB c = output_lut(compo.eval(palette_lut, i, ribbon_leds_count));
+          CRGB o = *ribbon_ptr;
          
-          ribbon_ptr[i] = CRGB(max8(c.r, o.r), max8(c.g, o.g), max8(c.b, o.b));
+          *ribbon_ptr = CRGB(max8(c.r, o.r), max8(c.g, o.g), max8(c.b, o.b));
         }
+#endif
         
       } // for ribbon
     } // for preset
-    unsigned long compute_end = millis();
+    const uint32_t compute_end = micros();
 
     // Draw frame
-    unsigned long draw_begin = millis();
     // When solowing, all ribbons on the other side than the soloing one are strongly dimmed
     //  All ribbons on the same side are weakly dimmed
-    FastLED.show(global.master.do_kill_lights ? 0 : global.master.brightness);
-    delay(1);
-    unsigned long draw_end = millis();
+    FastLED.show(global.master.do_kill_lights ? 0 : 255);
+    const uint32_t draw_end = micros();
 
-
-    unsigned long endtime = millis();
-
-    // Compute FPS
-    static unsigned long fps_accumulator= 0;
-    static unsigned long frame_cptr = 0;
-    fps_accumulator += endtime - master_clock.last_timestamp;
-    frame_cptr++;
+    scheduler.record(FrameScheduler::COMPUTE, compute_end - compute_begin);
+    scheduler.record(FrameScheduler::SHOW, draw_end - compute_end);
+    scheduler.end_frame(draw_end - compute_begin);
 
     // Send status message
-    if (2000 < fps_accumulator)
+    static uint32_t status_begin = draw_end;
+    const uint32_t status_elapsed = draw_end - status_begin;
+    const uint32_t status_period = global.setup.telemetry_period ? global.setup.telemetry_period * 100000lu : STATUS_PERIOD_US;
+    if (status_period < status_elapsed)
     {
-      float fps = float(frame_cptr) * 1000.f / fps_accumulator;
-      coarse_framerate = (uint8_t)fps;
-      
-      SERIAL.print("Avg FPS : ");
-      SERIAL.print(fps);
-      SERIAL.print(" : SerialUSB : ");
-      SERIAL.print(update_end - update_begin);
-      SERIAL.print(" : Compute : ");
-      SERIAL.print(compute_end - compute_begin);
-      SERIAL.print(" : Draw : ");
-      SERIAL.print(draw_end - draw_begin);
-      SERIAL.print(" : Drops : ");
-      SERIAL.print(drop_count);
-      SERIAL.print(" : Master Clock : ");
-      SERIAL.println(global.master.bpm);
-      SERIAL.print(" : Strobe Period : ");
-      SERIAL.print(strobe_clock.period);
-      SERIAL.print(" : Coarse FPS : ");
-      SERIAL.print(coarse_framerate);
-      SERIAL.print(" : Ctrl : ");
-      SERIAL.println(global.master.strobe_speed);
-
-      fps_accumulator = 0;
-      frame_cptr = 0;
+      coarse_framerate = (uint64_t(scheduler.frames) * 1000000) / status_elapsed;
+
+      if (global.setup.telemetry_period)
+      {
+        send_telemetry(status_elapsed, drop_count);
+      }
+      else
+      {
+        SERIAL.print("Avg FPS : ");
+        SERIAL.print(coarse_framerate);
+        SERIAL.print(" : Period : ");
+        SERIAL.print(scheduler.period);
+        SERIAL.print(" : Late : ");
+        SERIAL.print(scheduler.late_frames);
+        print_histogram(" : SerialUSB : ", scheduler.histograms[FrameScheduler::INPUT]);
+        print_histogram(" : Compute : ", scheduler.histograms[FrameScheduler::COMPUTE]);
+        print_histogram(" : Draw : ", scheduler.histograms[FrameScheduler::SHOW]);
+        print_histogram(" : Jitter : ", scheduler.histograms[FrameScheduler::JITTER]);
+        SERIAL.print(" : Frames : ");
+        SERIAL.print(controller_parser.stats.frames);
+        SERIAL.print(" : Drops : ");
+        SERIAL.print(drop_count);
+        SERIAL.print(" (framing ");
+        SERIAL.print(controller_parser.stats.framing_errors);
+        SERIAL.print(", crc ");
+        SERIAL.print(controller_parser.stats.crc_errors);
+        SERIAL.print(", range ");
+        SERIAL.print(controller_parser.stats.range_errors);
+        SERIAL.print(")");
+        SERIAL.print(" : Phase error : ");
+        SERIAL.print(phase_lock.error_us);
+        SERIAL.print("us, jumps ");
+        SERIAL.print(phase_lock.jumps);
+        SERIAL.print(" : Quantized : ");
+        SERIAL.print(pending_writes.released);
+        SERIAL.print(" (late ");
+        SERIAL.print(pending_writes.late);
+        SERIAL.print(", forced ");
+        SERIAL.print(pending_writes.forced);
+        SERIAL.print(")");
+        SERIAL.print(" : Master Clock : ");
+        SERIAL.println(global.master.bpm >> 16);
+        SERIAL.print(" : Strobe Period : ");
+        SERIAL.print(strobe_clock.period >> 3);
+        SERIAL.print(" : Coarse FPS : ");
+        SERIAL.print(coarse_framerate);
+        SERIAL.print(" : Ctrl : ");
+        SERIAL.println(global.master.strobe_speed);
+      }
+
+      scheduler.reset_stats();
+      status_begin = draw_end;
     }
 }
 
+/// Sends the binary health report of the last status period
+void send_telemetry(uint32_t window_us, uint32_t drops)
+{
+  static uint32_t sequence = 0;
+
+  telemetry_t report;
+  report.magic = telemetry_t::Magic;
+  report.version = telemetry_t::Version;
+  report.phases_count = telemetry_t::PhasesCount;
+  report.sequence = sequence++;
+  report.uptime_ms = millis();
+  report.window_us = window_us;
+  report.frames = scheduler.frames;
+  report.late_frames = scheduler.late_frames;
+  report.period_us = scheduler.period;
+  for (uint8_t i = 0 ; i < telemetry_t::PhasesCount ; ++i)
+  {
+    const TimingHistogram& histogram = scheduler.histograms[i];
+    report.phases[i].min = histogram.count ? histogram.min : 0;
+    report.phases[i].max = histogram.max;
+    report.phases[i].avg = histogram.mean();
+  }
+  report.drops = drops;
+  report.parser = controller_parser.stats;
+
+  uint8_t frame[telemetry::MaxEncodedSize];
+  SERIAL.write(frame, telemetry::encode(report, frame));
+}
+
+/// Prints "mean/p99/max" of a timing histogram, in microseconds
+void print_histogram(const char* label, const TimingHistogram& histogram)
+{
+  SERIAL.print(label);
+  SERIAL.print(histogram.mean());
+  SERIAL.print("/");
+  SERIAL.print(histogram.percentile(99));
+  SERIAL.print("/");
+  SERIAL.print(histogram.max);
+}
+
+/// Feeds the available bytes to the frame parser, returns the number of dropped frames
 int read_from_controller() {
 
-  static uint8_t serial_buffer[512];
-  static size_t serial_index = 0;
-  static size_t data_address = 0;
-  static size_t data_size = 0;
+  const protocol::stats_t& stats = controller_parser.stats;
+  const uint32_t errors_before = stats.framing_errors + stats.crc_errors + stats.range_errors;
 
-  unsigned long timeout_timestamp = millis();
-  while (SERIAL.available() <= 0)
-  {
-    if (SerialUSB_MESSAGE_TIMEOUT < millis() - timeout_timestamp)
-    {
-      return 0;
-    }
-    delayMicroseconds(100);
-  }
-  while (0 < SERIAL.available())
+  uint8_t chunk[64];
+  size_t chunk_size = 0;
+  while (0 < SERIAL.available() && chunk_size < sizeof(chunk))
   {
     int in = SERIAL.read();
     if (in < 0)
       continue;
-      
-    serial_buffer[serial_index++] = in;
-    
-    if (serial_index == 2)
-    {
-      data_address = ((uint16_t)serial_buffer[0]) << 8 | serial_buffer[1];
-    }
-    else if (serial_index == 3)
-    {
-      data_size = serial_buffer[2];
-    }
-    else if (serial_index == 3 + data_size)
-    {
-      memcpy(((uint8_t*)&global) + data_address, serial_buffer + 3, data_size);
-      SERIAL.print("Written "); SERIAL.print(data_size); SERIAL.print(" bytes at addr ");
-      SERIAL.print(data_address); SERIAL.println();
-      serial_index = 0;
-    }
+    chunk[chunk_size++] = in;
   }
-  return 0;
+  controller_parser.feed(chunk, chunk_size, controller_sink);
+
+  return stats.framing_errors + stats.crc_errors + stats.range_errors - errors_before;
 }
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <FastLED.h>
+
+#include "types.h"
+#include "clock.h"
+#include "Composition.h"
+#include "color_palette.h"
+
+/// Effects chain working on a whole ribbon of the leds buffer
+using RibbonEffect = opto::Effect<CRGB, uint16_t, uint32_t>;
+using RibbonSync = opto::Syncbase<uint32_t>;
+using RibbonTime = opto::Syncview<uint32_t>;
+
+/// A Clock as the master clock of a chain, 'clock' turns once every 8 periods
+inline RibbonSync clock_sync(const Clock& clock)
+{
+  static const uint32_t period = uint32_t(1) << 29;
+  RibbonSync sync;
+  sync.clock = &clock.clock;
+  sync.period = &period;
+  return sync;
+}
+
+/// A period of 'sync' shifted by 'offset', in 256th of period
+inline RibbonTime ribbon_time(const RibbonSync& sync, uint8_t offset)
+{
+  RibbonTime time;
+  time.sync = &sync;
+  time.phase = uint32_t(offset) << 21;
+  return time;
+}
+
+/// The chain time is node 'node' of 'graph', whose phase was computed by the last 'tick()'
+template <uint8_t N>
+inline RibbonEffect::RenderDatas make_ribbon_datas(CRGB* ribbon, uint16_t length, uint8_t index, uint8_t count,
+  const opto::SyncGraph<uint32_t, N>& graph, uint8_t node)
+{
+  RibbonEffect::RenderDatas datas;
+  datas.ribbon = ribbon;
+  datas.sync = graph.nodes[node].view->sync;
+
+  RibbonEffect::Context& ctx = datas.frame_context;
+  ctx.pixel_index = 0;
+  ctx.pixel_postlast_index = length;
+  ctx.pixel_count = length;
+  ctx.ribbon_length = length;
+  ctx.ribbon_index = index;
+  ctx.ribbon_count = count;
+  ctx.segment_index = 0;
+  ctx.segment_count = 1;
+  ctx.time = *graph.nodes[node].view;
+  ctx.phase = graph.phase(node);
+
+  datas.local_context = datas.frame_context;
+  return datas;
+}
+
+/// Parameters of 'composition_effect'
+struct composition_params_t
+{
+  Composition compo;
+  const PaletteLUT* palette;
+  const TransferLUT* transfer;
+  int8_t direction; ///!< -1 if the ribbon is wired backward
+};
+
+/**
+ * The hard-wired Composition as a chain node :
+ *  max-blends the composition over the range, then runs the rest of the chain.
+ * Positions are relative to the range, so the composition follows 'split'.
+ * It doesn't depend on time, the modulations are folded in its parameters.
+ */
+inline void composition_effect(const RibbonEffect::RenderDatas& datas, void* _chain_begin, void* _subchain, void* _chain_end) noexcept
+{
+  const composition_params_t& p = RibbonEffect::params<composition_params_t>(_subchain);
+  const RibbonEffect::Context& ctx = datas.local_context;
+
+  CRGB* out = datas.ribbon + (p.direction < 0 ? ctx.ribbon_length - 1 - ctx.pixel_index : ctx.pixel_index);
+  for (uint16_t i = 0 ; i < ctx.pixel_count ; ++i, out += p.direction)
+  {
+    const CRGB c = (*p.transfer)(p.compo.eval(*p.palette, i, ctx.pixel_count));
+    *out = CRGB(max8(c.r, out->r), max8(c.g, out->g), max8(c.b, out->b));
+  }
+
+  RibbonEffect::next(datas, _chain_begin, _subchain, _chain_end);
+}
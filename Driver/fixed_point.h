@@ -0,0 +1,147 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+Warning :
+  Code written in this file must be platform independant.
+*/
+
+/**
+ * Q format fixed point numbers.
+ *
+ * 'Q<Raw, Frac>' stores a number as a 'Raw' integer with 'Frac' fractional bits,
+ * 'uq16_16' being an unsigned 32 bits number with 16 integer bits and 16 fractional bits.
+ * Operators wrap around like integers, '*_sat' functions saturate to the range of 'Raw'.
+ *
+ * Everything is constexpr (C++11), float conversions are only meant
+ * to build constants at compile time.
+ */
+namespace fixed
+{
+  template <typename Raw> struct traits;
+  template <> struct traits<uint8_t>  { using wide_t = uint16_t; using unsigned_t = uint8_t;  static constexpr int64_t min = 0;          static constexpr int64_t max = 0xFF; };
+  template <> struct traits<int8_t>   { using wide_t = int16_t;  using unsigned_t = uint8_t;  static constexpr int64_t min = -0x80;      static constexpr int64_t max = 0x7F; };
+  template <> struct traits<uint16_t> { using wide_t = uint32_t; using unsigned_t = uint16_t; static constexpr int64_t min = 0;          static constexpr int64_t max = 0xFFFF; };
+  template <> struct traits<int16_t>  { using wide_t = int32_t;  using unsigned_t = uint16_t; static constexpr int64_t min = -0x8000;    static constexpr int64_t max = 0x7FFF; };
+  template <> struct traits<uint32_t> { using wide_t = uint64_t; using unsigned_t = uint32_t; static constexpr int64_t min = 0;          static constexpr int64_t max = 0xFFFFFFFF; };
+  template <> struct traits<int32_t>  { using wide_t = int64_t;  using unsigned_t = uint32_t; static constexpr int64_t min = -0x80000000ll; static constexpr int64_t max = 0x7FFFFFFF; };
+
+  template <typename Raw, uint8_t Frac>
+  struct Q
+  {
+    using raw_t = Raw;
+    using wide_t = typename traits<Raw>::wide_t;
+
+    static constexpr uint8_t FracBits = Frac;
+    /// Wide, as 1 is out of range of 'Raw' for pure fractions (uq0_16, uq0_32) : narrow it before mixing with 32 bits raws
+    static constexpr wide_t One = wide_t(1) << Frac;
+
+    Raw raw;
+
+    static constexpr Q from_raw(Raw r) { return Q{r}; }
+    static constexpr Q from_int(int32_t i) { return Q{Raw(wide_t(i) * One)}; }
+    static constexpr Q from_float(float f) { return Q{Raw(f * One)}; }
+
+    /// Integer part, rounded toward minus infinity
+    constexpr wide_t to_int() const { return wide_t(raw) >> Frac; }
+    constexpr float to_float() const { return float(raw) / float(One); }
+
+    /// Same number with another fractional precision
+    template <typename R, uint8_t F>
+    constexpr Q<R, F> as() const
+    {
+      return Q<R, F>::from_raw(F < Frac
+        ? R(raw >> (F < Frac ? Frac - F : 0))
+        : R(int64_t(raw) * (int64_t(1) << (F < Frac ? 0 : F - Frac))));
+    }
+  };
+
+  using uq0_8   = Q<uint8_t, 8>;
+  using uq8_8   = Q<uint16_t, 8>;
+  using q8_8    = Q<int16_t, 8>;
+  using uq0_16  = Q<uint16_t, 16>;
+  using q1_15   = Q<int16_t, 15>;
+  using uq24_8  = Q<uint32_t, 8>;
+  using uq16_16 = Q<uint32_t, 16>;
+  using q16_16  = Q<int32_t, 16>;
+  using uq0_32  = Q<uint32_t, 32>;
+
+  template <typename Raw>
+  constexpr Raw saturate(int64_t v)
+  {
+    return v < traits<Raw>::min ? Raw(traits<Raw>::min) : traits<Raw>::max < v ? Raw(traits<Raw>::max) : Raw(v);
+  }
+
+  // Wrapping operations
+
+  template <typename R, uint8_t F>
+  constexpr Q<R, F> operator+ (Q<R, F> a, Q<R, F> b)
+  {
+    return Q<R, F>::from_raw(R(typename traits<R>::unsigned_t(a.raw) + typename traits<R>::unsigned_t(b.raw)));
+  }
+
+  template <typename R, uint8_t F>
+  constexpr Q<R, F> operator- (Q<R, F> a, Q<R, F> b)
+  {
+    return Q<R, F>::from_raw(R(typename traits<R>::unsigned_t(a.raw) - typename traits<R>::unsigned_t(b.raw)));
+  }
+
+  template <typename R, uint8_t F>
+  constexpr Q<R, F> operator* (Q<R, F> a, Q<R, F> b)
+  {
+    return Q<R, F>::from_raw(R((typename Q<R, F>::wide_t(a.raw) * b.raw) >> F));
+  }
+
+  /// Wide division, prefer 'recip32' or 'div_by' in the frame loop
+  template <typename R, uint8_t F>
+  constexpr Q<R, F> operator/ (Q<R, F> a, Q<R, F> b)
+  {
+    return Q<R, F>::from_raw(R((typename Q<R, F>::wide_t(a.raw) << F) / b.raw));
+  }
+
+  template <typename R, uint8_t F>
+  constexpr bool operator< (Q<R, F> a, Q<R, F> b) { return a.raw < b.raw; }
+  template <typename R, uint8_t F>
+  constexpr bool operator== (Q<R, F> a, Q<R, F> b) { return a.raw == b.raw; }
+  template <typename R, uint8_t F>
+  constexpr bool operator!= (Q<R, F> a, Q<R, F> b) { return a.raw != b.raw; }
+
+  // Saturating operations
+
+  template <typename R, uint8_t F>
+  constexpr Q<R, F> add_sat(Q<R, F> a, Q<R, F> b)
+  {
+    return Q<R, F>::from_raw(saturate<R>(int64_t(a.raw) + int64_t(b.raw)));
+  }
+
+  template <typename R, uint8_t F>
+  constexpr Q<R, F> sub_sat(Q<R, F> a, Q<R, F> b)
+  {
+    return Q<R, F>::from_raw(saturate<R>(int64_t(a.raw) - int64_t(b.raw)));
+  }
+
+  template <typename R, uint8_t F>
+  constexpr Q<R, F> mul_sat(Q<R, F> a, Q<R, F> b)
+  {
+    return Q<R, F>::from_raw(saturate<R>((int64_t(a.raw) * int64_t(b.raw)) >> F));
+  }
+
+  // Raw helpers, mapping to single instructions on Cortex-M3
+
+  /// High word of the 64 bits product (UMULL / SMULL)
+  constexpr uint32_t mulhi(uint32_t a, uint32_t b) { return (uint64_t(a) * b) >> 32; }
+  constexpr int32_t mulhi(int32_t a, int32_t b) { return (int64_t(a) * b) >> 32; }
+
+  /// 1/n in Q0.32 for n > 1, a single hardware division
+  constexpr uint32_t recip32(uint32_t n) { return 0xFFFFFFFFu / n; }
+
+  /// n / D by multiply-high, exact for n < 2^16 and 1 < D < 2^16
+  template <uint32_t D>
+  constexpr uint32_t div_by(uint32_t n) { return mulhi(n, 0xFFFFFFFFu / D + 1); }
+
+  /// Upper bits of a Q0.32 phase
+  constexpr uint8_t hi8(uint32_t x) { return x >> 24; }
+  constexpr uint16_t hi16(uint32_t x) { return x >> 16; }
+
+} // namespace fixed
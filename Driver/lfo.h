@@ -0,0 +1,170 @@
+#pragma once
+
+#include "types.h"
+#include "noise.h"
+
+namespace opto
+{
+  /**
+   * Fixed point waveforms.
+   *
+   * Same shapes and parameters as the w_* float transfert functions of utils.h,
+   * with phases in [0, 65536[ for one period and outputs in [-32767, 32767].
+   * Fractional parameters (square and varislope breakpoint, varislope height)
+   * are stored in Q0.16, N-Phase parameters are integers.
+   */
+  namespace wave
+  {
+    /// One sine period sampled on 256 steps, last entry closes the loop for interpolation
+    static const int16_t sine_table[257] = {
+         0,    804,   1608,   2410,   3212,   4011,   4808,   5602,
+      6393,   7179,   7962,   8739,   9512,  10278,  11039,  11793,
+     12539,  13279,  14010,  14732,  15446,  16151,  16846,  17530,
+     18204,  18868,  19519,  20159,  20787,  21403,  22005,  22594,
+     23170,  23731,  24279,  24811,  25329,  25832,  26319,  26790,
+     27245,  27683,  28105,  28510,  28898,  29268,  29621,  29956,
+     30273,  30571,  30852,  31113,  31356,  31580,  31785,  31971,
+     32137,  32285,  32412,  32521,  32609,  32678,  32728,  32757,
+     32767,  32757,  32728,  32678,  32609,  32521,  32412,  32285,
+     32137,  31971,  31785,  31580,  31356,  31113,  30852,  30571,
+     30273,  29956,  29621,  29268,  28898,  28510,  28105,  27683,
+     27245,  26790,  26319,  25832,  25329,  24811,  24279,  23731,
+     23170,  22594,  22005,  21403,  20787,  20159,  19519,  18868,
+     18204,  17530,  16846,  16151,  15446,  14732,  14010,  13279,
+     12539,  11793,  11039,  10278,   9512,   8739,   7962,   7179,
+      6393,   5602,   4808,   4011,   3212,   2410,   1608,    804,
+         0,   -804,  -1608,  -2410,  -3212,  -4011,  -4808,  -5602,
+     -6393,  -7179,  -7962,  -8739,  -9512, -10278, -11039, -11793,
+    -12539, -13279, -14010, -14732, -15446, -16151, -16846, -17530,
+    -18204, -18868, -19519, -20159, -20787, -21403, -22005, -22594,
+    -23170, -23731, -24279, -24811, -25329, -25832, -26319, -26790,
+    -27245, -27683, -28105, -28510, -28898, -29268, -29621, -29956,
+    -30273, -30571, -30852, -31113, -31356, -31580, -31785, -31971,
+    -32137, -32285, -32412, -32521, -32609, -32678, -32728, -32757,
+    -32767, -32757, -32728, -32678, -32609, -32521, -32412, -32285,
+    -32137, -31971, -31785, -31580, -31356, -31113, -30852, -30571,
+    -30273, -29956, -29621, -29268, -28898, -28510, -28105, -27683,
+    -27245, -26790, -26319, -25832, -25329, -24811, -24279, -23731,
+    -23170, -22594, -22005, -21403, -20787, -20159, -19519, -18868,
+    -18204, -17530, -16846, -16151, -15446, -14732, -14010, -13279,
+    -12539, -11793, -11039, -10278,  -9512,  -8739,  -7962,  -7179,
+     -6393,  -5602,  -4808,  -4011,  -3212,  -2410,  -1608,   -804,
+         0,
+    };
+
+    /// Unipolar values map to [-32768, 32767], the lowest value is folded so that every waveform is symmetric
+    inline int16_t clamp16(int32_t v)
+    {
+      return v < -32767 ? -32767 : 32767 < v ? 32767 : v;
+    }
+
+    inline int16_t sin16(uint16_t phase)
+    {
+      const uint8_t idx = phase >> 8;
+      const int32_t a = sine_table[idx];
+      const int32_t b = sine_table[idx + 1];
+      return a + (((b - a) * (phase & 0xFF)) >> 8);
+    }
+
+    inline int16_t sqr16(uint16_t phase, uint16_t p1)
+    {
+      return phase < p1 ? -32767 : 32767;
+    }
+
+    inline int16_t tri16(uint16_t phase)
+    {
+      const int32_t v = phase < 32768 ? 65536 - 2 * int32_t(phase) : 2 * int32_t(phase) - 65536;
+      return clamp16(v - 32768);
+    }
+
+    inline int16_t saw16(uint16_t phase)
+    {
+      return clamp16(int32_t(phase) - 32768);
+    }
+
+    inline int16_t var16(uint16_t phase, uint16_t p1, uint16_t p2)
+    {
+      if (phase < p1)
+        return clamp16(int32_t((uint32_t(p2) * phase) / p1) - 32768);
+      else
+        return clamp16(32767 - int32_t((uint32_t(p2) * (phase - p1)) / (65536u - p1)));
+    }
+
+    inline int16_t nph16(uint16_t phase, uint16_t p1, uint16_t p2)
+    {
+      if (0 == p2)
+        return sin16(phase);
+      const uint32_t step = (uint32_t(phase) * (uint32_t(p1) + 1)) >> 16;
+      return sin16(phase + uint16_t((step << 16) / p2));
+    }
+
+    inline int16_t whi16(uint32_t seed, uint32_t counter)
+    {
+      return clamp16(int32_t(noise::eval16(seed, counter)) - 32768);
+    }
+
+    /// 'p1' is the unipolar level of the constant
+    inline int16_t cst16(uint16_t p1)
+    {
+      return clamp16(int32_t(p1) - 32768);
+    }
+  } // namespace wave
+
+  /**
+   * Struct of arrays bank of fixed point LFOs.
+   *
+   * Phases are written by the caller, then every active LFO is evaluated
+   * in a single call to 'eval()' per frame.
+   */
+  template <uint8_t N>
+  struct LFOBank
+  {
+    using WaveForm = typename LFO<float>::WaveForm;
+
+    uint8_t  count = 0;
+    uint8_t  waveform[N];
+    uint16_t phase[N];
+    uint16_t param1[N];
+    uint16_t param2[N];
+    int16_t  output[N];   ///!< Bipolar outputs in [-32767, 32767]
+    uint32_t frame = 0;   ///!< Counter of the white noise
+
+    /// Returns the index of the new LFO, or N if the bank is full
+    uint8_t add(WaveForm w, uint16_t p1 = 0, uint16_t p2 = 0)
+    {
+      if (N <= count)
+        return N;
+      waveform[count] = w;
+      phase[count] = 0;
+      param1[count] = p1;
+      param2[count] = p2;
+      output[count] = 0;
+      return count++;
+    }
+
+    void eval()
+    {
+      for (uint8_t i = 0 ; i < count ; ++i)
+      {
+        const uint16_t t = phase[i];
+        switch (waveform[i])
+        {
+        case LFO<float>::WSIN: output[i] = wave::sin16(t); break;
+        case LFO<float>::WSQR: output[i] = wave::sqr16(t, param1[i]); break;
+        case LFO<float>::WTRI: output[i] = wave::tri16(t); break;
+        case LFO<float>::WSAW: output[i] = wave::saw16(t); break;
+        case LFO<float>::WVAR: output[i] = wave::var16(t, param1[i], param2[i]); break;
+        case LFO<float>::WNPH: output[i] = wave::nph16(t, param1[i], param2[i]); break;
+        case LFO<float>::WWHI: output[i] = wave::whi16(noise::hash32(i), frame); break;
+        case LFO<float>::WCST: output[i] = wave::cst16(param1[i]); break;
+        default:               output[i] = 0; break;
+        }
+      }
+      frame++;
+    }
+
+    /// Output mapped to [1, 65535], as LFO::eval maps to [0, 1]
+    uint16_t unipolar(uint8_t i) const { return int32_t(output[i]) + 32768; }
+  };
+
+} // namespace opto
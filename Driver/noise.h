@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+Warning :
+  Code written in this file must be platform independant.
+*/
+
+/**
+ * Stateless counter based noise.
+ *
+ * Every value is a pure function of a seed and a counter, so noise can be
+ * evaluated in any order, over whole spans of pixels, and replayed exactly
+ * (no shared PRNG state between presets and ribbons).
+ */
+namespace noise
+{
+  /// Integer avalanche hash (lowbias32, see https://nullprogram.com/blog/2018/07/31/)
+  inline uint32_t hash32(uint32_t x)
+  {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+  }
+
+  /// Builds a seed from the preset, the ribbon and the preset's beat count
+  inline uint32_t seed(uint8_t preset, uint8_t ribbon, uint32_t beat, uint8_t channel = 0)
+  {
+    return hash32(
+      (uint32_t(preset) << 24) ^ (uint32_t(ribbon) << 16) ^ (uint32_t(channel) << 8)
+      ^ hash32(beat));
+  }
+
+  /// Noise value for the given counter in a seeded sequence
+  inline uint8_t eval8(uint32_t seed, uint32_t counter)
+  {
+    return hash32(seed + counter * 0x9e3779b9u) >> 24;
+  }
+
+  inline uint16_t eval16(uint32_t seed, uint32_t counter)
+  {
+    return hash32(seed + counter * 0x9e3779b9u) >> 16;
+  }
+
+} // namespace noise
@@ -0,0 +1,280 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+Warning :
+  Code written in this file must be platform independant.
+*/
+
+/**
+ * Controller to driver wire protocol.
+ *
+ * A frame carries one or more writes into the driver state :
+ *    [addr_hi, addr_lo, size, data...] [addr_hi, addr_lo, size, data...] ... [crc_hi, crc_lo]
+ * The CRC-16/CCITT covers every byte before it. The frame is then COBS encoded,
+ * so it contains no zero byte, and terminated by a zero byte.
+ *
+ * A frame is applied as a whole or not at all : any framing, CRC or range error drops it,
+ * and the parser resyncs on the next zero byte.
+ *
+ * Records with an address above 'ControlBase' are control markers, with a fixed data size :
+ * writes between 'BeginTransaction' and 'Commit' may span several frames
+ * and are shown on the same rendered frame, 'TimePing' and 'PhaseAnchor'
+ * carry the clock synchronisation (see timesync.h). 'Quantize' right after 'BeginTransaction'
+ * holds the transaction until a beat (see quantize.h).
+ */
+namespace protocol
+{
+  static constexpr uint8_t  Delimiter = 0x00;
+  static constexpr size_t   MaxPayloadSize = 256; ///!< Writes + CRC, before encoding
+  static constexpr size_t   MaxEncodedSize = MaxPayloadSize + MaxPayloadSize / 254 + 1;
+  static constexpr size_t   RecordHeaderSize = 3;
+  static constexpr size_t   CrcSize = 2;
+
+  static constexpr uint16_t ControlBase = 0xFF00;
+  static constexpr uint16_t BeginTransaction = 0xFF00;
+  static constexpr uint16_t Commit = 0xFF01;
+  static constexpr uint16_t TimePing = 0xFF02;    ///!< Controller time in us, echoed back by the driver
+  static constexpr uint16_t PhaseAnchor = 0xFF03; ///!< Master clock phase at a driver time
+  static constexpr uint16_t Quantize = 0xFF04;    ///!< Beat target of the transaction writes
+
+  /// Data size of a control marker, -1 for an unknown one
+  inline int control_size(uint16_t marker)
+  {
+    switch (marker)
+    {
+    case BeginTransaction:
+    case Commit:
+      return 0;
+    case TimePing:
+      return 4;
+    case PhaseAnchor:
+    case Quantize:
+      return 8;
+    }
+    return -1;
+  }
+
+  /// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF)
+  inline uint16_t crc16(const uint8_t* data, size_t len, uint16_t crc = 0xFFFF)
+  {
+    for (size_t i = 0 ; i < len ; ++i)
+    {
+      crc ^= uint16_t(data[i]) << 8;
+      for (uint8_t b = 0 ; b < 8 ; ++b)
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+    return crc;
+  }
+
+  /// COBS encodes 'len' bytes, returns the encoded size (without delimiter)
+  ///   'out' must hold at least len + len / 254 + 1 bytes
+  inline size_t cobs_encode(const uint8_t* in, size_t len, uint8_t* out)
+  {
+    size_t code_index = 0;
+    size_t out_index = 1;
+    uint8_t code = 1;
+    for (size_t i = 0 ; i < len ; ++i)
+    {
+      if (in[i] != 0)
+      {
+        out[out_index++] = in[i];
+        code++;
+      }
+      if (in[i] == 0 || code == 0xFF)
+      {
+        out[code_index] = code;
+        code_index = out_index++;
+        code = 1;
+      }
+    }
+    out[code_index] = code;
+    return out_index;
+  }
+
+  /// COBS decodes in place, returns the decoded size or 0 on a malformed frame
+  inline size_t cobs_decode(uint8_t* buffer, size_t len)
+  {
+    size_t in = 0, out = 0;
+    while (in < len)
+    {
+      const uint8_t code = buffer[in++];
+      if (code == 0 || len < in + code - 1)
+        return 0;
+      for (uint8_t i = 1 ; i < code ; ++i)
+        buffer[out++] = buffer[in++];
+      if (code != 0xFF && in < len)
+        buffer[out++] = 0;
+    }
+    return out;
+  }
+
+  /// Appends a write record to a payload, returns false if it doesn't fit
+  inline bool add_record(uint8_t* payload, size_t& len, uint16_t addr, const uint8_t* data, uint8_t size)
+  {
+    if (MaxPayloadSize - CrcSize < len + RecordHeaderSize + size)
+      return false;
+    payload[len++] = addr >> 8;
+    payload[len++] = addr & 0xFF;
+    payload[len++] = size;
+    if (size)
+      memcpy(payload + len, data, size);
+    len += size;
+    return true;
+  }
+
+  /// Appends a control marker to a payload, returns false if it doesn't fit
+  inline bool add_control(uint8_t* payload, size_t& len, uint16_t control, const uint8_t* data = nullptr)
+  {
+    return add_record(payload, len, control, data, control_size(control));
+  }
+
+  /// Appends the CRC to a payload of records, encodes it and terminates it,
+  ///   'out' must hold MaxEncodedSize + 1 bytes, returns the number of bytes to send
+  inline size_t finish_frame(uint8_t* payload, size_t len, uint8_t* out)
+  {
+    const uint16_t crc = crc16(payload, len);
+    payload[len++] = crc >> 8;
+    payload[len++] = crc & 0xFF;
+    size_t encoded = cobs_encode(payload, len, out);
+    out[encoded++] = Delimiter;
+    return encoded;
+  }
+
+  /// Error counters, reported in the status message
+  struct stats_t
+  {
+    uint32_t frames;        ///!< Applied frames
+    uint32_t writes;        ///!< Applied writes
+    uint32_t framing_errors;///!< Malformed COBS or oversized frames
+    uint32_t crc_errors;
+    uint32_t range_errors;  ///!< Writes out of the target or truncated records
+  };
+
+  /// Parser output writing straight into a buffer, control markers are ignored
+  struct buffer_sink_t
+  {
+    uint8_t* target;
+    size_t   target_size;
+
+    size_t size() const { return target_size; }
+    void write(size_t addr, const uint8_t* data, size_t size) { memcpy(target + addr, data, size); }
+    void control(uint16_t, const uint8_t*, size_t) {}
+    void end_frame() {}
+  };
+
+  /**
+   * Incremental frame parser, fed byte by byte or by chunks as they arrive.
+   * Valid frames are passed to the sink when their delimiter is received,
+   * a sink provides size(), write(addr, data, size), control(marker, data, size) and end_frame().
+   */
+  struct Parser
+  {
+    uint8_t  buffer[MaxEncodedSize];
+    size_t   length = 0;
+    bool     overflow = false;
+    stats_t  stats = {0, 0, 0, 0, 0};
+
+    /// Returns the number of frames applied
+    template <typename Sink>
+    size_t feed(const uint8_t* data, size_t len, Sink& sink)
+    {
+      size_t applied = 0;
+      for (size_t i = 0 ; i < len ; ++i)
+        applied += feed(data[i], sink);
+      return applied;
+    }
+
+    size_t feed(const uint8_t* data, size_t len, uint8_t* target, size_t target_size)
+    {
+      buffer_sink_t sink = { target, target_size };
+      return feed(data, len, sink);
+    }
+
+    /// Returns true if a frame has been applied
+    template <typename Sink>
+    bool feed(uint8_t byte, Sink& sink)
+    {
+      if (byte != Delimiter)
+      {
+        if (length < MaxEncodedSize)
+          buffer[length++] = byte;
+        else
+          overflow = true;
+        return false;
+      }
+
+      // End of frame
+      bool applied = false;
+      if (overflow)
+        stats.framing_errors++;
+      else if (length)
+        applied = apply(sink);
+      length = 0;
+      overflow = false;
+      return applied;
+    }
+
+  private:
+
+    static bool is_control(size_t addr, size_t size)
+    {
+      return ControlBase <= addr && control_size(addr) == int(size);
+    }
+
+    template <typename Sink>
+    bool apply(Sink& sink)
+    {
+      const size_t len = cobs_decode(buffer, length);
+      if (len < CrcSize + RecordHeaderSize)
+      {
+        stats.framing_errors++;
+        return false;
+      }
+
+      const size_t records_len = len - CrcSize;
+      const uint16_t crc = (uint16_t(buffer[records_len]) << 8) | buffer[records_len + 1];
+      if (crc != crc16(buffer, records_len))
+      {
+        stats.crc_errors++;
+        return false;
+      }
+
+      // Validate every record before writing anything
+      size_t writes = 0;
+      for (size_t i = 0 ; i < records_len ;)
+      {
+        const size_t addr = (size_t(buffer[i]) << 8) | buffer[i + 1];
+        const size_t size = buffer[i + 2];
+        i += RecordHeaderSize + size;
+        if (records_len < i || (sink.size() < addr + size && !is_control(addr, size))
+          || (records_len != i && records_len < i + RecordHeaderSize))
+        {
+          stats.range_errors++;
+          return false;
+        }
+        writes += !is_control(addr, size);
+      }
+
+      for (size_t i = 0 ; i < records_len ;)
+      {
+        const size_t addr = (size_t(buffer[i]) << 8) | buffer[i + 1];
+        const size_t size = buffer[i + 2];
+        if (is_control(addr, size))
+          sink.control(addr, buffer + i + RecordHeaderSize, size);
+        else
+          sink.write(addr, buffer + i + RecordHeaderSize, size);
+        i += RecordHeaderSize + size;
+      }
+      sink.end_frame();
+
+      stats.frames++;
+      stats.writes += writes;
+      return true;
+    }
+  };
+
+} // namespace protocol
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "protocol.h"
+
+/*
+Warning :
+  Code written in this file must be platform independant.
+*/
+
+/**
+ * Writes held by the driver until a beat.
+ *
+ * A 'Quantize' marker right after 'BeginTransaction' holds the writes of the transaction
+ * until its target is crossed : a phase of the master cycle, as in 'PhaseAnchor', or the
+ * next fall of a preset 'FallDetector'. The controller sends them ahead of time and they
+ * show on the frame of the beat, whatever the transport jitter. A write arriving after
+ * its target (by less than half a cycle) is applied on the next frame.
+ */
+namespace quantize
+{
+  enum mode_e : uint8_t {
+    MasterPhase,  ///!< When the master cycle phase crosses 'phase'
+    PresetFall,   ///!< On the next fall of the 'preset' beat detector
+  };
+
+  struct target_t
+  {
+    uint8_t  mode;
+    uint8_t  preset;
+    uint16_t reserved;
+    uint32_t phase;   ///!< UQ0.32 master cycle phase
+  };
+  static_assert(sizeof(target_t) == 8, "Target size is fixed by protocol::control_size");
+
+  /**
+   * Pending quantized transactions, in a fixed buffer of records.
+   *
+   * The writes of a transaction are kept as '[addr_hi, addr_lo, size, data...]' records
+   * until 'release' finds its target crossed, once per frame after the clocks ticked.
+   * A transaction that doesn't fit is released on the next frame, one whose target is
+   * never reached (stopped clock, lost commit) after 'MaxPendingFrames'.
+   * A write applied at once patches the held bytes it overlaps, so that a fader moved
+   * before the beat doesn't snap back to the held value on the release.
+   */
+  template <size_t Capacity = 1024, uint8_t MaxEntries = 8>
+  struct PendingQueue
+  {
+    static constexpr uint16_t MaxPendingFrames = 1000;
+
+    struct entry_t
+    {
+      target_t target;
+      uint32_t origin;  ///!< Master phase or fall count at the reception
+      uint16_t begin;   ///!< Records in 'records'
+      uint16_t end;
+      uint16_t frames;  ///!< Rendered frames since the reception
+      bool     closed;  ///!< Commit received
+      bool     forced;  ///!< Released on the next frame
+    };
+
+    uint8_t  records[Capacity];
+    entry_t  entries[MaxEntries];
+    uint8_t  count = 0;
+    bool     open = false;    ///!< Receiving the writes of the last entry
+    uint32_t queued = 0;      ///!< Quantized transactions received
+    uint32_t released = 0;    ///!< On their target
+    uint32_t late = 0;        ///!< Target crossed before the reception
+    uint32_t forced = 0;      ///!< Overflowed, or never reached their target
+    uint32_t overflows = 0;   ///!< Writes not held for lack of room
+    uint32_t superseded = 0;  ///!< Held writes patched by a later one
+
+    /// Starts holding the writes, 'origin' being the current value of the target clock
+    void begin(const target_t& target, uint32_t origin)
+    {
+      close();
+      queued++;
+      if (count == MaxEntries)
+      {
+        overflows++;
+        return;
+      }
+      const uint16_t first = count ? entries[count - 1].end : 0;
+      entries[count++] = entry_t{ target, origin, first, first, 0, false, false };
+      open = true;
+    }
+
+    /// Holds a write of the open transaction, false if it must be applied now
+    bool write(size_t addr, const uint8_t* data, size_t size)
+    {
+      if (!open)
+      {
+        supersede(addr, data, size);
+        return false;
+      }
+      entry_t& entry = entries[count - 1];
+      if (Capacity < entry.end + protocol::RecordHeaderSize + size)
+      {
+        // What is already held goes with the rest of the transaction
+        overflows++;
+        entry.forced = true;
+        close();
+        supersede(addr, data, size);
+        return false;
+      }
+      uint8_t* record = records + entry.end;
+      record[0] = addr >> 8;
+      record[1] = addr & 0xFF;
+      record[2] = size;
+      memcpy(record + protocol::RecordHeaderSize, data, size);
+      entry.end += protocol::RecordHeaderSize + size;
+      return true;
+    }
+
+    /// End of the transaction
+    void close()
+    {
+      if (open)
+        entries[count - 1].closed = true;
+      open = false;
+    }
+
+    /**
+     * Applies the writes of the crossed targets with 'apply(addr, data, size)', in the
+     * reception order. 'phase' is the master cycle phase of this frame, 'falls(preset)'
+     * the fall count of a beat detector. Returns the number of released transactions.
+     */
+    template <typename Falls, typename Apply>
+    uint8_t release(uint32_t phase, Falls&& falls, Apply&& apply)
+    {
+      uint8_t done = 0;
+      uint8_t kept = 0;
+      uint16_t used = 0;
+      for (uint8_t i = 0 ; i < count ; ++i)
+      {
+        entry_t entry = entries[i];
+        entry.frames++;
+        if (is_due(entry, phase, falls))
+        {
+          for (uint16_t r = entry.begin ; r < entry.end ; r += protocol::RecordHeaderSize + records[r + 2])
+            apply((size_t(records[r]) << 8) | records[r + 1], records + r + protocol::RecordHeaderSize, records[r + 2]);
+          // A commit lost for too long, the next writes aren't held anymore
+          if (open && i + 1 == count)
+            open = false;
+          done++;
+          continue;
+        }
+        // Compacts the kept records, they never move forward
+        const uint16_t size = entry.end - entry.begin;
+        if (used != entry.begin)
+          memmove(records + used, records + entry.begin, size);
+        entry.begin = used;
+        entry.end = used + size;
+        used += size;
+        entries[kept++] = entry;
+      }
+      count = kept;
+      return done;
+    }
+
+  private:
+
+    /// Patches the held bytes of [addr, addr + size[ with the write applied at once
+    void supersede(size_t addr, const uint8_t* data, size_t size)
+    {
+      const uint16_t used = count ? entries[count - 1].end : 0;
+      for (uint16_t r = 0 ; r < used ; r += protocol::RecordHeaderSize + records[r + 2])
+      {
+        const size_t held = (size_t(records[r]) << 8) | records[r + 1];
+        const size_t begin = held < addr ? addr : held;
+        const size_t end = addr + size < held + records[r + 2] ? addr + size : held + records[r + 2];
+        if (end <= begin)
+          continue;
+        memcpy(records + r + protocol::RecordHeaderSize + (begin - held), data + (begin - addr), end - begin);
+        superseded++;
+      }
+    }
+
+    template <typename Falls>
+    bool is_due(const entry_t& entry, uint32_t phase, Falls& falls)
+    {
+      if (entry.forced || MaxPendingFrames < entry.frames)
+      {
+        forced++;
+        return true;
+      }
+      if (!entry.closed)
+        return false;
+      if (entry.target.mode == PresetFall)
+      {
+        if (falls(entry.target.preset) == entry.origin)
+          return false;
+        released++;
+        return true;
+      }
+      // Wrapping distances from the reception, the target is at most half a cycle behind
+      const int32_t distance = int32_t(entry.target.phase - entry.origin);
+      if (distance <= 0)
+      {
+        late++;
+        return true;
+      }
+      if (int32_t(phase - entry.origin) < distance)
+        return false;
+      released++;
+      return true;
+    }
+  };
+
+} // namespace quantize
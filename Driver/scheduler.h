@@ -0,0 +1,195 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+Warning :
+  Code written in this file must be platform independant.
+*/
+
+/// Durations in microseconds, bucketed by powers of two
+struct TimingHistogram
+{
+  static constexpr uint8_t BucketsCount = 16; ///!< Last bucket holds everything above 16ms
+
+  uint32_t buckets[BucketsCount];
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t sum;
+
+  void reset()
+  {
+    memset(this, 0, sizeof(TimingHistogram));
+    min = 0xFFFFFFFFu;
+  }
+
+  void add(uint32_t us)
+  {
+    buckets[bucket(us)]++;
+    count++;
+    sum += us;
+    if (us < min)
+      min = us;
+    if (max < us)
+      max = us;
+  }
+
+  uint32_t mean() const { return count ? sum / count : 0; }
+
+  /// Upper bound of the bucket holding the given percentile
+  uint32_t percentile(uint8_t percent) const
+  {
+    const uint32_t target = (uint64_t(count) * percent + 99) / 100;
+    uint32_t seen = 0;
+    for (uint8_t i = 0 ; i < BucketsCount ; ++i)
+    {
+      seen += buckets[i];
+      if (target <= seen)
+        return i + 1 < BucketsCount ? (2u << i) - 1 : max;
+    }
+    return max;
+  }
+
+  /// Bucket i holds [2^i, 2^(i+1)), bucket 0 also holds 0
+  static uint8_t bucket(uint32_t us)
+  {
+    const uint8_t log2 = us ? 31 - __builtin_clz(us) : 0;
+    return log2 < BucketsCount ? log2 : BucketsCount - 1;
+  }
+};
+
+/**
+ * Deadline based frame pacing in microseconds.
+ *
+ * Each frame is given a deadline one period after the previous one (not after
+ * the end of the previous frame) so rendering cost doesn't accumulate as jitter.
+ * The period adapts to the average busy time : it never goes under 'min_period'
+ * and is stretched when compute and show don't fit in it anymore.
+ * All comparisons are done on wrapping differences, micros() overflows every 71 minutes.
+ */
+struct FrameScheduler
+{
+  enum phase_e : uint8_t {
+    INPUT,   ///!< Time spent reading the controller messages
+    COMPUTE, ///!< Clocks update and rendering
+    SHOW,    ///!< Sending the leds
+    JITTER,  ///!< Delay between the deadline and the actual start of the frame
+    PHASES_COUNT
+  };
+
+  uint32_t min_period;   ///!< Target frame period
+  uint32_t max_period;   ///!< Upper bound of the adapted period
+  uint32_t period;       ///!< Current frame period
+  uint32_t deadline = 0; ///!< Start time of the next frame
+  uint32_t last_begin = 0; ///!< Start time of the current frame
+  uint32_t elapsed;        ///!< Between the starts of the previous and the current frame
+  uint32_t busy_avg = 0; ///!< Moving average of compute + show, in 1/8 us
+  uint32_t frames = 0;      ///!< Frames since the last stats reset
+  uint32_t late_frames = 0; ///!< Frames started more than a period late since the last stats reset
+  bool     started = false;
+
+  TimingHistogram histograms[PHASES_COUNT];
+
+  FrameScheduler(uint32_t min_period, uint32_t max_period)
+  : min_period(min_period), max_period(max_period), period(min_period), elapsed(min_period)
+  {
+    reset_stats();
+  }
+
+  /// Microseconds left before the next frame, negative when late
+  int32_t remaining(uint32_t now) const { return int32_t(deadline - now); }
+  bool is_due(uint32_t now) const { return remaining(now) <= 0; }
+
+  /// Call when a frame starts, after 'is_due' returned true
+  void begin_frame(uint32_t now)
+  {
+    const int32_t lateness = -remaining(now);
+    elapsed = started ? now - last_begin : min_period;
+    last_begin = now;
+    if (!started || int32_t(period) < lateness)
+    {
+      // First frame or more than a full frame late : restart from now instead of bursting
+      if (started)
+        late_frames++;
+      deadline = now;
+      started = true;
+    }
+    else
+    {
+      histograms[JITTER].add(lateness < 0 ? 0 : lateness);
+    }
+    deadline += period;
+    frames++;
+  }
+
+  void record(phase_e phase, uint32_t us)
+  {
+    histograms[phase].add(us);
+  }
+
+  /// Call once compute and show are done, adapts the period for the next frames
+  void end_frame(uint32_t busy_us)
+  {
+    // busy_avg += (busy - busy_avg) / 8, kept in 1/8 us
+    busy_avg = busy_avg - (busy_avg >> 3) + busy_us;
+    // Keep an eighth of the period free for the input
+    uint32_t target = (busy_avg >> 3) + (busy_avg >> 6);
+    if (target < min_period)
+      target = min_period;
+    if (max_period < target)
+      target = max_period;
+    period = target;
+  }
+
+  void reset_stats()
+  {
+    for (uint8_t i = 0 ; i < PHASES_COUNT ; ++i)
+      histograms[i].reset();
+    frames = 0;
+    late_frames = 0;
+  }
+};
+
+/// Integer square root, rounded down
+inline uint32_t isqrt32(uint32_t x)
+{
+  uint32_t root = 0;
+  for (uint32_t bit = uint32_t(1) << 30 ; bit ; bit >>= 2)
+  {
+    if (root + bit <= x)
+    {
+      x -= root + bit;
+      root = (root >> 1) + bit;
+    }
+    else
+      root >>= 1;
+  }
+  return root;
+}
+
+/**
+ * Fraction kept by a decay over 'elapsed_us', 'kept' being the fraction kept every
+ * 'reference_us', so a decay doesn't depend on the frame period. Both in UQ0.16,
+ * 'elapsed_us' is capped to 'max_us'.
+ *  kept ^ (elapsed / reference), the fractional power by square roots.
+ */
+inline uint32_t decay_for_elapsed(uint32_t kept, uint32_t elapsed_us, uint32_t reference_us, uint32_t max_us)
+{
+  if (0xFFFF < kept)
+    return 0x10000;
+  if (max_us < elapsed_us)
+    elapsed_us = max_us;
+  const uint32_t exponent = (uint64_t(elapsed_us) << 8) / reference_us; // UQ24.8
+  uint32_t result = 0x10000;
+  for (uint32_t i = exponent >> 8 ; i ; --i)
+    result = (result * kept) >> 16;
+  for (uint8_t bit = 0x80 ; bit ; bit >>= 1)
+  {
+    kept = isqrt32(kept << 16);
+    if (exponent & bit)
+      result = (result * kept) >> 16;
+  }
+  return result;
+}
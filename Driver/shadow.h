@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "protocol.h"
+
+/*
+Warning :
+  Code written in this file must be platform independant.
+*/
+
+/**
+ * Shadow copy of a state receiving the controller writes.
+ *
+ * Written bytes are tracked by blocks and copied into the live state by 'commit',
+ * called once per frame before rendering. Outside of a transaction every received
+ * frame is committed on the next rendered frame, inside a transaction nothing is
+ * until the 'Commit' marker, so a whole preset shows on a single frame.
+ * A transaction whose commit marker is lost is forced after 'MaxTransactionFrames'.
+ * Plain writes received before a transaction are copied when it begins, so that
+ * they never carry the blocks of a transaction still in progress.
+ */
+template <typename T, size_t BlockSize = 16>
+struct ShadowState
+{
+  static constexpr size_t BlocksCount = (sizeof(T) + BlockSize - 1) / BlockSize;
+  static constexpr uint16_t MaxTransactionFrames = 100;
+
+  T        shadow;
+  uint32_t dirty[(BlocksCount + 31) / 32];
+  bool     in_transaction = false;
+  bool     commit_pending = false;
+  uint16_t transaction_frames = 0; ///!< Rendered frames since the transaction began
+  uint32_t transactions = 0;       ///!< Committed transactions
+  uint32_t forced_commits = 0;     ///!< Transactions committed without their marker
+
+  /// Starts from the live state, which plain writes are flushed to when a transaction begins
+  void reset(T& live)
+  {
+    live_state = &live;
+    shadow = live;
+    memset(dirty, 0, sizeof(dirty));
+    in_transaction = false;
+    commit_pending = false;
+    transaction_frames = 0;
+  }
+
+  // Parser sink
+
+  size_t size() const { return sizeof(T); }
+
+  void write(size_t addr, const uint8_t* data, size_t size)
+  {
+    memcpy(((uint8_t*)&shadow) + addr, data, size);
+    for (size_t block = addr / BlockSize ; block * BlockSize < addr + size ; ++block)
+      dirty[block >> 5] |= 1u << (block & 31);
+  }
+
+  /// Only handles the transaction markers
+  void control(uint16_t marker, const uint8_t*, size_t)
+  {
+    if (marker == protocol::BeginTransaction)
+    {
+      if (!in_transaction && live_state)
+        copy_dirty(*live_state);
+      commit_pending = false;
+      in_transaction = true;
+      transaction_frames = 0;
+    }
+    else if (marker == protocol::Commit && in_transaction)
+    {
+      in_transaction = false;
+      commit_pending = true;
+      transactions++;
+    }
+  }
+
+  void end_frame()
+  {
+    if (!in_transaction)
+      commit_pending = true;
+  }
+
+  /// Writes to the live state at once, and to the shadow so that no later commit reverts it
+  void apply(T& live, size_t addr, const uint8_t* data, size_t size)
+  {
+    memcpy(((uint8_t*)&shadow) + addr, data, size);
+    memcpy(((uint8_t*)&live) + addr, data, size);
+  }
+
+  /// Copies the changed blocks into the live state, returns the number of copied bytes
+  size_t commit(T& live)
+  {
+    if (in_transaction && MaxTransactionFrames < ++transaction_frames)
+    {
+      in_transaction = false;
+      commit_pending = true;
+      forced_commits++;
+    }
+    if (!commit_pending)
+      return 0;
+    commit_pending = false;
+    return copy_dirty(live);
+  }
+
+private:
+
+  T* live_state = nullptr;
+
+  bool is_dirty(size_t block) const { return dirty[block >> 5] & (1u << (block & 31)); }
+
+  /// Copies runs of consecutive dirty blocks at once, returns the number of copied bytes
+  size_t copy_dirty(T& live)
+  {
+    size_t copied = 0;
+    size_t block = 0;
+    while (block < BlocksCount)
+    {
+      if (!is_dirty(block))
+      {
+        ++block;
+        continue;
+      }
+      const size_t first = block;
+      while (block < BlocksCount && is_dirty(block))
+        ++block;
+      const size_t begin = first * BlockSize;
+      const size_t end = block * BlockSize < sizeof(T) ? block * BlockSize : sizeof(T);
+      memcpy(((uint8_t*)&live) + begin, ((const uint8_t*)&shadow) + begin, end - begin);
+      copied += end - begin;
+    }
+    memset(dirty, 0, sizeof(dirty));
+    return copied;
+  }
+};
@@ -6,6 +6,7 @@
 #define PRESETS_COUNT 8
 #define PALETTES_COUNT 8
 #define SOLOS_COUNT 4
+#define AUDIO_BANDS_COUNT 8
 
 struct state_t {
 
@@ -22,6 +23,10 @@ struct state_t {
     uint8_t ribbons_count;
     uint8_t ribbons_lengths[MAX_RIBBONS_COUNT];
     uint8_t soloribbons_location[SOLOS_COUNT];
+    uint8_t ribbons_reversed[MAX_RIBBONS_COUNT];
+    uint8_t solo_ribbon;    ///!< Index of the solo ribbon, none if out of range
+    uint8_t module_length;  ///!< Leds per module, 0 for the default length
+    uint8_t telemetry_period; ///!< Binary telemetry period in tenths of second, 0 for the text status
   } setup;
 
   struct triggers_t {
@@ -40,7 +45,7 @@ struct state_t {
   } triggers;
 
   struct master_t {
-    float   bpm;
+    uint32_t bpm;                 ///!< UQ16.16, tenths of BPM
     uint8_t sync_correction;
 
     uint8_t brightness;
@@ -65,11 +70,13 @@ struct state_t {
     uint8_t colormod_osc;
     uint8_t colormod_width;
     uint8_t colormod_move;
+    uint8_t colormod_band;  ///!< Audio band replacing the oscillator, 1 based, 0 for the oscillator
     
     uint8_t maskmod_enable;
     uint8_t maskmod_osc;
     uint8_t maskmod_width;
     uint8_t maskmod_move;
+    uint8_t maskmod_band;   ///!< Audio band replacing the oscillator, 1 based, 0 for the oscillator
 
     uint8_t slicer_nslices;
     uint8_t slicer_useuneven;
@@ -94,4 +101,9 @@ struct state_t {
 
   } presets[PRESETS_COUNT];
 
+  /// Streamed by the controller once per frame, not a control
+  struct audio_t {
+    uint8_t bands[AUDIO_BANDS_COUNT]; ///!< Energy of each band, from the lows, 0 to 255
+  } audio;
+
 };
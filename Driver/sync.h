@@ -40,6 +40,84 @@ namespace opto
   };
 
 
+  /**
+   * Syncview trees flattened in a topologically ordered array.
+   *
+   * Each node's clock, period and phase are computed once per 'tick()',
+   * parents before children, so sampling time per pixel only reads cached values
+   * instead of walking the subsync chain.
+   */
+  template <typename Time, uint8_t N>
+  struct SyncGraph
+  {
+    static constexpr uint8_t NoParent = 0xFF;
+    static_assert(N < NoParent, "node indices must stay below the NoParent sentinel");
+
+    struct node_t
+    {
+      const Syncview<Time>* view;
+      uint8_t  parent;  ///!< Index of the subsync node, NoParent if bound to the Syncbase
+      Time     clock;
+      Time     period;
+      uint16_t phase;   ///!< clock % period in Q0.16
+    };
+
+    node_t  nodes[N];
+    uint8_t count = 0;
+
+    /// Adds 'view' after its subsync chain, returns its index or N if the graph is full
+    uint8_t add(const Syncview<Time>* view)
+    {
+      for (uint8_t i = 0 ; i < count ; ++i)
+        if (nodes[i].view == view)
+          return i;
+
+      uint8_t parent = NoParent;
+      if (view->subsync)
+      {
+        const uint8_t p = add(view->subsync);
+        if (N <= p)
+          return N;
+        parent = p;
+      }
+      if (N <= count)
+        return N;
+
+      nodes[count] = node_t{view, parent, 0, 0, 0};
+      return count++;
+    }
+
+    void tick()
+    {
+      for (uint8_t i = 0 ; i < count ; ++i)
+      {
+        node_t& node = nodes[i];
+        const Syncview<Time>& view = *node.view;
+
+        Time clock, period;
+        if (node.parent == NoParent)
+        {
+          clock = *view.sync->clock;
+          period = *view.sync->period;
+        }
+        else
+        {
+          clock = nodes[node.parent].clock;
+          period = nodes[node.parent].period;
+        }
+
+        node.clock = clock + view.phase;
+        node.period = view.subdivide_level < 0 ? period >> -view.subdivide_level : period << view.subdivide_level;
+        node.phase = 0 == node.period ? 0 : (uint64_t(node.clock % node.period) << 16) / node.period;
+      }
+    }
+
+    uint16_t phase(uint8_t i) const noexcept { return nodes[i].phase; }
+    Time clock(uint8_t i) const noexcept { return nodes[i].clock; }
+    Time period(uint8_t i) const noexcept { return nodes[i].period; }
+  };
+
+
   template <typename T>
   struct LFO
   {
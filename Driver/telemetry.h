@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "protocol.h"
+
+/*
+Warning :
+  Code written in this file must be platform independant.
+*/
+
+/**
+ * Driver to controller health report.
+ *
+ * Fixed layout, little endian on both sides, framed like the controller messages
+ * (CRC-16 then COBS), with an extra leading delimiter so any text printed
+ * before the frame is flushed as a separate chunk.
+ */
+struct telemetry_t
+{
+  static constexpr uint16_t Magic = 0x4F54; ///!< "TO"
+  static constexpr uint8_t  Version = 1;
+  static constexpr uint8_t  PhasesCount = 4;  ///!< Input, compute, show, jitter
+
+  struct phase_t
+  {
+    uint32_t min, max, avg; ///!< In microseconds
+  };
+
+  uint16_t magic;
+  uint8_t  version;
+  uint8_t  phases_count;
+  uint32_t sequence;
+  uint32_t uptime_ms;
+  uint32_t window_us;      ///!< Time covered by the report
+  uint32_t frames;         ///!< Frames rendered during the window
+  uint32_t late_frames;
+  uint32_t period_us;      ///!< Current frame period
+  phase_t  phases[PhasesCount];
+  uint32_t drops;          ///!< Dropped controller frames since boot
+  protocol::stats_t parser;
+};
+static_assert(sizeof(telemetry_t) == 100, "Telemetry layout changed, bump telemetry_t::Version");
+
+namespace telemetry
+{
+  static constexpr size_t MaxEncodedSize = 1 + sizeof(telemetry_t) + protocol::CrcSize + 2 + 1;
+
+  /// Encodes a report, returns the number of bytes to send
+  inline size_t encode(const telemetry_t& report, uint8_t* out)
+  {
+    uint8_t payload[sizeof(telemetry_t) + protocol::CrcSize];
+    memcpy(payload, &report, sizeof(telemetry_t));
+    out[0] = protocol::Delimiter;
+    return 1 + protocol::finish_frame(payload, sizeof(telemetry_t), out + 1);
+  }
+
+  /// Decodes one frame, without its delimiters, returns false if it isn't a valid report
+  inline bool decode(uint8_t* frame, size_t len, telemetry_t& report)
+  {
+    const size_t decoded = protocol::cobs_decode(frame, len);
+    if (decoded != sizeof(telemetry_t) + protocol::CrcSize)
+      return false;
+    const uint16_t crc = (uint16_t(frame[sizeof(telemetry_t)]) << 8) | frame[sizeof(telemetry_t) + 1];
+    if (crc != protocol::crc16(frame, sizeof(telemetry_t)))
+      return false;
+    memcpy(&report, frame, sizeof(telemetry_t));
+    return report.magic == telemetry_t::Magic && report.version == telemetry_t::Version;
+  }
+
+} // namespace telemetry
@@ -0,0 +1,75 @@
+/*
+* Host benchmark : Syncview recursion against the flattened SyncGraph
+*
+*   g++ -O2 -std=c++17 bench-sync-graph.cpp -o bench-sync-graph
+*/
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+// Arduino's random(max), used by utils.h
+long random(long max) { return rand() % max; }
+
+#include "../types.h"
+
+#include <chrono>
+#include <cstdio>
+
+static constexpr uint8_t Depth = 16;
+static constexpr uint32_t Pixels = 8 * 240;
+static constexpr uint32_t Frames = 200;
+
+int main(int argc, char * const argv[])
+{
+  using Time = uint32_t;
+  using clock = std::chrono::steady_clock;
+
+  Time master_clock = 0, master_period = 1 << 20;
+  opto::Syncbase<Time> base{&master_clock, &master_period};
+
+  // Deep subdivision tree : every view divides or multiplies its parent
+  opto::Syncview<Time> views[Depth];
+  for (uint8_t i = 0 ; i < Depth ; ++i)
+  {
+    views[i].phase = i * 1000;
+    views[i].subdivide_level = i % 2 ? 1 : -1;
+    views[i].sync = &base;
+    views[i].subsync = i ? views + i - 1 : nullptr;
+  }
+  const opto::Syncview<Time>& leaf = views[Depth - 1];
+
+  opto::SyncGraph<Time, Depth> graph;
+  const uint8_t leaf_index = graph.add(&leaf);
+
+  volatile uint32_t sink = 0;
+
+  auto begin = clock::now();
+  for (uint32_t f = 0 ; f < Frames ; ++f)
+  {
+    master_clock += 12345;
+    for (uint32_t p = 0 ; p < Pixels ; ++p)
+      sink = sink + uint32_t(leaf.eval<float>() * 65536.f);
+  }
+  const double recursive = std::chrono::duration<double, std::nano>(clock::now() - begin).count();
+
+  begin = clock::now();
+  for (uint32_t f = 0 ; f < Frames ; ++f)
+  {
+    master_clock += 12345;
+    graph.tick();
+    for (uint32_t p = 0 ; p < Pixels ; ++p)
+      sink = sink + graph.phase(leaf_index);
+  }
+  const double flattened = std::chrono::duration<double, std::nano>(clock::now() - begin).count();
+
+  // Both paths must agree on the phase
+  const uint32_t expected = uint32_t(leaf.eval<double>() * 65536.);
+  const uint32_t cached = graph.phase(leaf_index);
+
+  printf("Depth %u, %u pixels per frame\n", Depth, Pixels);
+  printf("Syncview::eval : %8.2f ns per sample\n", recursive / (Frames * Pixels));
+  printf("SyncGraph      : %8.2f ns per sample (%8.2f us per tick)\n", flattened / (Frames * Pixels), flattened / Frames / 1000.);
+  printf("Phase check    : %u / %u\n", cached, expected);
+
+  return (cached + 1 < expected || expected + 1 < cached) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,56 @@
+// g++ -std=c++11 -I.. tests-fixed-point.cpp -o tests-fixed-point
+
+#include "fixed_point.h"
+
+#include <stdio.h>
+
+using namespace fixed;
+
+static_assert((q16_16::from_float(-1.5f) * q16_16::from_float(2.25f)).raw == q16_16::from_float(-3.375f).raw, "signed mul");
+static_assert((uq16_16::from_int(3) / uq16_16::from_int(4)).raw == 0xC000, "div");
+static_assert(q16_16::from_float(-1.5f).to_int() == -2, "to_int rounds toward minus infinity");
+static_assert((uq8_8::from_int(255) + uq8_8::from_int(2)).raw == uq8_8::from_int(1).raw, "wrapping add");
+static_assert((uq8_8::from_int(0) - uq8_8::from_raw(1)).raw == 0xFFFF, "wrapping sub");
+static_assert(add_sat(uq8_8::from_int(200), uq8_8::from_int(100)).raw == 0xFFFF, "saturating add");
+static_assert(sub_sat(uq8_8::from_int(1), uq8_8::from_int(2)).raw == 0, "saturating sub");
+static_assert(sub_sat(q8_8::from_int(-100), q8_8::from_int(100)).raw == -0x8000, "saturating signed sub");
+static_assert(mul_sat(q8_8::from_int(100), q8_8::from_int(100)).raw == 0x7FFF, "saturating mul");
+static_assert(mul_sat(q8_8::from_int(-100), q8_8::from_int(100)).raw == -0x8000, "saturating negative mul");
+static_assert(uq16_16::from_float(2.5f).as<uint32_t, 8>().raw == 0x280, "narrowing");
+static_assert(q8_8::from_float(-2.5f).as<int32_t, 16>().raw == -0x28000, "widening");
+static_assert(mulhi(0x80000000u, 0x80000000u) == 0x40000000u, "mulhi");
+static_assert(mulhi(int32_t(-0x80000000ll), int32_t(0x40000000)) == -0x20000000, "signed mulhi");
+static_assert(hi8(recip32(2)) == 0x7F, "recip32");
+
+int main(int argc, char * const argv[])
+{
+  int errors = 0;
+
+  for (uint32_t n = 0 ; n < 0x10000 ; ++n)
+  {
+    if (div_by<60>(n) != n / 60 || div_by<7>(n) != n / 7 || div_by<255>(n) != n / 255)
+    {
+      printf("div_by(%u) mismatch\n", n);
+      ++errors;
+    }
+  }
+
+  // Every value of i maps to [0, 255] in increasing order
+  for (uint32_t max_i = 2 ; max_i < 2000 ; ++max_i)
+  {
+    uint8_t last = 0;
+    for (uint32_t i = 0 ; i < max_i ; ++i)
+    {
+      const uint8_t v = hi8(i * recip32(max_i));
+      if (v < last)
+      {
+        printf("map(%u, %u) is not monotonic\n", i, max_i);
+        ++errors;
+      }
+      last = v;
+    }
+  }
+
+  printf("%d errors\n", errors);
+  return errors ? 1 : 0;
+}
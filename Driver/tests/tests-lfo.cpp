@@ -0,0 +1,92 @@
+// g++ -std=c++11 -I.. tests-lfo.cpp -o tests-lfo
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <cmath>
+
+// Arduino's random(max), used by utils.h
+long random(long max) { return rand() % max; }
+
+#include "types.h"
+#include "lfo.h"
+
+#include <stdio.h>
+
+/**
+ * Fixed point LFO bank against the float w_* waveforms of utils.h,
+ * over a whole period for every deterministic waveform.
+ */
+
+static int errors = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d : %s\n", __FILE__, __LINE__, #cond); ++errors; } } while (0)
+
+using LFO = opto::LFO<float>;
+using Bank = opto::LFOBank<8>;
+
+/// Largest difference with the float waveform, in units of the full scale
+float max_error(LFO::WaveForm waveform, uint16_t p1, uint16_t p2)
+{
+  Bank bank;
+  bank.add(waveform, p1, p2);
+  const LFO::transfert_f reference = LFO::castWaveform(waveform);
+  float worst = 0;
+  for (uint32_t phase = 0 ; phase < 65536 ; phase += 7)
+  {
+    bank.phase[0] = phase;
+    bank.eval();
+    const float expected = reference(phase / 65536.f, 1.f, waveform == LFO::WNPH ? p1 : p1 / 65536.f, waveform == LFO::WNPH ? p2 : p2 / 65536.f);
+    const float error = std::fabs(bank.output[0] / 32767.f - (waveform == LFO::WCST ? expected * 2 - 1 : expected));
+    if (worst < error)
+      worst = error;
+  }
+  return worst;
+}
+
+void test_waveforms()
+{
+  CHECK(max_error(LFO::WSIN, 0, 0) < 1e-3f);
+  CHECK(max_error(LFO::WTRI, 0, 0) < 1e-3f);
+  CHECK(max_error(LFO::WSAW, 0, 0) < 1e-3f);
+  CHECK(max_error(LFO::WVAR, 20000, 50000) < 1e-3f);
+  CHECK(max_error(LFO::WVAR, 49152, 65535) < 1e-3f);
+  CHECK(max_error(LFO::WNPH, 3, 4) < 1e-3f);
+  CHECK(max_error(LFO::WCST, 40000, 0) < 1e-3f);
+
+  // The square breakpoint falls on a step : compare away from it
+  Bank bank;
+  bank.add(LFO::WSQR, 16384);
+  for (uint32_t phase = 0 ; phase < 65536 ; phase += 7)
+  {
+    bank.phase[0] = phase;
+    bank.eval();
+    CHECK(bank.output[0] == 32767 * opto::w_sqr(phase / 65536.f, 1.f, 0.25f, 0.f));
+  }
+}
+
+/// Every waveform stays in [-32767, 32767], the unipolar output never wraps
+void test_range()
+{
+  Bank bank;
+  for (uint8_t w = 0 ; w < LFO::Count ; ++w)
+    bank.add(LFO::WaveForm(w), w == LFO::WVAR ? 1 : 0, 65535);
+  for (uint32_t phase = 0 ; phase < 65536 ; ++phase)
+  {
+    for (uint8_t i = 0 ; i < bank.count ; ++i)
+      bank.phase[i] = phase;
+    bank.eval();
+    for (uint8_t i = 0 ; i < bank.count ; ++i)
+    {
+      CHECK(-32767 <= bank.output[i] && bank.output[i] <= 32767);
+      CHECK(0 < bank.unipolar(i));
+    }
+  }
+}
+
+int main(int argc, char * const argv[])
+{
+  test_waveforms();
+  test_range();
+  printf("%d errors\n", errors);
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,43 @@
+// g++ -std=c++11 -I.. tests-noise.cpp -o tests-noise
+
+#include "noise.h"
+
+#include <stdio.h>
+
+/**
+ * Counter based noise : golden values pin the hash and the sequences, a change of
+ * constants or of the seed layout shows here before it changes the shows.
+ */
+
+static int errors = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d : %s\n", __FILE__, __LINE__, #cond); ++errors; } } while (0)
+
+int main(int argc, char * const argv[])
+{
+  CHECK(noise::hash32(0) == 0);
+  CHECK(noise::hash32(1) == 0x688990c0u);
+  CHECK(noise::hash32(0xdeadbeefu) == 0xe628c683u);
+  CHECK(noise::hash32(0xffffffffu) == 0x6768824au);
+
+  const uint32_t seed = noise::seed(3, 5, 42, 1);
+  CHECK(seed == 0x9093e1edu);
+  CHECK(noise::eval8(seed, 0) == 39 && noise::eval16(seed, 0) == 10018);
+  CHECK(noise::eval8(seed, 1) == 252 && noise::eval16(seed, 1) == 64748);
+  CHECK(noise::eval8(seed, 1000) == 225 && noise::eval16(seed, 1000) == 57801);
+
+  // The high byte of eval16 is eval8, and channels give different sequences
+  for (uint32_t counter = 0 ; counter < 1000 ; ++counter)
+    CHECK(noise::eval16(seed, counter) >> 8 == noise::eval8(seed, counter));
+  CHECK(noise::seed(3, 5, 42, 0) != seed && noise::seed(3, 5, 43, 1) != seed);
+
+  // Roughly uniform : each of the 16 buckets within 10% of its share
+  uint32_t buckets[16] = { 0 };
+  for (uint32_t counter = 0 ; counter < 160000 ; ++counter)
+    buckets[noise::eval8(seed, counter) >> 4]++;
+  for (uint8_t i = 0 ; i < 16 ; ++i)
+    CHECK(9000 < buckets[i] && buckets[i] < 11000);
+
+  printf("%d errors\n", errors);
+  return errors ? 1 : 0;
+}
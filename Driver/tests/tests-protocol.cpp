@@ -0,0 +1,361 @@
+// g++ -std=c++11 -I.. tests-protocol.cpp -o tests-protocol
+
+#include "protocol.h"
+#include "shadow.h"
+#include "timesync.h"
+#include "clock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using stream_t = std::vector<uint8_t>;
+
+static constexpr size_t TargetSize = 1024;
+
+static int errors = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d : %s\n", __FILE__, __LINE__, #cond); ++errors; } } while (0)
+
+/// Frame holding one write of 'size' times 'value' at 'addr'
+stream_t make_frame(uint16_t addr, uint8_t size, uint8_t value)
+{
+  uint8_t payload[protocol::MaxPayloadSize];
+  uint8_t frame[protocol::MaxEncodedSize + 1];
+  uint8_t data[255];
+  for (size_t i = 0 ; i < size ; ++i)
+    data[i] = value;
+  size_t len = 0;
+  protocol::add_record(payload, len, addr, data, size);
+  return stream_t(frame, frame + protocol::finish_frame(payload, len, frame));
+}
+
+void append(stream_t& stream, const stream_t& frame)
+{
+  stream.insert(stream.end(), frame.begin(), frame.end());
+}
+
+void test_roundtrip()
+{
+  // Zero bytes in the payload, and runs longer than a COBS block
+  for (uint8_t value : {0x00, 0x01, 0xFF})
+  {
+    for (uint8_t size : {1, 4, 200, 251})
+    {
+      uint8_t target[TargetSize] = {0};
+      protocol::Parser parser;
+      const stream_t frame = make_frame(10, size, value);
+      for (size_t i = 0 ; i + 1 < frame.size() ; ++i)
+        CHECK(frame[i] != protocol::Delimiter);
+      CHECK(frame.back() == protocol::Delimiter);
+      CHECK(parser.feed(frame.data(), frame.size(), target, TargetSize) == 1);
+      for (size_t i = 0 ; i < size ; ++i)
+        CHECK(target[10 + i] == value);
+      CHECK(parser.stats.frames == 1 && parser.stats.writes == 1);
+    }
+  }
+}
+
+void test_batch()
+{
+  uint8_t payload[protocol::MaxPayloadSize];
+  uint8_t frame[protocol::MaxEncodedSize + 1];
+  uint8_t target[TargetSize] = {0};
+  const uint8_t a[] = {1, 2, 3}, b[] = {4, 0, 5};
+  size_t len = 0;
+  CHECK(protocol::add_record(payload, len, 0, a, sizeof(a)));
+  CHECK(protocol::add_record(payload, len, 100, b, sizeof(b)));
+  protocol::Parser parser;
+  CHECK(parser.feed(frame, protocol::finish_frame(payload, len, frame), target, TargetSize) == 1);
+  CHECK(target[0] == 1 && target[2] == 3 && target[100] == 4 && target[101] == 0 && target[102] == 5);
+  CHECK(parser.stats.writes == 2);
+
+  // Records that don't fit are refused
+  len = 0;
+  uint8_t big[255] = {0};
+  CHECK(protocol::add_record(payload, len, 0, big, 200));
+  CHECK(!protocol::add_record(payload, len, 0, big, 100));
+}
+
+void test_out_of_range()
+{
+  uint8_t target[TargetSize] = {0};
+  protocol::Parser parser;
+  const stream_t frame = make_frame(TargetSize - 2, 4, 0xAA);
+  CHECK(parser.feed(frame.data(), frame.size(), target, TargetSize) == 0);
+  CHECK(target[TargetSize - 1] == 0);
+  CHECK(parser.stats.range_errors == 1);
+}
+
+/// Corrupts a stream of frames, every intact frame after a corruption must still be applied
+void test_corrupted_streams()
+{
+  srand(42);
+  size_t applied = 0, intact = 0;
+  uint8_t target[TargetSize];
+  protocol::Parser parser;
+
+  for (int round = 0 ; round < 2000 ; ++round)
+  {
+    const uint16_t addr = rand() % (TargetSize - 16);
+    const uint8_t size = 1 + rand() % 16;
+    const uint8_t value = rand();
+    stream_t frame = make_frame(addr, size, value);
+
+    stream_t stream;
+    const int corruption = rand() % 5;
+    switch (corruption)
+    {
+    case 0: // Bit flip
+      frame[rand() % (frame.size() - 1)] ^= 1 << (rand() % 8);
+      break;
+    case 1: // Lost byte
+      frame.erase(frame.begin() + rand() % (frame.size() - 1));
+      break;
+    case 2: // Garbage before the frame, without delimiter
+      for (int i = 0 ; i < 20 ; ++i)
+        stream.push_back(1 + rand() % 255);
+      break;
+    case 3: // Truncated frame, the next delimiter resyncs
+      frame.resize(1 + rand() % (frame.size() - 1));
+      frame.push_back(protocol::Delimiter);
+      break;
+    default:
+      break;
+    }
+    append(stream, frame);
+
+    memset(target, 0, sizeof(target));
+    const size_t ok = parser.feed(stream.data(), stream.size(), target, TargetSize);
+    applied += ok;
+
+    // Garbage before a frame is dropped along with it, the frame after must be clean
+    const stream_t next = make_frame(addr, size, value);
+    memset(target, 0, sizeof(target));
+    CHECK(parser.feed(next.data(), next.size(), target, TargetSize) == 1);
+    for (size_t i = 0 ; i < size ; ++i)
+      CHECK(target[addr + i] == value);
+    intact++;
+    // A bit flip that still decodes must be caught by the CRC
+    if (corruption == 0 || corruption == 1)
+      CHECK(ok == 0);
+  }
+  CHECK(parser.stats.frames == applied + intact);
+  printf("%zu frames applied, %u framing errors, %u crc errors, %u range errors\n",
+    (size_t)parser.stats.frames, parser.stats.framing_errors, parser.stats.crc_errors, parser.stats.range_errors);
+}
+
+void test_overflow()
+{
+  uint8_t target[TargetSize] = {0};
+  protocol::Parser parser;
+  stream_t stream(protocol::MaxEncodedSize * 3, 0x11);
+  stream.push_back(protocol::Delimiter);
+  append(stream, make_frame(0, 1, 0x22));
+  CHECK(parser.feed(stream.data(), stream.size(), target, TargetSize) == 1);
+  CHECK(parser.stats.framing_errors == 1);
+  CHECK(target[0] == 0x22);
+}
+
+struct live_t
+{
+  uint8_t bytes[TargetSize];
+};
+
+stream_t make_payload_frame(uint8_t* payload, size_t len)
+{
+  uint8_t frame[protocol::MaxEncodedSize + 1];
+  return stream_t(frame, frame + protocol::finish_frame(payload, len, frame));
+}
+
+/// Writes land in the shadow and only show on the live state at commit
+void test_shadow()
+{
+  static live_t live;
+  memset(&live, 0, sizeof(live));
+  ShadowState<live_t> shadow;
+  shadow.reset(live);
+  protocol::Parser parser;
+
+  // Single frame, committed on the next rendered frame
+  const stream_t single = make_frame(40, 4, 0x11);
+  parser.feed(single.data(), single.size(), shadow);
+  CHECK(live.bytes[40] == 0);
+  CHECK(shadow.commit(live) == 16);
+  CHECK(live.bytes[40] == 0x11 && live.bytes[43] == 0x11);
+  CHECK(shadow.commit(live) == 0);
+
+  // Transaction over three frames, nothing shows before the commit marker
+  uint8_t payload[protocol::MaxPayloadSize];
+  uint8_t data[200];
+  memset(data, 0x22, sizeof(data));
+  size_t len = 0;
+  protocol::add_control(payload, len, protocol::BeginTransaction);
+  protocol::add_record(payload, len, 100, data, 200);
+  stream_t stream = make_payload_frame(payload, len);
+  len = 0;
+  protocol::add_record(payload, len, 500, data, 1);
+  append(stream, make_payload_frame(payload, len));
+  parser.feed(stream.data(), stream.size(), shadow);
+  CHECK(shadow.commit(live) == 0);
+  CHECK(live.bytes[100] == 0 && live.bytes[500] == 0);
+
+  len = 0;
+  protocol::add_record(payload, len, 1000, data, 1);
+  protocol::add_control(payload, len, protocol::Commit);
+  stream = make_payload_frame(payload, len);
+  parser.feed(stream.data(), stream.size(), shadow);
+  CHECK(0 < shadow.commit(live));
+  CHECK(live.bytes[100] == 0x22 && live.bytes[299] == 0x22 && live.bytes[500] == 0x22 && live.bytes[1000] == 0x22);
+  CHECK(live.bytes[40] == 0x11);
+  CHECK(shadow.transactions == 1);
+
+  // A lost commit marker doesn't freeze the state
+  len = 0;
+  protocol::add_control(payload, len, protocol::BeginTransaction);
+  protocol::add_record(payload, len, 600, data, 1);
+  stream = make_payload_frame(payload, len);
+  parser.feed(stream.data(), stream.size(), shadow);
+  for (uint16_t i = 0 ; i < ShadowState<live_t>::MaxTransactionFrames ; ++i)
+    CHECK(shadow.commit(live) == 0);
+  CHECK(shadow.commit(live) == 16);
+  CHECK(live.bytes[600] == 0x22 && shadow.forced_commits == 1);
+
+  // Plain write then a partial transaction on the same block : the plain write shows, the transaction doesn't
+  memset(data, 0x33, sizeof(data));
+  stream = make_frame(40, 1, 0x44);
+  len = 0;
+  protocol::add_control(payload, len, protocol::BeginTransaction);
+  protocol::add_record(payload, len, 32, data, 1);
+  protocol::add_record(payload, len, 700, data, 1);
+  append(stream, make_payload_frame(payload, len));
+  parser.feed(stream.data(), stream.size(), shadow);
+  shadow.commit(live);
+  CHECK(live.bytes[40] == 0x44);
+  CHECK(live.bytes[32] == 0 && live.bytes[700] == 0);
+
+  len = 0;
+  protocol::add_control(payload, len, protocol::Commit);
+  stream = make_payload_frame(payload, len);
+  parser.feed(stream.data(), stream.size(), shadow);
+  CHECK(0 < shadow.commit(live));
+  CHECK(live.bytes[32] == 0x33 && live.bytes[700] == 0x33 && live.bytes[40] == 0x44);
+}
+
+struct sync_sink_t
+{
+  std::vector<uint16_t> markers;
+  uint32_t ping = 0;
+
+  size_t size() const { return TargetSize; }
+  void write(size_t, const uint8_t*, size_t) {}
+  void control(uint16_t marker, const uint8_t* data, size_t size)
+  {
+    markers.push_back(marker);
+    if (marker == protocol::TimePing)
+      memcpy(&ping, data, size);
+  }
+  void end_frame() {}
+};
+
+/// Clock sync markers carry data, and their size is checked
+void test_timesync_markers()
+{
+  protocol::Parser parser;
+  sync_sink_t sink;
+  uint8_t payload[protocol::MaxPayloadSize];
+  size_t len = 0;
+  const uint32_t t1 = 0xDEADBEEF;
+  timesync::anchor_t anchor = { 1000, 0x80000000u };
+  protocol::add_control(payload, len, protocol::TimePing, (const uint8_t*)&t1);
+  protocol::add_control(payload, len, protocol::PhaseAnchor, (const uint8_t*)&anchor);
+  stream_t stream = make_payload_frame(payload, len);
+  CHECK(parser.feed(stream.data(), stream.size(), sink) == 1);
+  CHECK(sink.markers.size() == 2 && sink.ping == t1);
+
+  // A ping without its timestamp is dropped
+  len = 0;
+  protocol::add_record(payload, len, protocol::TimePing, nullptr, 0);
+  stream = make_payload_frame(payload, len);
+  CHECK(parser.feed(stream.data(), stream.size(), sink) == 0);
+  CHECK(parser.stats.range_errors == 1);
+
+  // Echoes go back framed like telemetry
+  timesync::echo_t echo = { timesync::echo_t::Magic, timesync::echo_t::Version, 0, t1, 2, 3 };
+  uint8_t frame[timesync::MaxEncodedSize];
+  const size_t size = timesync::encode(echo, frame);
+  CHECK(frame[0] == protocol::Delimiter && frame[size - 1] == protocol::Delimiter);
+  timesync::echo_t decoded;
+  CHECK(timesync::decode(frame + 1, size - 2, decoded) && decoded.t1 == t1 && decoded.t3 == 3);
+}
+
+/// Ticks a clock through a phase lock for 'frames' frames of 10ms, anchored every second
+///   on a free running reference shifted by 'shift', returns the mean error of the last half
+int32_t run_phase_lock(Clock& clock, Clock& reference, timesync::PhaseLock& lock, uint32_t& now_us,
+  uint32_t frames, uint32_t shift, bool anchored, int32_t* max_step)
+{
+  int64_t errors = 0;
+  for (uint32_t i = 0 ; i < frames ; ++i)
+  {
+    now_us += 10000;
+    reference.tick(now_us / 1000);
+    if (anchored && i % 100 == 0)
+      lock.set({ now_us, (reference.clock << 3) + shift });
+    const int64_t offset_before = lock.offset_ns;
+    clock.tick(lock.time_ms(now_us / 1000));
+    lock.update(now_us, clock.clock << 3, clock._dt << 3);
+    const int32_t step = (lock.offset_ns - offset_before) / 1000;
+    if (max_step && *max_step < (step < 0 ? -step : step))
+      *max_step = step < 0 ? -step : step;
+    if (frames / 2 <= i)
+      errors += lock.error_us;
+  }
+  return errors / (frames - frames / 2);
+}
+
+/// Small errors are slewed without changing the tempo much, large ones are jumped
+void test_phase_lock()
+{
+  Clock clock, reference;
+  clock.setPeriod(2000); // 2s master cycle
+  reference.setPeriod(2000);
+  timesync::PhaseLock lock;
+  uint32_t now_us = 0;
+
+  // 1/16 cycle (125ms) ahead
+  int32_t max_step = 0;
+  run_phase_lock(clock, reference, lock, now_us, 1000, 1u << 28, true, &max_step);
+  CHECK(lock.jumps == 0);
+  CHECK(max_step <= 10000 / timesync::PhaseLock::MaxSlew);
+  CHECK(-2000 < lock.error_us && lock.error_us < 2000);
+
+  // Half a cycle away : jumped at once
+  run_phase_lock(clock, reference, lock, now_us, 300, 1u << 31, true, nullptr);
+  CHECK(lock.jumps == 1);
+  CHECK(-2000 < lock.error_us && lock.error_us < 2000);
+
+  // Driver period 1ms off : the rate error is learnt, no lag is left
+  clock.setPeriod(2001);
+  const int32_t lag = run_phase_lock(clock, reference, lock, now_us, 3000, 1u << 31, true, nullptr);
+  CHECK(-200 < lag && lag < 200);
+  CHECK(lock.jumps == 1);
+
+  // Stale anchors are ignored
+  run_phase_lock(clock, reference, lock, now_us, 500, 0, false, nullptr);
+  CHECK(lock.error_us == 0);
+}
+
+int main(int argc, char * const argv[])
+{
+  test_roundtrip();
+  test_batch();
+  test_out_of_range();
+  test_corrupted_streams();
+  test_overflow();
+  test_shadow();
+  test_timesync_markers();
+  test_phase_lock();
+
+  printf("%d errors\n", errors);
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,350 @@
+// g++ -std=c++11 -I.. tests-quantize.cpp -o tests-quantize
+
+#include "protocol.h"
+#include "shadow.h"
+#include "quantize.h"
+#include "clock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+/**
+ * Quantized writes, through the parser and the shadow state as in the driver loop :
+ * frames of 10ms, the master cycle of 2s (4 beats at 120 BPM). Each write must show
+ * on the first frame whose master phase crossed its target, whatever its arrival time.
+ */
+
+using stream_t = std::vector<uint8_t>;
+
+static constexpr uint32_t FrameMs = 10;
+static constexpr uint32_t CycleMs = 2000;
+
+static int errors = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d : %s\n", __FILE__, __LINE__, #cond); ++errors; } } while (0)
+
+struct test_state_t
+{
+  uint8_t bytes[1200];
+};
+
+// Clocks register themselves for good, they are shared by the tests
+Clock master_clock, beat_clock, reference_clock;
+FallDetector beat_detector;
+
+void restart(Clock& clock, uint32_t period)
+{
+  clock.clock = 0;
+  clock.last_timestamp = 0;
+  clock.setPeriod(period);
+}
+
+/// The driver main loop, without the rendering
+struct driver_t
+{
+  test_state_t live;
+  ShadowState<test_state_t> shadow;
+  quantize::PendingQueue<> pending;
+  protocol::Parser parser;
+  Clock& master = master_clock;
+  Clock& beat = beat_clock;
+  FallDetector& detector = beat_detector;
+  uint32_t now_ms = 0;
+
+  driver_t()
+  {
+    memset(&live, 0, sizeof(live));
+    shadow.reset(live);
+    restart(master, CycleMs);
+    restart(beat, CycleMs / 4);
+    detector.clock = &beat;
+    detector.last_value = 0;
+    detector.count = 0;
+    detector.reset();
+  }
+
+  uint32_t phase() const { return master.clock << 3; }
+
+  // Parser sink, as 'controller_sink_t'
+  size_t size() const { return shadow.size(); }
+  void write(size_t addr, const uint8_t* data, size_t size)
+  {
+    if (!pending.write(addr, data, size))
+      shadow.write(addr, data, size);
+  }
+  void end_frame() { shadow.end_frame(); }
+  void control(uint16_t marker, const uint8_t* data, size_t size)
+  {
+    if (marker == protocol::Quantize)
+    {
+      if (!shadow.in_transaction)
+        return;
+      quantize::target_t target;
+      memcpy(&target, data, sizeof(target));
+      pending.begin(target, target.mode == quantize::PresetFall ? detector.count : phase());
+      return;
+    }
+    if (marker == protocol::BeginTransaction || marker == protocol::Commit)
+      pending.close();
+    shadow.control(marker, data, size);
+  }
+
+  void receive(const stream_t& stream) { parser.feed(stream.data(), stream.size(), *this); }
+
+  /// One rendered frame
+  void frame()
+  {
+    now_ms += FrameMs;
+    shadow.commit(live);
+    master.tick(now_ms);
+    beat.tick(now_ms);
+    detector.tick();
+    pending.release(phase(),
+      [this](uint8_t) { return detector.count; },
+      [this](size_t addr, const uint8_t* data, size_t size) { shadow.apply(live, addr, data, size); });
+  }
+};
+
+/// Transaction writing 'size' times 'value' at 'addr', held until 'target', in as many frames as needed
+stream_t make_quantized(const quantize::target_t& target, uint16_t addr, size_t size, uint8_t value)
+{
+  stream_t stream;
+  uint8_t payload[protocol::MaxPayloadSize];
+  uint8_t frame[protocol::MaxEncodedSize + 1];
+  size_t len = 0;
+  protocol::add_control(payload, len, protocol::BeginTransaction);
+  protocol::add_control(payload, len, protocol::Quantize, (const uint8_t*)&target);
+  uint8_t data[200];
+  memset(data, value, sizeof(data));
+  for (size_t done = 0 ; done < size ; )
+  {
+    const uint8_t chunk = size - done < sizeof(data) ? size - done : sizeof(data);
+    if (!protocol::add_record(payload, len, addr + done, data, chunk))
+    {
+      const size_t encoded = protocol::finish_frame(payload, len, frame);
+      stream.insert(stream.end(), frame, frame + encoded);
+      len = 0;
+      continue;
+    }
+    done += chunk;
+  }
+  protocol::add_control(payload, len, protocol::Commit);
+  const size_t encoded = protocol::finish_frame(payload, len, frame);
+  stream.insert(stream.end(), frame, frame + encoded);
+  return stream;
+}
+
+stream_t make_write(uint16_t addr, uint8_t value)
+{
+  uint8_t payload[protocol::MaxPayloadSize];
+  uint8_t frame[protocol::MaxEncodedSize + 1];
+  size_t len = 0;
+  protocol::add_record(payload, len, addr, &value, 1);
+  return stream_t(frame, frame + protocol::finish_frame(payload, len, frame));
+}
+
+quantize::target_t at_phase(uint32_t phase) { return quantize::target_t{ quantize::MasterPhase, 0, 0, phase }; }
+
+void test_frame_exact()
+{
+  // The same beat, the transaction arriving anywhere up to 400ms before it
+  uint32_t exact = 0;
+  for (int trial = 0 ; trial < 200 ; ++trial)
+  {
+    driver_t driver;
+    const uint32_t target = 0x40000000u * (1 + trial % 3);
+    // First frame crossing the target, from a clock ticked alone
+    Clock& reference = reference_clock;
+    restart(reference, CycleMs);
+    uint32_t expected = 0;
+    for (uint32_t f = 1 ; !expected ; ++f)
+    {
+      const uint32_t before = reference.clock << 3;
+      reference.tick(f * FrameMs);
+      if (before < target && target <= (reference.clock << 3))
+        expected = f;
+    }
+
+    const uint32_t arrival = expected * FrameMs - 20 - rand() % 400;
+    uint32_t applied = 0;
+    for (uint32_t f = 1 ; f <= expected + 10 ; ++f)
+    {
+      if (driver.now_ms < arrival && arrival <= driver.now_ms + FrameMs)
+        driver.receive(make_quantized(at_phase(target), 100, 4, 0x42));
+      driver.frame();
+      if (!applied && driver.live.bytes[100] == 0x42)
+        applied = f;
+    }
+    exact += applied == expected;
+    CHECK(applied == expected);
+    CHECK(driver.live.bytes[103] == 0x42 && driver.live.bytes[104] == 0);
+  }
+  printf("Frame exact : %u / 200\n", exact);
+}
+
+void test_late_and_plain()
+{
+  driver_t driver;
+  for (int f = 0 ; f < 60 ; ++f)
+    driver.frame();
+  // Target half a beat behind : applied on the next frame
+  driver.receive(make_quantized(at_phase(driver.phase() - 0x10000000u), 10, 1, 7));
+  CHECK(driver.live.bytes[10] == 0);
+  driver.frame();
+  CHECK(driver.live.bytes[10] == 7 && driver.pending.late == 1);
+
+  // Outside a transaction the marker is ignored
+  uint8_t payload[protocol::MaxPayloadSize];
+  uint8_t frame[protocol::MaxEncodedSize + 1];
+  size_t len = 0;
+  const quantize::target_t target = at_phase(driver.phase() + 0x20000000u);
+  protocol::add_control(payload, len, protocol::Quantize, (const uint8_t*)&target);
+  const uint8_t value = 9;
+  protocol::add_record(payload, len, 11, &value, 1);
+  driver.receive(stream_t(frame, frame + protocol::finish_frame(payload, len, frame)));
+  driver.frame();
+  CHECK(driver.live.bytes[11] == 9 && driver.pending.count == 0);
+
+  // Plain writes go on while a transaction waits, and a later commit of the block doesn't revert it
+  driver.receive(make_quantized(at_phase(driver.phase() + 0x08000000u), 20, 1, 1));
+  driver.receive(make_write(21, 2));
+  driver.frame();
+  CHECK(driver.live.bytes[20] == 0 && driver.live.bytes[21] == 2);
+  for (int f = 0 ; f < 30 ; ++f)
+    driver.frame();
+  CHECK(driver.live.bytes[20] == 1);
+  driver.receive(make_write(22, 3));
+  driver.frame();
+  CHECK(driver.live.bytes[20] == 1 && driver.live.bytes[22] == 3);
+}
+
+void test_superseded()
+{
+  driver_t driver;
+  driver.frame();
+  // A fader moved while a preset waits for its beat keeps its new value
+  driver.receive(make_quantized(at_phase(driver.phase() + 0x10000000u), 60, 1, 1));
+  driver.receive(make_quantized(at_phase(driver.phase() + 0x10000000u), 70, 4, 1));
+  driver.frame();
+  driver.receive(make_write(60, 2));
+  driver.receive(make_write(72, 9));
+  driver.frame();
+  CHECK(driver.live.bytes[60] == 2 && driver.live.bytes[72] == 9 && driver.live.bytes[70] == 0);
+  for (int f = 0 ; f < 40 ; ++f)
+    driver.frame();
+  CHECK(driver.pending.count == 0 && driver.pending.released == 2 && driver.pending.superseded == 2);
+  CHECK(driver.live.bytes[60] == 2);
+  CHECK(driver.live.bytes[70] == 1 && driver.live.bytes[71] == 1 && driver.live.bytes[72] == 9 && driver.live.bytes[73] == 1);
+  CHECK(driver.shadow.shadow.bytes[60] == 2 && driver.shadow.shadow.bytes[72] == 9);
+
+  // Writes past the room of their transaction go at once, its held ones don't revert them
+  stream_t stream;
+  uint8_t payload[protocol::MaxPayloadSize];
+  uint8_t frame[protocol::MaxEncodedSize + 1];
+  size_t len = 0;
+  const quantize::target_t target = at_phase(driver.phase() + 0x20000000u);
+  const uint8_t held = 3, later = 4;
+  uint8_t data[200];
+  memset(data, 5, sizeof(data));
+  protocol::add_control(payload, len, protocol::BeginTransaction);
+  protocol::add_control(payload, len, protocol::Quantize, (const uint8_t*)&target);
+  protocol::add_record(payload, len, 1150, &held, 1);
+  for (uint16_t addr = 0 ; addr < 1100 ; addr += 100)
+    if (!protocol::add_record(payload, len, addr, data, 100))
+    {
+      stream.insert(stream.end(), frame, frame + protocol::finish_frame(payload, len, frame));
+      len = 0;
+      addr -= 100;
+    }
+  protocol::add_record(payload, len, 1150, &later, 1);
+  protocol::add_control(payload, len, protocol::Commit);
+  stream.insert(stream.end(), frame, frame + protocol::finish_frame(payload, len, frame));
+  driver.receive(stream);
+  CHECK(driver.pending.overflows == 1);
+  driver.frame();
+  CHECK(driver.live.bytes[1150] == 4 && driver.live.bytes[1099] == 5);
+  driver.frame();
+  CHECK(driver.live.bytes[1150] == 4 && driver.pending.count == 0);
+}
+
+void test_order_and_room()
+{
+  driver_t driver;
+  driver.frame();
+  // Released out of reception order, the kept records are compacted
+  const uint32_t phase = driver.phase();
+  driver.receive(make_quantized(at_phase(phase + 0x30000000u), 200, 50, 3));
+  driver.receive(make_quantized(at_phase(phase + 0x10000000u), 300, 50, 1));
+  driver.receive(make_quantized(at_phase(phase + 0x20000000u), 400, 50, 2));
+  driver.receive(make_quantized(at_phase(phase + 0x10000000u), 300, 1, 4));
+  CHECK(driver.pending.count == 4);
+  uint32_t frames[5] = { 0 };
+  for (uint32_t f = 1 ; f < 200 ; ++f)
+  {
+    driver.frame();
+    if (!frames[1] && driver.live.bytes[349] == 1)
+      frames[1] = f;
+    if (!frames[2] && driver.live.bytes[449] == 2)
+      frames[2] = f;
+    if (!frames[3] && driver.live.bytes[249] == 3)
+      frames[3] = f;
+  }
+  CHECK(frames[1] && frames[1] < frames[2] && frames[2] < frames[3]);
+  CHECK(driver.live.bytes[300] == 4 && driver.live.bytes[301] == 1);
+  CHECK(driver.pending.count == 0 && driver.pending.released == 4);
+
+  // Too large to hold : on the next frame, as a plain transaction
+  driver.receive(make_quantized(at_phase(driver.phase() + 0x20000000u), 0, 1100, 5));
+  CHECK(driver.pending.overflows == 1);
+  driver.frame();
+  CHECK(driver.live.bytes[0] == 5 && driver.live.bytes[1099] == 5 && driver.pending.count == 0);
+
+  // Lost commit : forced after 'MaxPendingFrames'
+  uint8_t payload[protocol::MaxPayloadSize];
+  uint8_t frame[protocol::MaxEncodedSize + 1];
+  size_t len = 0;
+  const quantize::target_t target = at_phase(driver.phase() + 0x20000000u);
+  const uint8_t value = 6;
+  protocol::add_control(payload, len, protocol::BeginTransaction);
+  protocol::add_control(payload, len, protocol::Quantize, (const uint8_t*)&target);
+  protocol::add_record(payload, len, 1150, &value, 1);
+  driver.receive(stream_t(frame, frame + protocol::finish_frame(payload, len, frame)));
+  for (uint32_t f = 0 ; f < decltype(driver.pending)::MaxPendingFrames ; ++f)
+    driver.frame();
+  CHECK(driver.live.bytes[1150] == 0);
+  driver.frame();
+  CHECK(driver.live.bytes[1150] == 6 && driver.pending.forced == 2);
+}
+
+void test_preset_fall()
+{
+  driver_t driver;
+  for (int f = 0 ; f < 7 ; ++f)
+    driver.frame();
+  driver.receive(make_quantized(quantize::target_t{ quantize::PresetFall, 0, 0, 0 }, 50, 1, 8));
+  uint32_t applied = 0, fell = 0;
+  for (uint32_t f = 1 ; f < 100 ; ++f)
+  {
+    driver.frame();
+    if (!applied && driver.live.bytes[50] == 8)
+      applied = f;
+    if (!fell && driver.detector.trigger)
+      fell = f;
+  }
+  CHECK(applied && applied == fell);
+  printf("Preset fall : applied on frame %u, detector fell on frame %u\n", applied, fell);
+}
+
+int main(int argc, char * const argv[])
+{
+  srand(argc >= 2 ? atoi(argv[1]) : 1);
+  test_frame_exact();
+  test_late_and_plain();
+  test_superseded();
+  test_order_and_room();
+  test_preset_fall();
+
+  printf("%d errors\n", errors);
+  return errors ? 1 : 0;
+}
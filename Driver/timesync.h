@@ -0,0 +1,158 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "protocol.h"
+
+/*
+Warning :
+  Code written in this file must be platform independant.
+*/
+
+/**
+ * Clock synchronisation between the controller and the driver.
+ *
+ * The controller sends 'TimePing' markers holding its time t1, the driver echoes
+ * t1 with its receive time t2 and send time t3, the controller notes the arrival t4 :
+ * the round trip is (t4 - t1) - (t3 - t2) and the driver clock is ahead of the
+ * controller by ((t2 - t1) + (t3 - t4)) / 2, as in NTP.
+ * With that offset the controller sends 'PhaseAnchor' markers : the master cycle
+ * phase the driver should show at a given time of its own clock.
+ * All times are microseconds and wrap around.
+ */
+namespace timesync
+{
+  struct echo_t
+  {
+    static constexpr uint16_t Magic = 0x4554; ///!< "TE"
+    static constexpr uint8_t  Version = 1;
+
+    uint16_t magic;
+    uint8_t  version;
+    uint8_t  reserved;
+    uint32_t t1; ///!< Controller time of the ping
+    uint32_t t2; ///!< Driver time when the ping was parsed
+    uint32_t t3; ///!< Driver time when the echo was sent
+  };
+  static_assert(sizeof(echo_t) == 16, "Echo layout changed, bump echo_t::Version");
+
+  struct anchor_t
+  {
+    uint32_t time_us; ///!< Driver time
+    uint32_t phase;   ///!< UQ0.32 master cycle phase at that time
+  };
+  static_assert(sizeof(anchor_t) == 8, "Anchor size is fixed by protocol::control_size");
+
+  static constexpr size_t MaxEncodedSize = 1 + sizeof(echo_t) + protocol::CrcSize + 1 + 1;
+
+  /// Encodes an echo like a telemetry report, returns the number of bytes to send
+  inline size_t encode(const echo_t& echo, uint8_t* out)
+  {
+    uint8_t payload[sizeof(echo_t) + protocol::CrcSize];
+    memcpy(payload, &echo, sizeof(echo_t));
+    out[0] = protocol::Delimiter;
+    return 1 + protocol::finish_frame(payload, sizeof(echo_t), out + 1);
+  }
+
+  /// Decodes one frame, without its delimiters, returns false if it isn't a valid echo
+  inline bool decode(uint8_t* frame, size_t len, echo_t& echo)
+  {
+    const size_t decoded = protocol::cobs_decode(frame, len);
+    if (decoded != sizeof(echo_t) + protocol::CrcSize)
+      return false;
+    const uint16_t crc = (uint16_t(frame[sizeof(echo_t)]) << 8) | frame[sizeof(echo_t) + 1];
+    if (crc != protocol::crc16(frame, sizeof(echo_t)))
+      return false;
+    memcpy(&echo, frame, sizeof(echo_t));
+    return echo.magic == echo_t::Magic && echo.version == echo_t::Version;
+  }
+
+  /**
+   * Keeps the driver clocks on the received anchors.
+   *
+   * The clocks are ticked with 'time_ms()', the driver time shifted by 'offset_ns'.
+   * Shifting the time rather than a phase moves every clock by the same duration,
+   * so oscillators keep their ratios to the master clock. Small errors are slewed
+   * by at most 1/MaxSlew of the elapsed time, so the tempo never visibly changes,
+   * errors above 1/JumpFraction of a cycle (first anchor, lost sync) are jumped.
+   * The slew is proportional-integral : the integral learns the steady rate error
+   * (crystal, integer clock period), which would otherwise leave a constant lag.
+   * It only integrates small errors, so slewing a large one doesn't overshoot.
+   */
+  struct PhaseLock
+  {
+    static constexpr uint32_t AnchorTimeout = 4000000; ///!< Older anchors are ignored, the tempo may have changed since
+    static constexpr uint32_t TimeConstant = 1000000;  ///!< An error is slewed in about this time, in us
+    static constexpr int32_t  MaxSlew = 32;
+    static constexpr int32_t  JumpFraction = 8;
+    static constexpr int32_t  IntegralRange = 4000;   ///!< Larger errors are slewed without learning the rate, in us
+
+    anchor_t anchor = {0, 0};
+    bool     has_anchor = false;
+    int64_t  offset_ns = 0;    ///!< Clocks time shift
+    int32_t  drift_ppb = 0;    ///!< Learnt rate correction, in ns per second
+    int32_t  error_us = 0;     ///!< Last measured phase error
+    uint32_t last_update = 0;
+    uint32_t anchors = 0;
+    uint32_t jumps = 0;
+
+    void set(const anchor_t& a)
+    {
+      anchor = a;
+      has_anchor = true;
+      anchors++;
+    }
+
+    /// Time to tick the clocks with
+    uint32_t time_ms(uint32_t millis) const { return millis + int32_t(offset_ns / 1000000); }
+
+    /// Compares the master phase to the anchor, 'rate' is the master phase increment per ms in UQ0.32
+    void update(uint32_t now_us, uint32_t phase, uint32_t rate)
+    {
+      uint32_t elapsed = now_us - last_update;
+      last_update = now_us;
+      // Never step past the error, whatever the time since the last update
+      if (TimeConstant < elapsed)
+        elapsed = TimeConstant;
+      const int32_t since = int32_t(now_us - anchor.time_us);
+      if (!has_anchor || rate == 0 || int32_t(AnchorTimeout) < since || since < -int32_t(AnchorTimeout))
+      {
+        error_us = 0;
+        return;
+      }
+
+      // Wrapping difference, the error is at most half a cycle
+      const uint32_t expected = anchor.phase + uint32_t(int64_t(since) * rate / 1000);
+      const int32_t error = int32_t(expected - phase);
+      error_us = int64_t(error) * 1000 / rate;
+
+      const int64_t cycle_us = (int64_t(1) << 32) * 1000 / rate;
+      if (cycle_us / JumpFraction < (error_us < 0 ? -error_us : error_us))
+      {
+        offset_ns += int64_t(error_us) * 1000;
+        jumps++;
+        return;
+      }
+
+      // Integral gain of a quarter of the proportional gain squared, critically damped
+      const int32_t max_drift = 1000000000 / MaxSlew / 2;
+      if (-IntegralRange < error_us && error_us < IntegralRange)
+        drift_ppb += int64_t(error_us) * elapsed * 1000 / (4 * int64_t(TimeConstant) * TimeConstant / 1000000);
+      if (max_drift < drift_ppb)
+        drift_ppb = max_drift;
+      if (drift_ppb < -max_drift)
+        drift_ppb = -max_drift;
+
+      int64_t step = int64_t(error_us) * elapsed * 1000 / TimeConstant + int64_t(drift_ppb) * elapsed / 1000000;
+      const int64_t max_step = int64_t(elapsed) * 1000 / MaxSlew;
+      if (max_step < step)
+        step = max_step;
+      if (step < -max_step)
+        step = -max_step;
+      offset_ns += step;
+    }
+  };
+
+} // namespace timesync
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "Constants.h"
+#include "state.h"
+
+/*
+Warning :
+  Code written in this file must be platform independant.
+*/
+
+/// One physical output segment, wired on a parallel output port
+struct segment_t
+{
+  uint16_t offset;    ///!< Index of the first led in the packed leds buffer
+  uint16_t length;    ///!< Number of leds
+  uint8_t  modules;   ///!< Number of modules, used to scale slicers
+  int8_t   direction; ///!< 1 if wired from the controller side, -1 if wired backward
+  int16_t  x, y;      ///!< Optional position of the segment in the installation
+};
+
+/// Precomputed rendering target for one segment
+struct render_plan_t
+{
+  uint16_t offset;    ///!< First rendered led in the packed buffer
+  uint16_t length;
+  uint8_t  modules;
+  int8_t   direction;
+  uint8_t  side;      ///!< Half of the installation the segment belongs to
+  bool     is_solo;   ///!< True for the solo segment
+};
+
+/**
+ * Setup-time description of the installation.
+ *
+ * Segments are packed port by port with a stride equal to the longest segment,
+ * as required by the parallel output, and render plans are only rebuilt
+ * when the ribbons layout or the solo controls change.
+ */
+struct Topology
+{
+  segment_t     segments[MaxRibbonsCount];
+  render_plan_t plans[MaxRibbonsCount];
+  uint8_t       segments_count = 0;
+  uint16_t      port_stride = 0; ///!< Leds per port in the packed buffer
+  uint16_t      leds_count = 0;  ///!< Used leds in the packed buffer
+
+  /// Returns true if the topology has been rebuilt
+  bool update(const state_t& state)
+  {
+    if (is_built
+      && same_layout(cached_setup, state.setup)
+      && cached_solo_enable == state.master.solo_enable
+      && cached_solo_index == state.master.solo_index)
+      return false;
+
+    cached_setup = state.setup;
+    cached_solo_enable = state.master.solo_enable;
+    cached_solo_index = state.master.solo_index;
+    is_built = true;
+
+    build_segments(state.setup);
+    build_plans(state);
+    return true;
+  }
+
+  static uint16_t module_length(const state_t::setup_t& setup)
+  {
+    return setup.module_length ? setup.module_length : DefaultModuleLength;
+  }
+
+private:
+
+  state_t::setup_t cached_setup;
+  uint8_t cached_solo_enable = 0;
+  uint8_t cached_solo_index = 0;
+  bool is_built = false;
+
+  /// Compares only the fields the segments and plans are built from, other setup values must not black out the leds
+  static bool same_layout(const state_t::setup_t& a, const state_t::setup_t& b)
+  {
+    return a.ribbons_count == b.ribbons_count
+      && 0 == memcmp(a.ribbons_lengths, b.ribbons_lengths, sizeof(a.ribbons_lengths))
+      && 0 == memcmp(a.soloribbons_location, b.soloribbons_location, sizeof(a.soloribbons_location))
+      && 0 == memcmp(a.ribbons_reversed, b.ribbons_reversed, sizeof(a.ribbons_reversed))
+      && a.solo_ribbon == b.solo_ribbon
+      && a.module_length == b.module_length;
+  }
+
+  void build_segments(const state_t::setup_t& setup)
+  {
+    const uint16_t modlen = module_length(setup);
+
+    segments_count = setup.ribbons_count < MaxRibbonsCount ? setup.ribbons_count : MaxRibbonsCount;
+    port_stride = 0;
+    for (uint8_t i = 0 ; i < segments_count ; ++i)
+    {
+      uint16_t length = modlen * setup.ribbons_lengths[i];
+      if (MaxLedsPerRibbon < length)
+        length = MaxLedsPerRibbon;
+      segments[i].length = length;
+      segments[i].modules = length / modlen;
+      segments[i].direction = setup.ribbons_reversed[i] ? -1 : 1;
+      segments[i].x = i;
+      segments[i].y = 0;
+      if (port_stride < length)
+        port_stride = length;
+    }
+    for (uint8_t i = 0 ; i < segments_count ; ++i)
+      segments[i].offset = i * port_stride;
+    leds_count = segments_count * port_stride;
+  }
+
+  void build_plans(const state_t& state)
+  {
+    const uint16_t modlen = module_length(state.setup);
+
+    for (uint8_t i = 0 ; i < segments_count ; ++i)
+    {
+      const segment_t& segment = segments[i];
+      render_plan_t& plan = plans[i];
+
+      plan.offset = segment.offset;
+      plan.length = segment.length;
+      plan.modules = segment.modules;
+      plan.direction = segment.direction;
+      plan.side = i < (segments_count / 2);
+      plan.is_solo = i == state.setup.solo_ribbon;
+
+      // When soloing, only the selected module of the solo segment is rendered
+      if (plan.is_solo && state.master.solo_enable && state.master.solo_index < SOLOS_COUNT)
+      {
+        const uint16_t module = state.setup.soloribbons_location[state.master.solo_index];
+        if (module < segment.modules)
+        {
+          plan.offset += module * modlen;
+          plan.length = modlen;
+          plan.modules = 1;
+        }
+      }
+    }
+  }
+};
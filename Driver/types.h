@@ -24,6 +24,7 @@ namespace opto
       Size segment_count = 0;
 
       Syncview<Time> time;
+      uint16_t phase = 0; ///!< Phase of 'time' in Q0.16, sampled once per frame
     };
 
     Context         frame_context;
@@ -33,16 +34,52 @@ namespace opto
     Context& operator* () const noexcept { return local_context; }
   };
 
+  /**
+   * Effects process a whole pixel range of 'datas.local_context' per call.
+   *
+   * A chain is an array of 'node_t', each effect receives the whole chain
+   * ('_chain_begin', '_chain_end') and its own node ('_subchain'), and is
+   * responsible for calling 'next()' to run the remaining effects, possibly
+   * several times on subranges, or not at all.
+   */
   template <typename Color, typename Size, typename Time>
   struct Effect
   {
-    using RenderDatas = RenderDatas<Color, Size, Time>;
+    using RenderDatas = opto::RenderDatas<Color, Size, Time>;
+    using Context = typename RenderDatas::Context;
     using effect_t = void (*)(
       const RenderDatas& datas, 
       void* _chain_begin, 
       void* _subchain,
       void* _chain_end);
-    
+
+    struct node_t
+    {
+      effect_t effect;
+      const void* params; ///!< Effect specific parameters
+    };
+
+    /// Runs the chain [begin, end[ on the local context of 'datas'
+    static void run(const RenderDatas& datas, const node_t* begin, const node_t* end) noexcept
+    {
+      if (begin != end)
+        begin->effect(datas, (void*)begin, (void*)begin, (void*)end);
+    }
+
+    /// Runs the effects following '_subchain'
+    static void next(const RenderDatas& datas, void* _chain_begin, void* _subchain, void* _chain_end) noexcept
+    {
+      const node_t* following = static_cast<const node_t*>(_subchain) + 1;
+      if (following != _chain_end)
+        following->effect(datas, _chain_begin, (void*)following, _chain_end);
+    }
+
+    template <typename Params>
+    static const Params& params(void* _subchain) noexcept
+    {
+      return *static_cast<const Params*>(static_cast<const node_t*>(_subchain)->params);
+    }
+
     static void fill_black(const RenderDatas& datas) noexcept
     {
       for (
@@ -53,6 +90,39 @@ namespace opto
         datas.ribbon[i] = Color(0); 
       }
     }
+
+    /// Clears the range, then runs the rest of the chain
+    static void clear(const RenderDatas& datas, void* _chain_begin, void* _subchain, void* _chain_end) noexcept
+    {
+      fill_black(datas);
+      next(datas, _chain_begin, _subchain, _chain_end);
+    }
+
+    struct split_params_t
+    {
+      Size segment_count; ///!< Number of equal subranges
+    };
+
+    /// Runs the rest of the chain once per segment of the range
+    static void split(const RenderDatas& datas, void* _chain_begin, void* _subchain, void* _chain_end) noexcept
+    {
+      const split_params_t& p = params<split_params_t>(_subchain);
+      const Context saved = datas.local_context;
+      const Size count = p.segment_count ? p.segment_count : 1;
+      const Size length = saved.pixel_count / count;
+
+      for (Size s = 0 ; s < count ; ++s)
+      {
+        Context& ctx = datas.local_context;
+        ctx.pixel_index = saved.pixel_index + s * length;
+        ctx.pixel_postlast_index = s + 1 == count ? saved.pixel_postlast_index : ctx.pixel_index + length;
+        ctx.pixel_count = ctx.pixel_postlast_index - ctx.pixel_index;
+        ctx.segment_index = s;
+        ctx.segment_count = count;
+        next(datas, _chain_begin, _subchain, _chain_end);
+      }
+      datas.local_context = saved;
+    }
   };
 
 } /* namespace opto */
@@ -0,0 +1,33 @@
+#pragma once
+
+#define BATCH_SIZE 64
+
+// Struct of arrays view of `count` EffectInputs
+struct EffectInputs {
+    float* pos;
+    float* time;
+};
+
+// Struct of arrays view of `count` colors
+struct EffectOutputs {
+    float* r;
+    float* g;
+    float* b;
+};
+
+// An Effect split in the part applied before the next effects (on their inputs)
+// and the part applied after them (on their outputs). Null stages are skipped.
+using BatchInputStage  = void (*)(EffectInputs in, int count);
+using BatchOutputStage = void (*)(EffectInputs in, EffectOutputs out, int count);
+using BatchFinalEffect = void (*)(EffectInputs in, EffectOutputs out, int count);
+
+struct BatchEffect {
+    BatchInputStage  input;
+    BatchOutputStage output;
+};
+
+// clang-format off
+#define BATCH_INPUT(fn_name)        void(fn_name)(EffectInputs in, int count)
+#define BATCH_OUTPUT(fn_name)       void(fn_name)(EffectInputs in, EffectOutputs out, int count)
+#define BATCH_FINAL_EFFECT(fn_name) void(fn_name)(EffectInputs in, EffectOutputs out, int count)
+// clang-format on
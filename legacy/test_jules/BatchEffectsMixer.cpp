@@ -0,0 +1,44 @@
+#include "BatchEffectsMixer.h"
+
+BatchFinalEffect BatchEffectsMixer::final;
+BatchEffect      BatchEffectsMixer::layers[NUM_LAYERS];
+
+void BatchEffectsMixer::eval(const float* pos, const float* time, EffectOutputs out, int count)
+{
+    float work_pos[BATCH_SIZE];
+    float work_time[BATCH_SIZE];
+    // Inputs seen by each layer, needed by output stages
+    float saved_pos[NUM_LAYERS][BATCH_SIZE];
+    float saved_time[NUM_LAYERS][BATCH_SIZE];
+
+    for (int begin = 0; begin < count; begin += BATCH_SIZE) {
+        const int n = count - begin < BATCH_SIZE ? count - begin : BATCH_SIZE;
+        for (int i = 0; i < n; ++i) {
+            work_pos[i]  = pos[begin + i];
+            work_time[i] = time[begin + i];
+        }
+
+        // Same order as EffectsMixer::eval : last layer sees the inputs first
+        for (int l = NUM_LAYERS - 1; l >= 0; --l) {
+            if (layers[l].output) {
+                for (int i = 0; i < n; ++i) {
+                    saved_pos[l][i]  = work_pos[i];
+                    saved_time[l][i] = work_time[i];
+                }
+            }
+            if (layers[l].input) {
+                layers[l].input({work_pos, work_time}, n);
+            }
+        }
+
+        const EffectOutputs span = {out.r + begin, out.g + begin, out.b + begin};
+        final({work_pos, work_time}, span, n);
+
+        // ... and modifies the outputs last
+        for (int l = 0; l < NUM_LAYERS; ++l) {
+            if (layers[l].output) {
+                layers[l].output({saved_pos[l], saved_time[l]}, span, n);
+            }
+        }
+    }
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "BatchEffect.h"
+#include "EffectsMixer.h"
+
+// Same layers stack as EffectsMixer, but each layer processes a whole span
+// before the next one runs, so the float math can be vectorized.
+struct BatchEffectsMixer {
+    static void eval(const float* pos, const float* time, EffectOutputs out, int count);
+
+    static BatchFinalEffect final;
+    static BatchEffect      layers[NUM_LAYERS];
+};
@@ -71,4 +71,99 @@ EFFECT(ReduceIntensity)
     return APPLY_NEXT_EFFECT() * 0.4f;
 }
 
-} // namespace Effects
\ No newline at end of file
+} // namespace Effects
+
+namespace BatchEffects {
+
+static BATCH_INPUT(BlinkInput)
+{
+    for (int i = 0; i < count; ++i) {
+        in.time[i] = in.time[i] < 0.5f ? 0.f : 0.5f;
+    }
+}
+
+static BATCH_INPUT(FreezeTimeInput)
+{
+    for (int i = 0; i < count; ++i) {
+        in.time[i] = 0.f;
+    }
+}
+
+static BATCH_INPUT(InvertTimeInput)
+{
+    for (int i = 0; i < count; ++i) {
+        in.time[i] = 1.f - in.time[i];
+    }
+}
+
+static BATCH_INPUT(InvertSpaceInput)
+{
+    for (int i = 0; i < count; ++i) {
+        in.pos[i] = 1.f - in.pos[i];
+    }
+}
+
+static BATCH_INPUT(SplitRangeInTwoInput)
+{
+    for (int i = 0; i < count; ++i) {
+        in.pos[i] = in.pos[i] < 0.5f
+                        ? 2.f * in.pos[i]
+                        : 1.f - 2.f * (in.pos[i] - 0.5f);
+    }
+}
+
+static BATCH_INPUT(PingPongInput)
+{
+    for (int i = 0; i < count; ++i) {
+        in.time[i] = sin(3.141 * in.time[i]);
+    }
+}
+
+static BATCH_OUTPUT(InvertColorsOutput)
+{
+    for (int i = 0; i < count; ++i) {
+        out.r[i] = 1.f - out.r[i];
+        out.g[i] = 1.f - out.g[i];
+        out.b[i] = 1.f - out.b[i];
+    }
+}
+
+static BATCH_OUTPUT(SinusoidalBlinkOutput)
+{
+    for (int i = 0; i < count; ++i) {
+        const float k = sin(in.time[i] * 6.28) * 0.5 + 0.5;
+        out.r[i] *= k;
+        out.g[i] *= k;
+        out.b[i] *= k;
+    }
+}
+
+static BATCH_INPUT(OffsetRangeInTimeInput)
+{
+    for (int i = 0; i < count; ++i) {
+        in.time[i] += in.pos[i];
+    }
+}
+
+static BATCH_OUTPUT(ReduceIntensityOutput)
+{
+    for (int i = 0; i < count; ++i) {
+        out.r[i] *= 0.4f;
+        out.g[i] *= 0.4f;
+        out.b[i] *= 0.4f;
+    }
+}
+
+const BatchEffect Identity          = {nullptr, nullptr};
+const BatchEffect Blink             = {BlinkInput, nullptr};
+const BatchEffect FreezeTime        = {FreezeTimeInput, nullptr};
+const BatchEffect InvertTime        = {InvertTimeInput, nullptr};
+const BatchEffect InvertSpace       = {InvertSpaceInput, nullptr};
+const BatchEffect SplitRangeInTwo   = {SplitRangeInTwoInput, nullptr};
+const BatchEffect PingPong          = {PingPongInput, nullptr};
+const BatchEffect InvertColors      = {nullptr, InvertColorsOutput};
+const BatchEffect SinusoidalBlink   = {nullptr, SinusoidalBlinkOutput};
+const BatchEffect OffsetRangeInTime = {OffsetRangeInTimeInput, nullptr};
+const BatchEffect ReduceIntensity   = {nullptr, ReduceIntensityOutput};
+
+} // namespace BatchEffects
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "BatchEffect.h"
 #include "Effect.h"
 
 namespace Effects {
@@ -16,4 +17,21 @@ EFFECT(SinusoidalBlink);
 EFFECT(OffsetRangeInTime);
 EFFECT(ReduceIntensity);
 
-} // namespace Effects
\ No newline at end of file
+} // namespace Effects
+
+// Span versions of the Effects, bit-compatible with the ones above
+namespace BatchEffects {
+
+extern const BatchEffect Identity;
+extern const BatchEffect Blink;
+extern const BatchEffect FreezeTime;
+extern const BatchEffect InvertTime;
+extern const BatchEffect InvertSpace;
+extern const BatchEffect SplitRangeInTwo;
+extern const BatchEffect PingPong;
+extern const BatchEffect InvertColors;
+extern const BatchEffect SinusoidalBlink;
+extern const BatchEffect OffsetRangeInTime;
+extern const BatchEffect ReduceIntensity;
+
+} // namespace BatchEffects
\ No newline at end of file
@@ -17,4 +17,33 @@ FINAL_EFFECT(ScrollingGradient)
     return clamp01(palette_test6.eval(in.pos * 0.1 + in.time));
 }
 
-} // namespace FinalEffects
\ No newline at end of file
+} // namespace FinalEffects
+
+// One channel of ColorPalette::eval followed by clamp01, written with the same float operations
+static void eval_clamped_channel(float a, float b, float c, float d, const float* t, float* out, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        const float cosine = cos((c * t[i] + d) * 6.28f);
+        const float v      = a + b * cosine;
+        out[i]             = min(max(v, 0.f), 1.f);
+    }
+}
+
+namespace BatchFinalEffects {
+
+BATCH_FINAL_EFFECT(ScrollingGradient)
+{
+    float t[BATCH_SIZE];
+    for (int begin = 0; begin < count; begin += BATCH_SIZE) {
+        const int n = count - begin < BATCH_SIZE ? count - begin : BATCH_SIZE;
+        for (int i = 0; i < n; ++i) {
+            t[i] = in.pos[begin + i] * 0.1 + in.time[begin + i];
+        }
+        const ColorPalette& p = palette_test6;
+        eval_clamped_channel(p.a.x, p.b.x, p.c.x, p.d.x, t, out.r + begin, n);
+        eval_clamped_channel(p.a.y, p.b.y, p.c.y, p.d.y, t, out.g + begin, n);
+        eval_clamped_channel(p.a.z, p.b.z, p.c.z, p.d.z, t, out.b + begin, n);
+    }
+}
+
+} // namespace BatchFinalEffects
\ No newline at end of file
@@ -1,9 +1,16 @@
 #pragma once
 
+#include "BatchEffect.h"
 #include "Effect.h"
 
 namespace FinalEffects {
 
 FINAL_EFFECT(ScrollingGradient);
 
+}
+
+namespace BatchFinalEffects {
+
+BATCH_FINAL_EFFECT(ScrollingGradient);
+
 }
\ No newline at end of file
@@ -1,12 +1,16 @@
 #include <FastLED.h>
 #include "ColorPalette.h"
 #include "EffectsMixer.h"
+#include "BatchEffectsMixer.h"
 #include "MyEffects.h"
 #include "MyFinalEffects.h"
 #include "util.h"
 
 #define DATA_PIN 2
 
+// Compare the per pixel EffectsMixer to the BatchEffectsMixer every frame
+// #define BENCHMARK_BATCH
+
 CRGB leds[NUM_LEDS];
 
 void setup()
@@ -27,7 +31,54 @@ void setup()
      EffectsMixer::layers[3] = &Effects::PingPong;
     // EffectsMixer::layers[4] = &Effects::SinusoidalBlink;
     // EffectsMixer::layers[5] = &Effects::OffsetRangeInTime;
+
+    // Same stack for the batch engine
+    BatchEffectsMixer::final = &BatchFinalEffects::ScrollingGradient;
+    for (auto& layer : BatchEffectsMixer::layers) {
+        layer = BatchEffects::Identity;
+    }
+    BatchEffectsMixer::layers[0] = BatchEffects::ReduceIntensity;
+    BatchEffectsMixer::layers[1] = BatchEffects::InvertTime;
+    BatchEffectsMixer::layers[3] = BatchEffects::PingPong;
+}
+
+#ifdef BENCHMARK_BATCH
+void benchmark_batch(const EffectInput& input)
+{
+    static float pos[NUM_LEDS], time[NUM_LEDS];
+    static float r[NUM_LEDS], g[NUM_LEDS], b[NUM_LEDS];
+
+    EffectInput in = input;
+    unsigned long begin = micros();
+    for (int i = 0; i < NUM_LEDS; ++i) {
+        in.pos         = i / (float)(NUM_LEDS - 1);
+        const auto col = EffectsMixer::eval(in);
+        r[i] = col.x, g[i] = col.y, b[i] = col.z;
+    }
+    unsigned long scalar = micros() - begin;
+
+    begin = micros();
+    for (int i = 0; i < NUM_LEDS; ++i) {
+        pos[i]  = i / (float)(NUM_LEDS - 1);
+        time[i] = input.time;
+    }
+    static float br[NUM_LEDS], bg[NUM_LEDS], bb[NUM_LEDS];
+    BatchEffectsMixer::eval(pos, time, {br, bg, bb}, NUM_LEDS);
+    unsigned long batch = micros() - begin;
+
+    int mismatches = 0;
+    for (int i = 0; i < NUM_LEDS; ++i) {
+        mismatches += r[i] != br[i] || g[i] != bg[i] || b[i] != bb[i];
+    }
+
+    Serial.print("Pixels par seconde : ");
+    Serial.print(NUM_LEDS * 1000000.f / scalar);
+    Serial.print(" : Batch : ");
+    Serial.print(NUM_LEDS * 1000000.f / batch);
+    Serial.print(" : Differences : ");
+    Serial.println(mismatches);
 }
+#endif
 
 void loop()
 {
@@ -62,6 +113,11 @@ void loop()
       fpscptr = 0;
     }
     
+#ifdef BENCHMARK_BATCH
+    if (cptr == 0)
+      benchmark_batch(input);
+#endif
+    
     delay(10);
     input.time = fract(input.time + 0.0003f);
 }
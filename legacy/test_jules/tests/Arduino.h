@@ -0,0 +1,12 @@
+#pragma once
+
+// Host stand-in for the few Arduino.h names the effects use, for the tests of this directory.
+// Build with -fpermissive as the Arduino IDE does (vec3::operator+ is not const).
+
+#include <math.h>
+#include <algorithm>
+
+using std::max;
+using std::min;
+
+typedef bool boolean;
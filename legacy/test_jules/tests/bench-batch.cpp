@@ -0,0 +1,79 @@
+// g++ -std=c++11 -O2 -fpermissive -I. -I.. bench-batch.cpp ../EffectsMixer.cpp ../BatchEffectsMixer.cpp ../MyEffects.cpp ../MyFinalEffects.cpp -o bench-batch
+
+#include "BatchEffectsMixer.h"
+#include "MyEffects.h"
+#include "MyFinalEffects.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+// Random layers stacks rendered by the per pixel EffectsMixer and the BatchEffectsMixer :
+// colors must be bit identical, then prints the pixels per second of both.
+// Usage : bench-batch [seed]
+
+static const Effect effects[] = {
+    Effects::Identity, Effects::Blink, Effects::FreezeTime, Effects::InvertTime,
+    Effects::InvertSpace, Effects::SplitRangeInTwo, Effects::PingPong, Effects::InvertColors,
+    Effects::SinusoidalBlink, Effects::OffsetRangeInTime, Effects::ReduceIntensity};
+
+static const BatchEffect batch_effects[] = {
+    BatchEffects::Identity, BatchEffects::Blink, BatchEffects::FreezeTime, BatchEffects::InvertTime,
+    BatchEffects::InvertSpace, BatchEffects::SplitRangeInTwo, BatchEffects::PingPong, BatchEffects::InvertColors,
+    BatchEffects::SinusoidalBlink, BatchEffects::OffsetRangeInTime, BatchEffects::ReduceIntensity};
+
+static constexpr int EffectsCount = sizeof(effects) / sizeof(*effects);
+static constexpr int Stacks       = 200;
+
+int main(int argc, char* const argv[])
+{
+    using clock = std::chrono::steady_clock;
+    srand(argc >= 2 ? atoi(argv[1]) : 42);
+
+    EffectsMixer::final      = &FinalEffects::ScrollingGradient;
+    BatchEffectsMixer::final = &BatchFinalEffects::ScrollingGradient;
+
+    static float pos[NUM_LEDS], time[NUM_LEDS];
+    static float r[NUM_LEDS], g[NUM_LEDS], b[NUM_LEDS];
+    int          errors = 0;
+    double       scalar = 0, batch = 0;
+
+    for (int stack = 0; stack < Stacks; ++stack) {
+        for (int layer = 0; layer < NUM_LAYERS; ++layer) {
+            const int k                     = rand() % EffectsCount;
+            EffectsMixer::layers[layer]      = effects[k];
+            BatchEffectsMixer::layers[layer] = batch_effects[k];
+        }
+        const float t = rand() / (float)RAND_MAX;
+
+        const auto begin = clock::now();
+        for (int i = 0; i < NUM_LEDS; ++i) {
+            pos[i]  = i / (float)(NUM_LEDS - 1);
+            time[i] = t;
+        }
+        BatchEffectsMixer::eval(pos, time, {r, g, b}, NUM_LEDS);
+        const auto middle = clock::now();
+
+        int mismatches = 0;
+        for (int i = 0; i < NUM_LEDS; ++i) {
+            EffectInput in;
+            in.pos         = i / (float)(NUM_LEDS - 1);
+            in.time        = t;
+            const vec3 col = EffectsMixer::eval(in);
+            mismatches += col.x != r[i] || col.y != g[i] || col.z != b[i];
+        }
+        const auto end = clock::now();
+
+        if (mismatches) {
+            printf("stack %d : %d differing pixels\n", stack, mismatches);
+            ++errors;
+        }
+        batch += std::chrono::duration<double>(middle - begin).count();
+        scalar += std::chrono::duration<double>(end - middle).count();
+    }
+
+    printf("Pixels par seconde : %.1f M : Batch : %.1f M\n", Stacks * NUM_LEDS / scalar * 1e-6, Stacks * NUM_LEDS / batch * 1e-6);
+    printf("%d errors\n", errors);
+    return errors ? 1 : 0;
+}